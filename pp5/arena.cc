@@ -0,0 +1,55 @@
+/* File: arena.cc
+ * --------------
+ * Implementation of the Arena allocator.
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+#include "utility.h"
+
+Arena compilationArena;
+
+// the strictest alignment of the basic types (gcc 4.7 has no max_align_t)
+union MaxAlign { long double d; long long l; void *p; };
+static const size_t Alignment = alignof(MaxAlign);
+
+Arena::Arena(size_t size)
+  : next(NULL), limit(NULL), chunkSize(size), bytesAllocated(0) {}
+
+void *Arena::Allocate(size_t size)
+{
+  size = (size + Alignment - 1) & ~(Alignment - 1);
+  if (size > (size_t)(limit - next))
+  {
+    // a request bigger than a chunk gets a chunk of its own, and the
+    // current chunk stays in use for the smaller requests to come
+    size_t n = size > chunkSize ? size : chunkSize;
+    char *chunk = (char *)malloc(n);
+    if (!chunk)
+      Failure("Out of memory");
+    chunks.push_back(chunk);
+    if (size > chunkSize)
+    {
+      bytesAllocated += size;
+      return chunk;
+    }
+    next = chunk;
+    limit = chunk + n;
+  }
+  void *result = next;
+  next += size;
+  bytesAllocated += size;
+  return result;
+}
+
+void Arena::Release()
+{
+  for (int i = (int)finalizers.size() - 1; i >= 0; i--)
+    finalizers[i].destroy(finalizers[i].object);
+  finalizers.clear();
+  for (size_t i = 0; i < chunks.size(); i++)
+    free(chunks[i]);
+  chunks.clear();
+  next = limit = NULL;
+  bytesAllocated = 0;
+}
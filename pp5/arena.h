@@ -0,0 +1,76 @@
+/* File: arena.h
+ * -------------
+ * An Arena hands out memory by bumping a pointer through large chunks
+ * and gives it all back at once. Nothing allocated from an arena is
+ * freed on its own; Release() destroys every object made with New()
+ * (in reverse order of creation) and frees the chunks together.
+ *
+ * The compiler uses two kinds of arena. The objects that live for the
+ * whole compilation (ast nodes, Tac instructions, Locations) come from
+ * compilationArena through their class operator new, so the usual
+ * "new Foo(...)" places them there. The analyses done for register
+ * allocation (basic blocks, liveness sets) are made with New() in an
+ * arena owned by the CodeGenerator that is released as soon as each
+ * function has been emitted, so the memory they need is bounded by the
+ * largest function rather than by the whole program.
+ *
+ * Sample usage:
+ *
+ *     Arena arena;
+ *     BasicBlock *block = arena.New<BasicBlock>(0);
+ *     ...
+ *     arena.Release();    // destroys block and frees its memory
+ */
+
+#ifndef _H_arena
+#define _H_arena
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+#include <utility>
+
+class Arena {
+    struct Finalizer {
+      void (*destroy)(void *object);
+      void *object;
+    };
+
+    std::vector<char*> chunks;
+    std::vector<Finalizer> finalizers;
+    char *next, *limit;     // free space left in the newest chunk
+    size_t chunkSize;
+    size_t bytesAllocated;
+
+    template <class T> static void Destroy(void *object)
+        { static_cast<T*>(object)->~T(); }
+
+  public:
+    Arena(size_t chunkSize = 64 * 1024);
+    ~Arena() { Release(); }
+
+          // Returns size bytes of memory aligned for any type
+    void *Allocate(size_t size);
+
+          // Constructs a T in the arena. Its destructor is run by Release()
+    template <class T, class... Args> T *New(Args&&... args)
+        { T *object = new (Allocate(sizeof(T))) T(std::forward<Args>(args)...);
+          if (!__has_trivial_destructor(T))
+            finalizers.push_back({Destroy<T>, object});
+          return object; }
+
+          // Destroys the objects made by New() and frees all the memory
+    void Release();
+
+          // Bytes handed out since the last Release()
+    size_t BytesAllocated() { return bytesAllocated; }
+
+  private:
+    Arena(const Arena &);             // not copyable
+    Arena &operator=(const Arena &);
+};
+
+    // Holds everything that lives until the end of compilation
+extern Arena compilationArena;
+
+#endif
@@ -36,6 +36,7 @@
 #include "codegen.h"
 #include "errors.h"
 #include "hashtable.h"
+#include "arena.h"
 
 extern CodeGenerator CG;
 
@@ -55,6 +56,11 @@ class Node
   public:
     Node(yyltype loc);
     Node();
+
+         // The tree is kept until the end of compilation, so every
+         // node is allocated in compilationArena
+    static void *operator new(size_t size) { return compilationArena.Allocate(size); }
+    static void operator delete(void *) {}
     
     yyltype *GetLocation()   { return location; }
     void SetParent(Node *p)  { parent = p; }
@@ -123,7 +123,7 @@ void FnDecl::Emit()
     if (cla)
     {
         var = new VarDecl(new Identifier(yyltype(), "this"), cla->GetType());
-        var->SetLoc(new Location(Segment::fpRelative, para, "this"));
+        var->SetLoc(CG.GenLocation(Segment::fpRelative, para, "this"));
         para += 4;
         Insert("this", var);
         formalLocs->Append(var->GetLoc());
@@ -132,7 +132,7 @@ void FnDecl::Emit()
     {
         var = formals->Nth(i);
         const char *name = var->GetName();
-        var->SetLoc(new Location(Segment::fpRelative, para, name));
+        var->SetLoc(CG.GenLocation(Segment::fpRelative, para, name));
         para += 4;
         Insert(name, var);
         formalLocs->Append(var->GetLoc());
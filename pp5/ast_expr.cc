@@ -68,34 +68,27 @@ void RelationalExpr::Emit()
 {
     CompoundExpr::Emit();
     std::string opName(op->GetName());
-    bool l = !opName.compare("<"), g = !opName.compare(">"),
-        le = !opName.compare("<="), ge = !opName.compare(">=");
-    Location *diff, *equal;
-    if (l || le) diff = CG.GenBinaryOp("<", left->GetLoc(), right->GetLoc());
-    if (g || ge) diff = CG.GenBinaryOp("<", right->GetLoc(), left->GetLoc());
-    if (l || g) loc = diff;
-    else
-    {
-        if (le) equal = CG.GenBinaryOp("==", left->GetLoc(), right->GetLoc());
-        else equal = CG.GenBinaryOp("==", right->GetLoc(), left->GetLoc());
-        loc = CG.GenBinaryOp("||", diff, equal);
-    }
+    if (!opName.compare(">"))
+        loc = CG.GenBinaryOp("<", right->GetLoc(), left->GetLoc());
+    else loc = CG.GenBinaryOp(op->GetName(), left->GetLoc(), right->GetLoc());
 }
 
 void EqualityExpr::Emit()
 {
     CompoundExpr::Emit();
     std::string opName(op->GetName());
-    Location *equal = NULL;
-    if (left->GetType() == Type::stringType && right->GetType() == Type::stringType)
-        equal = CG.GenBuiltInCall(BuiltIn::StringEqual, left->GetLoc(), right->GetLoc());
-    else equal = CG.GenBinaryOp("==", left->GetLoc(), right->GetLoc());
+    if (left->GetType() != Type::stringType || right->GetType() != Type::stringType)
+    {
+        loc = CG.GenBinaryOp(op->GetName(), left->GetLoc(), right->GetLoc());
+        return;
+    }
+    Location *equal = CG.GenBuiltInCall(BuiltIn::StringEqual, left->GetLoc(), right->GetLoc());
     if (!opName.compare("==")) loc = equal;
     else
     {
-        BoolConstant fal = BoolConstant(yyltype(), false);
-        fal.Emit();
-        loc = CG.GenBinaryOp("==", equal, fal.GetLoc());
+        BoolConstant tru = BoolConstant(yyltype(), true);
+        tru.Emit();
+        loc = CG.GenBinaryOp("^", equal, tru.GetLoc());
     }
 }
 
@@ -105,9 +98,9 @@ void LogicalExpr::Emit()
     if (left) loc = CG.GenBinaryOp(op->GetName(), left->GetLoc(), right->GetLoc());
     else
     {
-        BoolConstant fal = BoolConstant(yyltype(), false);
-        fal.Emit();
-        loc = CG.GenBinaryOp("==", right->GetLoc(), fal.GetLoc());
+        BoolConstant tru = BoolConstant(yyltype(), true);
+        tru.Emit();
+        loc = CG.GenBinaryOp("^", right->GetLoc(), tru.GetLoc());
     }
 }
 
@@ -116,8 +109,8 @@ void AssignExpr::Emit()
     CompoundExpr::Emit();
     ArrayAccess *l1 = dynamic_cast<ArrayAccess*>(left);
     FieldAccess *l2 = dynamic_cast<FieldAccess*>(left);
-    if (l1) CG.GenStore(left->GetLoc(), right->GetLoc(), 0);
-    else if (l2 && l2->GetOffset()) CG.GenStore(left->GetLoc(), right->GetLoc(), l2->GetOffset());
+    if (l1) CG.GenStore(left->GetLoc(), right->GetLoc(), 0, l1->GetMemory());
+    else if (l2 && l2->GetOffset()) CG.GenStore(left->GetLoc(), right->GetLoc(), l2->GetOffset(), FieldMemory);
     else CG.GenAssign(left->GetLoc(), right->GetLoc());
     loc = left->GetLoc();
 }
@@ -144,7 +137,7 @@ void ArrayAccess::Emit()
     subscript->Emit();
     zero.Emit();
     Location *check1 = CG.GenBinaryOp("<", subscript->GetLoc(), zero.GetLoc()),
-        *length = CG.GenLoad(base->GetLoc(), -4),
+        *length = CG.GenLoad(base->GetLoc(), -4, true),
         *check2 = CG.GenBinaryOp("<", subscript->GetLoc(), length),
         *check3 = CG.GenBinaryOp("==", check2, zero.GetLoc()),
         *check = CG.GenBinaryOp("||", check1, check3);
@@ -159,9 +152,20 @@ void ArrayAccess::Emit()
     Location *pos = CG.GenBinaryOp("*", four.GetLoc(), subscript->GetLoc()),
         *addr = CG.GenBinaryOp("+", base->GetLoc(), pos);
     AssignExpr *assign = dynamic_cast<AssignExpr*>(parent);
-    if (!assign || assign->GetLeft() != this) loc = CG.GenLoad(addr, 0);
+    if (!assign || assign->GetLeft() != this) loc = CG.GenLoad(addr, 0, false, GetMemory());
     else loc = addr;
 }
+
+MemoryClass ArrayAccess::GetMemory()
+{
+    Type *type = GetType();
+    if (type == Type::intType) return IntElement;
+    if (type == Type::boolType) return BoolElement;
+    if (type == Type::stringType) return StringElement;
+    if (dynamic_cast<NamedType*>(type)) return ObjectElement;
+    if (dynamic_cast<ArrayType*>(type)) return ArrayElement;
+    return AnyMemory;
+}
      
 FieldAccess::FieldAccess(Expr *b, Identifier *f) 
   : LValue(b? Join(b->GetLocation(), f->GetLocation()) : *f->GetLocation()) {
@@ -179,7 +183,7 @@ void FieldAccess::Emit()
     {
         loc = base ? base->GetLoc() : GetFn()->Lookup("this")->GetLoc();
         AssignExpr *assign = dynamic_cast<AssignExpr*>(parent);
-        if (!assign || assign->GetLeft() != this) loc = CG.GenLoad(loc, offset);
+        if (!assign || assign->GetLeft() != this) loc = CG.GenLoad(loc, offset, false, FieldMemory);
     }
     else loc = var->GetLoc();
 }
@@ -228,7 +232,7 @@ void Call::Emit()
     if (base && dynamic_cast<ArrayType*>(base->GetType()))
     {
         base->Emit();
-        loc = CG.GenLoad(base->GetLoc(), -4);
+        loc = CG.GenLoad(base->GetLoc(), -4, true);
         return;
     }
     FnDecl *fn = FindField();
@@ -238,16 +242,17 @@ void Call::Emit()
     if (base) base->Emit();
     if (ifLCall)
     {
-        for (int i = actuals->NumElements() - 1; i >= 0; --i) CG.GenPushParam(actuals->Nth(i)->GetLoc());
+        for (int i = actuals->NumElements() - 1; i >= 0; --i) CG.GenPushParam(actuals->Nth(i)->GetLoc(), i);
         loc = CG.GenLCall(label, fn->GetType() != Type::voidType);
     }
     else
     {
         ClassDecl *cla = base ? GetProgram()->Query(((NamedType*)base->GetType())->GetName()) : GetClass();
         Location *baseLoc = base ? base->GetLoc() : GetFn()->Lookup("this")->GetLoc(),
-            *vtable = CG.GenLoad(baseLoc, 0), *code = CG.GenLoad(vtable, cla->GetOffset(fn->GetLabel()));
-        for (int i = actuals->NumElements() - 1; i >= 0; --i) CG.GenPushParam(actuals->Nth(i)->GetLoc());
-        CG.GenPushParam(baseLoc);
+            *vtable = CG.GenLoad(baseLoc, 0, true),
+            *code = CG.GenLoad(vtable, cla->GetOffset(fn->GetLabel()), true);
+        for (int i = actuals->NumElements() - 1; i >= 0; --i) CG.GenPushParam(actuals->Nth(i)->GetLoc(), i + 1);
+        CG.GenPushParam(baseLoc, 0);
         loc = CG.GenACall(code, fn->GetType() != Type::voidType);
     }
     CG.GenPopParams(actuals->NumElements() * 4 + (ifLCall ? 0 : 4));
@@ -295,7 +300,7 @@ void NewExpr::Emit()
     IntConstant size = IntConstant(yyltype(), cla->GetSize());
     size.Emit();
     Location *left = CG.GenBuiltInCall(BuiltIn::Alloc, size.GetLoc()), *right = CG.GenLoadLabel(name);
-    CG.GenStore(left, right, 0);
+    CG.GenStore(left, right, 0, HeaderMemory);
     loc = left;
 }
 
@@ -317,7 +322,7 @@ void NewArrayExpr::Emit()
     four.Emit();
     Location *bytes = CG.GenBinaryOp("*", total, four.GetLoc()),
         *array = CG.GenBuiltInCall(BuiltIn::Alloc, bytes);
-    CG.GenStore(array, size->GetLoc(), 0);
+    CG.GenStore(array, size->GetLoc(), 0, HeaderMemory);
     loc = CG.GenBinaryOp("+", array, four.GetLoc());
 }
 
@@ -182,6 +182,7 @@ class ArrayAccess : public LValue
     ArrayAccess(yyltype loc, Expr *base, Expr *subscript);
     void Emit();
     Type *GetType() { return ((ArrayType*)base->GetType())->GetElemType(); }
+    MemoryClass GetMemory(); // of the element
 };
 
 /* Note that field access is used both for qualified names
@@ -34,7 +34,7 @@ void Program::Build()
         if (var)
         {
             name = var->GetName();
-            var->SetLoc(new Location(Segment::gpRelative, offset, name));
+            var->SetLoc(CG.GenLocation(Segment::gpRelative, offset, name));
             offset += 4;
             Insert(name, var);
         }
@@ -71,7 +71,7 @@ void StmtBlock::Emit()
     {
         VarDecl *var = decls->Nth(i);
         const char *name = var->GetName();
-        var->SetLoc(new Location(Segment::fpRelative, fn->GetOffset(), name));
+        var->SetLoc(CG.GenLocation(Segment::fpRelative, fn->GetOffset(), name));
         fn->UpdateOffset();
         fn->Insert(name, var);
     }
@@ -0,0 +1,122 @@
+/* File: bitvector.h
+ * -----------------
+ * A BitVector is a fixed-size set of small non-negative integers
+ * stored densely, one bit per possible element. The backend numbers
+ * the Locations of each function 0, 1, 2, ... so the dataflow sets
+ * used for liveness can be kept as BitVectors: union, difference and
+ * comparison then work a machine word at a time instead of walking
+ * a tree and comparing names.
+ *
+ * Sample usage:
+ *
+ *     BitVector live(numLocations);
+ *     live.Set(3);
+ *     changed = live.UnionWith(successorLive);
+ *     for (int i = live.NextSetBit(0); i >= 0; i = live.NextSetBit(i + 1))
+ *        ...
+ */
+
+#ifndef _H_bitvector
+#define _H_bitvector
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "utility.h" // for Assert()
+
+class BitVector {
+  public:
+    typedef uint64_t Word;
+    static const int BitsPerWord = 64;
+
+  private:
+    std::vector<Word> words;
+    int numBits;
+
+    static int WordsFor(int n) { return (n + BitsPerWord - 1) / BitsPerWord; }
+
+  public:
+          // Creates an empty set able to hold the elements 0..n-1
+    BitVector(int n = 0) : words(WordsFor(n), 0), numBits(n) {}
+
+          // Changes the capacity to n elements and empties the set
+    void Resize(int n) { words.assign(WordsFor(n), 0); numBits = n; }
+
+    int NumBits() const { return numBits; }
+
+    void Set(int i)
+        { Assert(i >= 0 && i < numBits);
+          words[i / BitsPerWord] |= Word(1) << (i % BitsPerWord); }
+    void Reset(int i)
+        { Assert(i >= 0 && i < numBits);
+          words[i / BitsPerWord] &= ~(Word(1) << (i % BitsPerWord)); }
+    bool Test(int i) const
+        { Assert(i >= 0 && i < numBits);
+          return (words[i / BitsPerWord] >> (i % BitsPerWord)) & 1; }
+
+          // Removes every element
+    void Clear() { std::fill(words.begin(), words.end(), 0); }
+
+          // Adds every element of other to this set. Returns true
+          // if this set grew.
+    bool UnionWith(const BitVector &other)
+        { Assert(numBits == other.numBits);
+          Word grew = 0;
+          for (size_t i = 0; i < words.size(); i++) {
+            Word merged = words[i] | other.words[i];
+            grew |= merged ^ words[i];
+            words[i] = merged;
+          }
+          return grew != 0; }
+
+          // Removes every element of other from this set
+    void Subtract(const BitVector &other)
+        { Assert(numBits == other.numBits);
+          for (size_t i = 0; i < words.size(); i++)
+            words[i] &= ~other.words[i]; }
+
+          // Sets this to gen | (out - kill), the usual backward transfer
+          // function, in a single pass. Returns true if the set changed.
+    bool AssignTransfer(const BitVector &gen, const BitVector &out,
+                        const BitVector &kill)
+        { Assert(numBits == gen.numBits && numBits == out.numBits
+                 && numBits == kill.numBits);
+          Word diff = 0;
+          for (size_t i = 0; i < words.size(); i++) {
+            Word w = gen.words[i] | (out.words[i] & ~kill.words[i]);
+            diff |= w ^ words[i];
+            words[i] = w;
+          }
+          return diff != 0; }
+
+    bool operator==(const BitVector &other) const
+        { return numBits == other.numBits && words == other.words; }
+    bool operator!=(const BitVector &other) const
+        { return !(*this == other); }
+
+          // Returns the smallest element >= from, or -1 if there is none
+    int NextSetBit(int from) const
+        { if (from < 0) from = 0;
+          if (from >= numBits) return -1;
+          size_t w = from / BitsPerWord;
+          Word bits = words[w] & (~Word(0) << (from % BitsPerWord));
+          while (true) {
+            if (bits) return w * BitsPerWord + __builtin_ctzll(bits);
+            if (++w >= words.size()) return -1;
+            bits = words[w];
+          } }
+
+          // Returns the number of elements in the set
+    int Count() const
+        { int n = 0;
+          for (size_t i = 0; i < words.size(); i++)
+            n += __builtin_popcountll(words[i]);
+          return n; }
+
+    bool IsEmpty() const
+        { for (size_t i = 0; i < words.size(); i++)
+            if (words[i]) return false;
+          return true; }
+};
+
+#endif
@@ -0,0 +1,456 @@
+/* File: bounds.cc
+ * ---------------
+ * Implementation of the BoundsProver class.
+ */
+
+#include "bounds.h"
+#include <climits>
+#include <string.h>
+
+// The relation that holds when code does not
+static Mips::OpCode Negate(Mips::OpCode code)
+{
+  switch (code)
+  {
+    case Mips::Less: return Mips::Ge;
+    case Mips::Le:   return Mips::Gt;
+    case Mips::Gt:   return Mips::Le;
+    case Mips::Ge:   return Mips::Less;
+    case Mips::Eq:   return Mips::Ne;
+    case Mips::Ne:   return Mips::Eq;
+    default: Failure("No negation of op %d", code); return code;
+  }
+}
+
+// Whether a BinaryOp gives 0 or 1 only
+static bool IsTest(Instruction *tac)
+{
+  auto binaryTac = TacCast<BinaryOp>(tac);
+  if (!binaryTac)
+    return false;
+  switch (binaryTac->GetCode())
+  {
+    case Mips::Eq: case Mips::Ne: case Mips::Less: case Mips::Le:
+    case Mips::Gt: case Mips::Ge: case Mips::And: case Mips::Or:
+      return true;
+    default:
+      return false;
+  }
+}
+
+BoundsProver::BoundsProver(List<BasicBlock*> *blocks, DominatorTree *d,
+                           LocationTable *locations)
+  : domTree(d), steps(0)
+{
+  int n = locations->NumElements();
+  defOf.assign(n, NULL);
+  defBlock.assign(n, NULL);
+  factsAbout.resize(n);
+  storesTo.resize(n);
+  active[Upper].resize(n);
+  active[Lower].resize(n);
+
+  const std::vector<BasicBlock*> &order = domTree->ReversePostorder();
+  for (size_t j = 0; j < order.size(); j++)
+  {
+    BasicBlock *block = order[j];
+    for (int k = 0; k < block->code.NumElements(); k++)
+    {
+      auto tac = block->code.Nth(k);
+      for (auto var : tac->GetKillVars())
+      {
+        defOf[var->GetId()] = tac;
+        defBlock[var->GetId()] = block;
+      }
+      auto storeTac = TacCast<Store>(tac);
+      if (storeTac && storeTac->GetOffset() == 0 &&
+          storeTac->GetDst()->GetSegment() == fpRelative)
+        storesTo[storeTac->GetDst()->GetId()].push_back(storeTac);
+    }
+  }
+
+  // A block entered by a branch, but from blocks that halt, holds what
+  // the branch tested on the edge into it, and so do the blocks it
+  // dominates
+  for (size_t j = 1; j < order.size(); j++)
+  {
+    BasicBlock *block = order[j], *from = NULL;
+    int numFrom = 0;
+    for (int p = 0; p < block->preds.NumElements(); p++)
+    {
+      BasicBlock *pred = block->preds.Nth(p);
+      if (domTree->IsReachable(pred) && !Halts(pred))
+      {
+        from = pred;
+        numFrom++;
+      }
+    }
+    if (numFrom != 1 || from->succs.NumElements() != 2 ||
+        from->succs.Nth(0) == from->succs.Nth(1))
+      continue;
+    bool taken = from->succs.Nth(0) == block; // the label first
+    if (auto ifzTac = TacCast<IfZ>(from->Last()))
+      Assume(ifzTac->GetTest(), !taken, block, 0);
+    else if (auto ifRelTac = TacCast<IfRel>(from->Last()))
+      AssumeRelation(ifRelTac->GetCode(), Operand(ifRelTac->GetOp1(), 0),
+                     Operand(ifRelTac->GetOp2(), ifRelTac->GetImmediate()),
+                     taken, block);
+  }
+}
+
+bool BoundsProver::Halts(BasicBlock *block)
+{
+  for (int k = 0; k < block->code.NumElements(); k++)
+  {
+    auto callTac = TacCast<LCall>(block->code.Nth(k));
+    if (callTac && !strcmp(callTac->GetLabel(), "_Halt"))
+      return true;
+  }
+  return false;
+}
+
+Instruction *BoundsProver::Def(Location *v)
+{
+  if (!v || v->GetSegment() != fpRelative)
+    return NULL;
+  return defOf[v->GetId()];
+}
+
+bool BoundsProver::Constant(Location *v, long long *c)
+{
+  auto constTac = TacCast<LoadConstant>(Def(v));
+  if (!constTac)
+    return false;
+  *c = constTac->GetValue();
+  return true;
+}
+
+Location *BoundsProver::SizeOf(Location *length)
+{
+  auto loadTac = TacCast<Load>(Def(length));
+  if (!loadTac || !loadTac->IsInvariant() || loadTac->GetOffset() != -4)
+    return NULL;
+  // the array is 4 past the block allocated, whose first word is
+  // stored the size once
+  auto baseTac = TacCast<BinaryOp>(Def(loadTac->GetSrc()));
+  if (!baseTac || baseTac->GetCode() != Mips::Add)
+    return NULL;
+  Term op2 = Operand(baseTac->GetOp2(), baseTac->GetImmediate());
+  Location *block = baseTac->GetOp1();
+  auto allocTac = TacCast<LCall>(Def(block));
+  if (op2.v || op2.c != 4 || !allocTac ||
+      strcmp(allocTac->GetLabel(), "_Alloc") ||
+      storesTo[block->GetId()].size() != 1)
+    return NULL;
+  Location *size = storesTo[block->GetId()][0]->GetSrc();
+  return size->GetSegment() == fpRelative ? size : NULL;
+}
+
+BoundsProver::Term BoundsProver::Operand(Location *v, int imm)
+{
+  Term t = {v, imm};
+  long long c;
+  if (!v)
+    return t;
+  t.c = 0;
+  if (Constant(v, &c))
+  {
+    t.v = NULL;
+    t.c = c;
+  }
+  return t;
+}
+
+void BoundsProver::Assume(Location *test, bool value, BasicBlock *where,
+                          int depth)
+{
+  auto binaryTac = TacCast<BinaryOp>(Def(test));
+  if (!binaryTac || depth > 8)
+    return;
+  Location *op1 = binaryTac->GetOp1(), *op2 = binaryTac->GetOp2();
+  Term a = Operand(op1, 0), b = Operand(op2, binaryTac->GetImmediate());
+  switch (binaryTac->GetCode())
+  {
+    case Mips::Or:
+      if (!value && op2)
+      {
+        Assume(op1, false, where, depth + 1);
+        Assume(op2, false, where, depth + 1);
+      }
+      break;
+    case Mips::And:
+      if (value && op2)
+      {
+        Assume(op1, true, where, depth + 1);
+        Assume(op2, true, where, depth + 1);
+      }
+      break;
+    case Mips::Eq:
+    case Mips::Ne:
+    {
+      // a test compared with 0 (false) is the test itself or its negation
+      bool isEq = binaryTac->GetCode() == Mips::Eq;
+      if (!b.v && b.c == 0 && a.v && IsTest(Def(a.v)))
+        Assume(a.v, isEq ? !value : value, where, depth + 1);
+      else if (!a.v && a.c == 0 && b.v && IsTest(Def(b.v)))
+        Assume(b.v, isEq ? !value : value, where, depth + 1);
+      else
+        AssumeRelation(binaryTac->GetCode(), a, b, value, where);
+      break;
+    }
+    case Mips::Less:
+    case Mips::Le:
+    case Mips::Gt:
+    case Mips::Ge:
+      AssumeRelation(binaryTac->GetCode(), a, b, value, where);
+      break;
+    default:
+      break;
+  }
+}
+
+void BoundsProver::AssumeRelation(Mips::OpCode code, Term a, Term b,
+                                  bool value, BasicBlock *where)
+{
+  if ((a.v && a.v->GetSegment() != fpRelative) ||
+      (b.v && b.v->GetSegment() != fpRelative))
+    return; // a global, which the calls may change
+  if (!value)
+    code = Negate(code);
+  if (code == Mips::Gt || code == Mips::Ge)
+  {
+    std::swap(a, b);
+    code = code == Mips::Gt ? Mips::Less : Mips::Le;
+  }
+  auto add = [&](Term x, Term y, long long c) {
+    // x.v + x.c <= y.v + y.c + c
+    if (!x.v && !y.v)
+      return;
+    Fact fact = {x.v, y.v, y.c + c - x.c, where};
+    if (x.v)
+      factsAbout[x.v->GetId()].push_back(fact);
+    if (y.v && y.v != x.v)
+      factsAbout[y.v->GetId()].push_back(fact);
+  };
+  switch (code)
+  {
+    case Mips::Less: add(a, b, -1); break;
+    case Mips::Le:   add(a, b, 0); break;
+    case Mips::Eq:   add(a, b, 0); add(b, a, 0); break;
+    default: break; // Ne: nothing that one chain can use
+  }
+}
+
+// Whether v <= a + c (Upper) or v >= a + c (Lower), a NULL being 0,
+// where the block at ends. Reduced is proven but for the cycles that
+// come back to a phi being proven, which hold by induction.
+BoundsProver::Proof BoundsProver::Prove(Direction dir, Location *v,
+                                        Location *a, long long c,
+                                        BasicBlock *at)
+{
+  if (--steps < 0)
+    return Disproven;
+  if (v == a)
+    return (dir == Upper ? c >= 0 : c <= 0) ? Proven : Disproven;
+  if (!v) // 0 <= a + c is a >= -c, and likewise
+    return Prove(dir == Upper ? Lower : Upper, a, NULL, -c, at);
+  if (v->GetSegment() != fpRelative || (a && a->GetSegment() != fpRelative))
+    return Disproven;
+  long long k;
+  if (Location *size = SizeOf(a)) // the bound is as good as the size
+    a = size;
+  if (Constant(a, &k))
+    return Prove(dir, v, NULL, c + k, at);
+  if (!a && (dir == Upper ? c >= INT_MAX : c <= INT_MIN))
+    return Proven;
+
+  // Around a loop, back to a phi being proven the same bound of. The
+  // facts of the branches in the loop may still prove it outright.
+  std::vector<Term> &goals = active[dir][v->GetId()];
+  bool revisited = false;
+  Proof cycle = Disproven;
+  for (size_t g = 0; g < goals.size() && !revisited; g++)
+  {
+    if (goals[g].v != a)
+      continue;
+    revisited = true;
+    bool invariant = !a || !defBlock[a->GetId()] ||
+        (defBlock[a->GetId()] != defBlock[v->GetId()] &&
+         domTree->Dominates(defBlock[a->GetId()], defBlock[v->GetId()]));
+    if (TacCast<Phi>(Def(v)) && invariant &&
+        (dir == Upper ? c >= goals[g].c : c <= goals[g].c))
+      cycle = Reduced;
+  }
+
+  Term goal = {a, c};
+  if (!revisited)
+    goals.push_back(goal);
+  Proof result = Disproven;
+  std::vector<Fact> &facts = factsAbout[v->GetId()];
+  for (size_t f = 0; f < facts.size() && result != Proven; f++)
+  {
+    Fact fact = facts[f];
+    if (!domTree->Dominates(fact.where, at))
+      continue;
+    Proof found = Disproven;
+    if (dir == Upper && fact.x == v) // v <= y + fc
+      found = Prove(Upper, fact.y, a, c - fact.c, at);
+    else if (dir == Lower && fact.y == v) // v >= x - fc
+      found = Prove(Lower, fact.x, a, c + fact.c, at);
+    result = std::max(result, found);
+  }
+  if (revisited)
+    return std::max(result, cycle);
+  if (result != Proven)
+    result = std::max(result, ProveByDef(dir, v, a, c, at));
+  goals.pop_back();
+  return result;
+}
+
+// The same from what v is defined to be
+BoundsProver::Proof BoundsProver::ProveByDef(Direction dir, Location *v,
+                                             Location *a, long long c,
+                                             BasicBlock *at)
+{
+  Instruction *tac = Def(v);
+  if (!tac)
+    return Disproven;
+  switch (tac->GetOpcode())
+  {
+    case TacLoadConstant:
+      return Prove(dir, NULL, a, c - static_cast<LoadConstant*>(tac)->GetValue(), at);
+    case TacAssign:
+      return Prove(dir, static_cast<Assign*>(tac)->GetSrc(), a, c, at);
+    case TacBinaryOp:
+    {
+      // v = u + k, but for an overflow
+      auto binaryTac = static_cast<BinaryOp*>(tac);
+      Term op1 = Operand(binaryTac->GetOp1(), 0),
+           op2 = Operand(binaryTac->GetOp2(), binaryTac->GetImmediate());
+      Term u;
+      if (binaryTac->GetCode() == Mips::Add && op1.v && !op2.v)
+        u = {op1.v, op2.c};
+      else if (binaryTac->GetCode() == Mips::Add && !op1.v && op2.v)
+        u = {op2.v, op1.c};
+      else if (binaryTac->GetCode() == Mips::Sub && op1.v && !op2.v)
+        u = {op1.v, -op2.c};
+      else
+        return Disproven;
+      // the sum wraps only away from the bound, or must be shown not to
+      if (dir == Upper && u.c < 0 &&
+          Prove(Lower, u.v, NULL, INT_MIN - u.c, at) == Disproven)
+        return Disproven;
+      if (dir == Lower && u.c > 0 &&
+          Prove(Upper, u.v, NULL, INT_MAX - u.c, at) == Disproven)
+        return Disproven;
+      return Prove(dir, u.v, a, c - u.c, at);
+    }
+    case TacLoad:
+    {
+      // the length of an array is at least 0, and is the size it was
+      // allocated with
+      auto loadTac = static_cast<Load*>(tac);
+      if (!loadTac->IsInvariant() || loadTac->GetOffset() != -4)
+        return Disproven;
+      Proof result = Disproven;
+      if (dir == Lower)
+        result = Prove(Lower, NULL, a, c, at);
+      if (Location *size = SizeOf(v))
+        result = std::max(result, Prove(dir, size, a, c, at));
+      return result;
+    }
+    case TacPhi:
+    {
+      // as bounded as all of its arguments, at the ends of its
+      // predecessors
+      auto phiTac = static_cast<Phi*>(tac);
+      BasicBlock *block = defBlock[v->GetId()];
+      Proof result = Proven;
+      for (int e = 0; e < phiTac->NumArgs() && result != Disproven; e++)
+      {
+        BasicBlock *pred = block->preds.Nth(e);
+        if (!domTree->IsReachable(pred))
+          continue;
+        result = std::min(result, Prove(dir, phiTac->GetArg(e), a, c, pred));
+      }
+      return result;
+    }
+    default:
+      return Disproven;
+  }
+}
+
+bool BoundsProver::ProveTest(Location *test, bool value, BasicBlock *at,
+                             int depth)
+{
+  long long k;
+  if (Constant(test, &k))
+    return (k != 0) == value;
+  auto binaryTac = TacCast<BinaryOp>(Def(test));
+  if (!binaryTac || depth > 8)
+    return false;
+  Location *op1 = binaryTac->GetOp1(), *op2 = binaryTac->GetOp2();
+  Term a = Operand(op1, 0), b = Operand(op2, binaryTac->GetImmediate());
+  switch (binaryTac->GetCode())
+  {
+    case Mips::Or:
+    case Mips::And:
+    {
+      if (!op2)
+        return false;
+      // both sides when it takes both, either side otherwise
+      bool both = (binaryTac->GetCode() == Mips::Or) != value;
+      bool first = ProveTest(op1, value, at, depth + 1);
+      if (first != both)
+        return first;
+      return ProveTest(op2, value, at, depth + 1);
+    }
+    case Mips::Eq:
+    case Mips::Ne:
+    {
+      bool isEq = binaryTac->GetCode() == Mips::Eq;
+      if (!b.v && b.c == 0 && a.v && IsTest(Def(a.v)))
+        return ProveTest(a.v, isEq ? !value : value, at, depth + 1);
+      if (!a.v && a.c == 0 && b.v && IsTest(Def(b.v)))
+        return ProveTest(b.v, isEq ? !value : value, at, depth + 1);
+      return ProveRelation(binaryTac->GetCode(), a, b, value, at);
+    }
+    case Mips::Less:
+    case Mips::Le:
+    case Mips::Gt:
+    case Mips::Ge:
+      return ProveRelation(binaryTac->GetCode(), a, b, value, at);
+    default:
+      return false;
+  }
+}
+
+bool BoundsProver::ProveRelation(Mips::OpCode code, Term a, Term b,
+                                 bool value, BasicBlock *at)
+{
+  if (!value)
+    code = Negate(code);
+  if (code == Mips::Gt || code == Mips::Ge)
+  {
+    std::swap(a, b);
+    code = code == Mips::Gt ? Mips::Less : Mips::Le;
+  }
+  auto upper = [&](Term x, Term y, long long c) {
+    // x.v + x.c <= y.v + y.c + c
+    return Prove(Upper, x.v, y.v, y.c + c - x.c, at) != Disproven;
+  };
+  switch (code)
+  {
+    case Mips::Less: return upper(a, b, -1);
+    case Mips::Le:   return upper(a, b, 0);
+    case Mips::Eq:   return upper(a, b, 0) && upper(b, a, 0);
+    case Mips::Ne:   return upper(a, b, -1) || upper(b, a, -1);
+    default: return false;
+  }
+}
+
+bool BoundsProver::Prove(Location *test, bool value, BasicBlock *at)
+{
+  steps = MaxSteps;
+  return ProveTest(test, value, at, 0);
+}
@@ -0,0 +1,82 @@
+/* File: bounds.h
+ * --------------
+ * BoundsProver proves inequalities between the integer variables of a
+ * function in SSA form, so that the runtime checks on array subscripts
+ * (and the like) that are sure to pass can go. It follows ABCD (Bodik,
+ * Gupta and Sarkar, "ABCD: Eliminating Array Bounds Checks on Demand",
+ * 2000): what is known are inequalities x <= y + c, between variables
+ * or a variable and a constant, and x <= y + c is proven by a chain of
+ * them from x to y whose constants add up to at most c.
+ *
+ * The inequalities come from the instructions writing the variables
+ * (x = y + 1 gives x <= y + 1, and x >= y + 1 when the addition cannot
+ * overflow) and from the branches: below the edge on which a test
+ * x < y is true, x <= y - 1 holds. A phi is as bounded as all of its
+ * arguments are, each taken at the end of its predecessor. A chain
+ * that comes back around a loop to a phi it started from proves the
+ * bound by induction if the loop only moves the phi away from it (an
+ * index counting down, for an upper bound) and fails otherwise.
+ *
+ * The blocks that call _Halt are taken to stop there, so the facts a
+ * runtime check tests hold below it. The search for a proof is cut off
+ * after a fixed number of steps, the answer then being no.
+ */
+
+#ifndef _H_bounds
+#define _H_bounds
+
+#include <vector>
+#include "list.h"
+#include "tac.h"
+#include "cfg.h"
+#include "dominators.h"
+
+class BoundsProver {
+         // v + c, v being NULL for the constant c alone
+    struct Term { Location *v; long long c; };
+         // x <= y + c (x or y NULL for 0), below the block where
+    struct Fact { Location *x, *y; long long c; BasicBlock *where; };
+    enum Proof { Disproven, Reduced, Proven };
+    enum Direction { Upper, Lower };
+
+    DominatorTree *domTree;
+    std::vector<Instruction*> defOf;           // by location id
+    std::vector<BasicBlock*> defBlock;          // likewise
+    std::vector<std::vector<Fact> > factsAbout; // likewise
+    std::vector<std::vector<Store*> > storesTo; // at offset 0 of it
+    std::vector<std::vector<Term> > active[2];  // the bounds being proven
+    int steps;                         // left in the current search
+
+    bool Constant(Location *v, long long *c);
+    Term Operand(Location *v, int imm);
+    Location *SizeOf(Location *length);
+    void Assume(Location *test, bool value, BasicBlock *where, int depth);
+    void AssumeRelation(Mips::OpCode code, Term a, Term b, bool value,
+                        BasicBlock *where);
+    Proof Prove(Direction dir, Location *v, Location *a, long long c,
+                BasicBlock *at);
+    Proof ProveByDef(Direction dir, Location *v, Location *a, long long c,
+                     BasicBlock *at);
+    bool ProveTest(Location *test, bool value, BasicBlock *at, int depth);
+    bool ProveRelation(Mips::OpCode code, Term a, Term b, bool value,
+                       BasicBlock *at);
+
+  public:
+    static const int MaxSteps = 400;
+
+         // Gathers the definitions and the facts of the branches
+    BoundsProver(List<BasicBlock*> *blocks, DominatorTree *domTree,
+                 LocationTable *locations);
+
+         // Whether test is sure to be value (zero or not) where the
+         // block at ends
+    bool Prove(Location *test, bool value, BasicBlock *at);
+
+         // The instruction writing v, NULL for a formal or a global
+    Instruction *Def(Location *v);
+
+         // Whether the block stops the program: it calls _Halt
+    static bool Halts(BasicBlock *block);
+};
+
+#endif
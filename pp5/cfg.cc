@@ -0,0 +1,152 @@
+/* File: cfg.cc
+ * ------------
+ * Implementation of the BasicBlock class.
+ */
+
+#include "cfg.h"
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+BasicBlock::BasicBlock(int i) : index(i), loopDepth(0)
+{
+  use = def = liveIn = liveOut = NULL;
+}
+
+void BasicBlock::AddSuccessor(BasicBlock *succ)
+{
+  succs.Append(succ);
+  succ->preds.Append(this);
+}
+
+void BasicBlock::ComputeUseDef(Arena *arena, LocationTable *locations)
+{
+  use = arena->New<LiveVars>(locations);
+  def = arena->New<LiveVars>(locations);
+  for (int i = 0; i < code.NumElements(); i++)
+  {
+    // a read counts as a use only if no earlier instruction of the
+    // block wrote the variable; the VarLists are used directly, as
+    // clearing whole sets per instruction would cost O(locations)
+    for (auto var : code.Nth(i)->GetGenVars())
+      if (!def->Contains(var))
+        use->Insert(var);
+    for (auto var : code.Nth(i)->GetKillVars())
+      def->Insert(var);
+  }
+}
+
+void GetGenKill(Instruction *tac, BitVector &gen, BitVector &kill)
+{
+  gen.Clear();
+  kill.Clear();
+  for (auto var : tac->GetGenVars())
+    gen.Set(var->GetId());
+  for (auto var : tac->GetKillVars())
+    kill.Set(var->GetId());
+}
+
+void FindLoops(List<BasicBlock*> *blocks, std::vector<Loop> *loops)
+{
+  // An edge to a block that is still on the depth-first search stack
+  // goes back to the head of a loop. Decaf's control flow is structured
+  // (the CFG is reducible), so these are exactly the loops' back edges.
+  int n = blocks->NumElements();
+  std::vector<int> state(n, 0); // 0 unseen, 1 on the stack, 2 finished
+  std::vector<std::pair<BasicBlock*, int> > stack;
+  std::vector<std::pair<BasicBlock*, BasicBlock*> > backEdges;
+  if (n > 0)
+  {
+    stack.push_back(std::make_pair(blocks->Nth(0), 0));
+    state[0] = 1;
+  }
+  while (!stack.empty())
+  {
+    BasicBlock *b = stack.back().first;
+    int next = stack.back().second++;
+    if (next < b->succs.NumElements())
+    {
+      BasicBlock *succ = b->succs.Nth(next);
+      if (state[succ->GetIndex()] == 0)
+      {
+        state[succ->GetIndex()] = 1;
+        stack.push_back(std::make_pair(succ, 0));
+      }
+      else if (state[succ->GetIndex()] == 1)
+        backEdges.push_back(std::make_pair(b, succ));
+    }
+    else
+    {
+      state[b->GetIndex()] = 2;
+      stack.pop_back();
+    }
+  }
+
+  // The loop of a head is the head plus every block that reaches one
+  // of its back edges without passing through the head. A head with
+  // several back edges (a loop with continue-like jumps) is one loop.
+  std::vector<BitVector> bodies(n);
+  for (size_t e = 0; e < backEdges.size(); e++)
+  {
+    BasicBlock *tail = backEdges[e].first, *head = backEdges[e].second;
+    BitVector &body = bodies[head->GetIndex()];
+    if (body.NumBits() == 0)
+    {
+      body.Resize(n);
+      body.Set(head->GetIndex());
+    }
+    std::vector<BasicBlock*> worklist;
+    if (!body.Test(tail->GetIndex()))
+    {
+      body.Set(tail->GetIndex());
+      worklist.push_back(tail);
+    }
+    while (!worklist.empty())
+    {
+      BasicBlock *b = worklist.back();
+      worklist.pop_back();
+      for (int i = 0; i < b->preds.NumElements(); i++)
+      {
+        BasicBlock *pred = b->preds.Nth(i);
+        if (!body.Test(pred->GetIndex()))
+        {
+          body.Set(pred->GetIndex());
+          worklist.push_back(pred);
+        }
+      }
+    }
+  }
+
+  // A loop inside another has fewer blocks, so taking the loops from
+  // the biggest down puts each after those around it, the last of
+  // which to hold its head being its parent
+  std::vector<int> heads;
+  for (int h = 0; h < n; h++)
+    if (bodies[h].NumBits() > 0)
+      heads.push_back(h);
+  std::stable_sort(heads.begin(), heads.end(), [&](int a, int b) {
+    return bodies[a].Count() > bodies[b].Count();
+  });
+  loops->clear();
+  loops->reserve(heads.size());
+  for (auto h : heads)
+  {
+    Loop loop = {blocks->Nth(h), bodies[h], NULL, true};
+    for (auto &outer : *loops)
+      if (outer.body.Test(h))
+      {
+        loop.parent = &outer;
+        outer.innermost = false;
+      }
+    loops->push_back(loop);
+  }
+}
+
+void ComputeLoopDepths(List<BasicBlock*> *blocks)
+{
+  std::vector<Loop> loops;
+  FindLoops(blocks, &loops);
+  for (auto &loop : loops)
+    for (int i = loop.body.NextSetBit(0); i >= 0; i = loop.body.NextSetBit(i + 1))
+      blocks->Nth(i)->loopDepth++;
+}
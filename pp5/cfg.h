@@ -0,0 +1,74 @@
+/* File: cfg.h
+ * -----------
+ * A BasicBlock is a maximal straight-line run of Tac instructions: it
+ * can only be entered at its first instruction and only be left after
+ * its last one. The blocks of a function together with their successor
+ * and predecessor edges form the control flow graph that the dataflow
+ * analyses iterate over (CodeGenerator::BuildCFG builds it).
+ *
+ * Each block keeps a summary of the variables it uses and defines, so
+ * the liveness fixpoint only has to look at blocks. Liveness of single
+ * instructions is recovered when needed by a backward walk over the
+ * block starting from its live-out set.
+ */
+
+#ifndef _H_cfg
+#define _H_cfg
+
+#include "list.h"
+#include "tac.h"
+#include "arena.h"
+#include "bitvector.h"
+#include <vector>
+
+class BasicBlock {
+    int index;
+
+  public:
+    BasicBlock(int index);
+
+    int GetIndex()                    { return index; }
+    Instruction *First()              { return code.Nth(0); }
+    Instruction *Last()               { return code.Nth(code.NumElements() - 1); }
+
+        // Adds an edge from this block to succ (and the reverse edge)
+    void AddSuccessor(BasicBlock *succ);
+
+        // Computes use and def over the locations of the function,
+        // allocating the sets in arena
+    void ComputeUseDef(Arena *arena, LocationTable *locations);
+
+    List<Instruction*> code;   // the instructions of the block, in order
+    List<BasicBlock*> succs;   // blocks control can go to from here
+    List<BasicBlock*> preds;   // blocks control can come from
+
+    int loopDepth;      // number of loops the block is in
+
+    LiveVars *use;      // variables read before any write in the block
+    LiveVars *def;      // variables written in the block
+    LiveVars *liveIn;   // variables live on entry to the block
+    LiveVars *liveOut;  // variables live on exit from the block
+};
+
+    // Sets gen and kill to the variables read and written by tac
+void GetGenKill(Instruction *tac, BitVector &gen, BitVector &kill);
+
+    // A natural loop: its head, and the blocks that reach one of its
+    // back edges without passing through the head
+struct Loop {
+    BasicBlock *head;
+    BitVector body;   // by block index, the head included
+    Loop *parent;     // the closest loop around it, NULL if none
+    bool innermost;   // no loop inside it
+};
+
+    // Finds the loops of a function's CFG, the entry block being first.
+    // A loop comes after the loops around it, so the outermost ones are
+    // first and the innermost last.
+void FindLoops(List<BasicBlock*> *blocks, std::vector<Loop> *loops);
+
+    // Sets the loopDepth of each block of a function's CFG, the entry
+    // block being first
+void ComputeLoopDepths(List<BasicBlock*> *blocks);
+
+#endif
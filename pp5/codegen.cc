@@ -8,15 +8,29 @@
 #include "codegen.h"
 #include <string.h>
 #include "tac.h"
+#include "cfg.h"
+#include "dataflow.h"
+#include "interference.h"
+#include "linearscan.h"
+#include "dominators.h"
+#include "bounds.h"
 #include "ast_decl.h"
 #include "mips.h"
 #include "hashtable.h"
-#include <iostream>
+#include <array>
+#include <map>
+#include <set>
 #include <stack>
+#include <algorithm>
+#include <vector>
 
 CodeGenerator::CodeGenerator()
 {
   code = new List<Instruction*>();
+  globals = new LocationTable();
+  locals = NULL;
+  beginFunc = NULL;
+  numParams = 0;
 }
 
 char *CodeGenerator::NewLabel()
@@ -28,13 +42,22 @@ char *CodeGenerator::NewLabel()
 }
 
 
+Location *CodeGenerator::GenLocation(Segment seg, int offset, const char *name)
+{
+  if (seg == gpRelative)
+    return globals->Intern(seg, offset, name);
+  Assert(locals != NULL);
+  return locals->Intern(seg, offset, name);
+}
+
+
 Location *CodeGenerator::GenTempVariable()
 {
   static int nextTempNum;
   char temp[10];
   Location *result = NULL;
   sprintf(temp, "_tmp%d", nextTempNum++);
-  result = new Location(Segment::fpRelative, fn->GetOffset(), temp);
+  result = GenLocation(Segment::fpRelative, fn->GetOffset(), temp);
   fn->UpdateOffset();
   return result;
 }
@@ -68,16 +91,18 @@ void CodeGenerator::GenAssign(Location *dst, Location *src)
 }
 
 
-Location *CodeGenerator::GenLoad(Location *ref, int offset)
+Location *CodeGenerator::GenLoad(Location *ref, int offset, bool invariant,
+                                 MemoryClass memory)
 {
   Location *result = GenTempVariable();
-  code->Append(new Load(result, ref, offset));
+  code->Append(new Load(result, ref, offset, invariant, memory));
   return result;
 }
 
-void CodeGenerator::GenStore(Location *dst,Location *src, int offset)
+void CodeGenerator::GenStore(Location *dst,Location *src, int offset,
+                             MemoryClass memory)
 {
-  code->Append(new Store(dst, src, offset));
+  code->Append(new Store(dst, src, offset, memory));
 }
 
 
@@ -116,6 +141,9 @@ BeginFunc *CodeGenerator::GenBeginFunc(FnDecl *f)
   BeginFunc *result = new BeginFunc(f->GetFormals());
   code->Append(result);
   fn = f;
+  beginFunc = result;
+  locals = new LocationTable(globals);
+  result->locations = locals;
   return result;
 }
 
@@ -124,9 +152,10 @@ void CodeGenerator::GenEndFunc()
   code->Append(new EndFunc());
 }
 
-void CodeGenerator::GenPushParam(Location *param)
+void CodeGenerator::GenPushParam(Location *param, int index)
 {
-  code->Append(new PushParam(param));
+  code->Append(new PushParam(param, index));
+  numParams++;
 }
 
 void CodeGenerator::GenPopParams(int numBytesOfParams)
@@ -136,17 +165,25 @@ void CodeGenerator::GenPopParams(int numBytesOfParams)
     code->Append(new PopParams(numBytesOfParams));
 }
 
+void CodeGenerator::AppendCall(FnCall *call)
+{
+  code->Append(call);
+  if (numParams > beginFunc->maxArgs)
+    beginFunc->maxArgs = numParams;
+  numParams = 0;
+}
+
 Location *CodeGenerator::GenLCall(const char *label, bool fnHasReturnValue)
 {
   Location *result = fnHasReturnValue ? GenTempVariable() : NULL;
-  code->Append(new LCall(label, result));
+  AppendCall(new LCall(label, result, numParams));
   return result;
 }
 
 Location *CodeGenerator::GenACall(Location *fnAddr, bool fnHasReturnValue)
 {
   Location *result = fnHasReturnValue ? GenTempVariable() : NULL;
-  code->Append(new ACall(fnAddr, result));
+  AppendCall(new ACall(fnAddr, result, numParams));
   return result;
 }
  
@@ -176,9 +213,9 @@ Location *CodeGenerator::GenBuiltInCall(BuiltIn bn, Location *arg1, Location *ar
   Assert((b->numArgs == 0 && !arg1 && !arg2)
 	|| (b->numArgs == 1 && arg1 && !arg2)
 	|| (b->numArgs == 2 && arg1 && arg2));
-  if (arg2) code->Append(new PushParam(arg2));
-  if (arg1) code->Append(new PushParam(arg1));
-  code->Append(new LCall(b->label, result));
+  if (arg2) GenPushParam(arg2, 1);
+  if (arg1) GenPushParam(arg1, 0);
+  AppendCall(new LCall(b->label, result, numParams));
   GenPopParams(VarSize*b->numArgs);
   return result;
 }
@@ -192,259 +229,3286 @@ void CodeGenerator::GenVTable(const char *className, List<const char *> *methodL
 
 void CodeGenerator::DoFinalCodeGen()
 {
-  // Register allocation
-  BuildCFG();
-  LiveVariableAnalysis();
-  BuildInterferenceGraph();
-  ColorInterferenceGraph();
-
-  if (IsDebugOn("tac")) { // if debug don't translate to mips, just print Tac
-    for (int i = 0; i < code->NumElements(); i++)
-      code->Nth(i)->Print();
-  } else {
-    Mips mips;
+  bool printTac = IsDebugOn("tac"); // if debug don't translate to mips, just print Tac
+  Mips mips;
+  if (!printTac)
     mips.EmitPreamble();
-    for (int i = 0; i < code->NumElements(); i++)
-      code->Nth(i)->Emit(&mips);
+  BeginFunc *currentFunc = nullptr;
+  ModRef modRef(code, globals->NumElements());
+  for (int i = 0; i < code->NumElements(); i++)
+  {
+    auto tac = code->Nth(i);
+
+    // Register allocation, one function at a time, right before the
+    // function is emitted
+    if (auto beginFuncTac = TacCast<BeginFunc>(tac))
+    {
+      currentFunc = beginFuncTac;
+      PromoteGlobals(i, &modRef);
+      bool optimize = !OverBudget(i); // the SSA passes cost a few liveness analyses
+      if (optimize)
+      {
+        int round = 0;
+        do
+        {
+          ToSSA(i);
+          PropagateConstants(i);
+          NumberValues(i);
+          HoistInvariants(i);
+          EliminateChecks(i);
+          FromSSA(i);
+          CoalesceCopies(i);
+        } while (round++ == 0 && VersionLoops(i)); // once more for the copies
+      }
+      SelectInstructions(i);
+      if (optimize)
+        ReduceStrength(i);
+      AllocateRegisters(i);
+    }
+
+    if (printTac)
+      tac->Print();
+    else
+      tac->Emit(&mips);
+
+    // what the analyses built for the function is no longer needed
+    if (tac->GetOpcode() == TacEndFunc)
+    {
+      PrintDebug("arena", "%d bytes of analysis data",
+                 (int) functionArena.BytesAllocated());
+      currentFunc->blocks.Clear();
+      functionArena.Release();
+      currentFunc = nullptr;
+    }
   }
 }
 
-void CodeGenerator::BuildCFG()
+void CodeGenerator::PromoteGlobals(int start, ModRef *modRef)
 {
-  // build label to Instruction hashtable
-  Hashtable<Instruction*> labelToTac;
-  for (int i = 0; i < code->NumElements() - 1; i++)
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  int numGlobals = globals->NumElements();
+  if (numGlobals == 0)
+    return;
+
+  // A global is worth a local when the loads and stores it saves
+  // outweigh those added: one load on entry, a store before each exit
+  // if the function writes it, and around each call that may use it a
+  // store before (if written here) and a reload after (if the callee
+  // may write it). Each is weighted by 10 per enclosing loop, as for
+  // spill costs.
+  BuildCFG(start);
+  std::vector<double> saved(numGlobals, 0), added(numGlobals, 1);
+  BitVector written(numGlobals);
+  auto blocks = &beginFuncTac->blocks;
+  for (int j = 0; j < blocks->NumElements(); j++)
+    for (int k = 0; k < blocks->Nth(j)->code.NumElements(); k++)
+      for (auto var : blocks->Nth(j)->code.Nth(k)->GetGlobalsWritten())
+        written.Set(var->GetId());
+  for (int j = 0; j < blocks->NumElements(); j++)
   {
-    if (auto labelTac = dynamic_cast<Label*>(code->Nth(i)))
+    auto block = blocks->Nth(j);
+    double weight = 1;
+    for (int d = 0; d < block->loopDepth; d++)
+      weight *= 10;
+    for (int k = 0; k < block->code.NumElements(); k++)
     {
-      labelToTac.Enter(labelTac->GetLabel(), code->Nth(i+1));
+      auto tac = block->code.Nth(k);
+      for (auto var : tac->GetGlobalsRead())
+        saved[var->GetId()] += weight;
+      for (auto var : tac->GetGlobalsWritten())
+        saved[var->GetId()] += weight;
+      if (tac->GetOpcode() == TacReturn || tac->GetOpcode() == TacEndFunc)
+        for (int g = written.NextSetBit(0); g >= 0; g = written.NextSetBit(g + 1))
+          added[g] += weight;
+      if (auto callTac = TacCast<FnCall>(tac))
+      {
+        const BitVector &ref = modRef->Ref(callTac), &mod = modRef->Mod(callTac);
+        for (int g = 0; g < numGlobals; g++)
+          added[g] += weight * (((ref.Test(g) || mod.Test(g)) && written.Test(g)) +
+                                mod.Test(g));
+      }
     }
   }
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
 
-  // std::cout << "Debug begin..." << std::endl;
-  for (int i = 0; i < code->NumElements() - 1; i++)
+  static int nextPromotedNum;
+  std::vector<Location*> local(numGlobals);
+  int numPromoted = 0;
+  for (int g = 0; g < numGlobals; g++)
   {
-    auto tac = code->Nth(i);
-    // tac->Print();
-    if (dynamic_cast<EndFunc*>(code->Nth(i)))
-    {
+    if (saved[g] <= added[g])
       continue;
-    }
-    else if (auto ifZTac = dynamic_cast<IfZ*>(tac))
-    {
-      auto jumpToTac = labelToTac.Lookup(ifZTac->GetLabel());
-      ifZTac->next.Append(jumpToTac);
-      jumpToTac->previous.Append(ifZTac);
+    char name[16];
+    sprintf(name, "_global%d", nextPromotedNum++);
+    local[g] = locations->Intern(fpRelative,
+        OffsetToFirstLocal - beginFuncTac->GetFrameSize(), name);
+    beginFuncTac->SetFrameSize(beginFuncTac->GetFrameSize() + VarSize);
+    numPromoted++;
+  }
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("globals", "%d globals promoted in %s", numPromoted,
+             labelTac->GetLabel());
+  if (numPromoted == 0)
+    return;
 
-      ifZTac->next.Append(code->Nth(i+1));
-      code->Nth(i+1)->previous.Append(ifZTac);
+  List<Instruction*> rewritten;
+  int end = start;
+  for (;; end++)
+  {
+    auto tac = code->Nth(end);
+    List<Instruction*> after;
+    if (tac->GetOpcode() == TacBeginFunc)
+    {
+      for (int g = 0; g < numGlobals; g++)
+        if (local[g])
+          after.Append(new Assign(local[g], globals->Nth(g)));
     }
-    else if (auto gotoTac = dynamic_cast<Goto*>(tac))
+    else if (tac->GetOpcode() == TacReturn || tac->GetOpcode() == TacEndFunc)
     {
-      auto jumpToTac = labelToTac.Lookup(gotoTac->GetLabel());
-      gotoTac->next.Append(jumpToTac);
-      jumpToTac->previous.Append(gotoTac);
+      for (int g = 0; g < numGlobals; g++)
+        if (local[g] && written.Test(g))
+          rewritten.Append(new Assign(globals->Nth(g), local[g]));
     }
-    else
+    else if (auto callTac = TacCast<FnCall>(tac))
     {
-      tac->next.Append(code->Nth(i+1));
-      code->Nth(i+1)->previous.Append(tac);
+      const BitVector &ref = modRef->Ref(callTac), &mod = modRef->Mod(callTac);
+      for (int g = 0; g < numGlobals; g++)
+      {
+        if (!local[g])
+          continue;
+        if ((ref.Test(g) || mod.Test(g)) && written.Test(g))
+          rewritten.Append(new Assign(globals->Nth(g), local[g]));
+        if (mod.Test(g))
+          after.Append(new Assign(local[g], globals->Nth(g)));
+      }
     }
 
-    // std::cout << ">>> Next:" << std::endl;
-    // for (int j = 0; j < tac->next.NumElements(); j++)
-    // {
-    //   tac->next.Nth(j)->Print();
-    // }
-    // std::cout << ">>> Next end." << std::endl;
+    VarList vars(NULL, NULL, NULL, gpRelative);
+    for (auto var : tac->GetGlobalsRead())
+      vars.Add(var);
+    for (auto var : tac->GetGlobalsWritten())
+      vars.Add(var);
+    for (auto var : vars)
+      if (local[var->GetId()])
+        tac = tac->Rename(var, local[var->GetId()]);
+    rewritten.Append(tac);
+    rewritten.AppendAll(after);
+    if (tac->GetOpcode() == TacEndFunc)
+      break;
   }
-  // std::cout << "Debug end" << std::endl;
+  code->ReplaceRange(start, end + 1 - start, rewritten);
+}
+
+// Which of block's preds the edge from its succs.Nth(succIndex) is:
+// the edges are added to both lists together, so the m-th edge from
+// a pred to block is its m-th entry among the preds
+static int PredIndex(BasicBlock *block, int succIndex)
+{
+  BasicBlock *succ = block->succs.Nth(succIndex);
+  int m = 0;
+  for (int i = 0; i < succIndex; i++)
+    m += block->succs.Nth(i) == succ;
+  for (int j = 0; j < succ->preds.NumElements(); j++)
+    if (succ->preds.Nth(j) == block && m-- == 0)
+      return j;
+  Failure("Edge B%d -> B%d missing from the preds", block->GetIndex(),
+          succ->GetIndex());
+  return -1;
+}
+
+// Where the phis of block go: after its label, if it has one
+static int PhiStart(BasicBlock *block)
+{
+  return TacCast<Label>(block->First()) ? 1 : 0;
 }
 
-void CodeGenerator::LiveVariableAnalysis()
+void CodeGenerator::ToSSA(int start)
 {
-  bool changed = true;
-  while (changed)
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  BuildCFG(start);
+  LiveVariableAnalysis(start);
+  auto blocks = &beginFuncTac->blocks;
+  int numBlocks = blocks->NumElements(), numInstructions = 0;
+  int numLocations = locations->NumElements();
+  DominatorTree domTree(blocks);
+
+  // The blocks where each variable is written
+  std::vector<std::vector<BasicBlock*> > defSites(numLocations);
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    numInstructions += block->code.NumElements();
+    if (!domTree.IsReachable(block))
+      continue;
+    for (int k = 0; k < block->code.NumElements(); k++)
+      for (auto var : block->code.Nth(k)->GetKillVars())
+      {
+        auto &sites = defSites[var->GetId()];
+        if (sites.empty() || sites.back() != block)
+          sites.push_back(block);
+      }
+  }
+
+  // A variable written in several places needs a phi in the iterated
+  // dominance frontier of those places, but only where it is live: a
+  // value dead on entry to a join point needs no merging (pruned SSA)
+  std::vector<int> hasPhi(numBlocks, -1), queued(numBlocks, -1);
+  int numPhis = 0;
+  for (int id = 0; id < numLocations; id++)
+  {
+    // (a variable live on entry also has its value there to merge;
+    // otherwise a single write dominates every use it reaches)
+    std::vector<BasicBlock*> worklist = defSites[id];
+    Location *var = locations->Nth(id);
+    if (worklist.empty() ||
+        (worklist.size() == 1 && !blocks->Nth(0)->liveIn->Contains(var)))
+      continue;
+    for (auto block : worklist)
+      queued[block->GetIndex()] = id;
+    while (!worklist.empty())
+    {
+      BasicBlock *block = worklist.back();
+      worklist.pop_back();
+      for (auto join : domTree.Frontier(block))
+      {
+        if (hasPhi[join->GetIndex()] == id || !join->liveIn->Contains(var))
+          continue;
+        hasPhi[join->GetIndex()] = id;
+        join->code.InsertAt(new Phi(var, join->preds.NumElements()),
+                            PhiStart(join));
+        numPhis++;
+        if (queued[join->GetIndex()] != id)
+        {
+          queued[join->GetIndex()] = id;
+          worklist.push_back(join);
+        }
+      }
+    }
+  }
+
+  // Renaming, down the dominator tree: each write makes a new version,
+  // and each read sees the version on top of its variable's stack, but
+  // a copy between locals just makes its src's version that of its dst
+  // (the copies are folded, leaving the allocator fewer to coalesce). The
+  // first version of a variable not live on entry is the variable
+  // itself, so the temps, written once, keep their Locations; the
+  // others get a slot of their own (the frame is packed later anyway)
+  std::vector<std::vector<Location*> > versions(numLocations);
+  std::vector<int> numVersions(numLocations, 0);
+  std::vector<Location*> original(numLocations);
+  for (int id = 0; id < numLocations; id++)
+    original[id] = locations->Nth(id);
+  LiveVars *liveOnEntry = blocks->Nth(0)->liveIn;
+  auto current = [&](Location *var) {
+    auto &stack = versions[var->GetId()];
+    return stack.empty() ? var : stack.back();
+  };
+  auto newVersion = [&](Location *var) {
+    if (numVersions[var->GetId()]++ == 0 && !liveOnEntry->Contains(var))
+      return var;
+    char name[64];
+    snprintf(name, sizeof(name), "%s.%d", var->GetName(),
+             numVersions[var->GetId()]);
+    Location *version = locations->Intern(fpRelative,
+        OffsetToFirstLocal - beginFuncTac->GetFrameSize(), name);
+    beginFuncTac->SetFrameSize(beginFuncTac->GetFrameSize() + VarSize);
+    original.resize(version->GetId() + 1);
+    original[version->GetId()] = var;
+    return version;
+  };
+
+  std::vector<Location*> written; // the variables pushed, to pop them
+  int numFolded = 0;
+  std::vector<std::pair<BasicBlock*, size_t> > walk; // block, next child
+  std::vector<size_t> writtenBefore;
+  walk.push_back(std::make_pair(blocks->Nth(0), 0));
+  while (!walk.empty())
   {
-    changed = false;
-    for (int i = code->NumElements() - 1; i >= 0; i--)
+    BasicBlock *block = walk.back().first;
+    size_t next = walk.back().second++;
+    if (next == 0)
     {
-      auto tac = code->Nth(i);
+      writtenBefore.push_back(written.size());
+      List<Instruction*> renamed;
+      for (int k = 0; k < block->code.NumElements(); k++)
+      {
+        auto tac = block->code.Nth(k);
+        auto copyTac = TacCast<Assign>(tac);
+        if (copyTac && copyTac->GetDst()->GetSegment() == fpRelative &&
+            copyTac->GetSrc()->GetSegment() == fpRelative)
+        {
+          // a copy gives its dst the version of its src, and goes
+          Location *var = copyTac->GetDst();
+          versions[var->GetId()].push_back(current(copyTac->GetSrc()));
+          written.push_back(var);
+          numFolded++;
+          continue;
+        }
+        // (Rename renames the dst too, when it is also read)
+        const VarList kills = tac->GetKillVars();
+        for (auto var : tac->GetGenVars())
+          if (current(var) != var)
+            tac = tac->Rename(var, current(var));
+        for (auto var : kills)
+        {
+          Location *version = newVersion(var);
+          tac = tac->RenameDst(version);
+          versions[var->GetId()].push_back(version);
+          written.push_back(var);
+        }
+        renamed.Append(tac);
+      }
+      block->code = renamed;
 
-      LiveVars *newLiveVarsOut = new LiveVars;
-      for (int j = 0; j < tac->next.NumElements(); j++) {
-        auto nextLiveVars = tac->next.Nth(j)->liveVarsIn;
-        newLiveVarsOut->insert(nextLiveVars->begin(), nextLiveVars->end());
+      // the phis of the successors take what reaches them from here
+      for (int i = 0; i < block->succs.NumElements(); i++)
+      {
+        BasicBlock *succ = block->succs.Nth(i);
+        int j = PredIndex(block, i);
+        for (int k = PhiStart(succ); k < succ->code.NumElements(); k++)
+        {
+          auto phiTac = TacCast<Phi>(succ->code.Nth(k));
+          if (!phiTac)
+            break;
+          phiTac->SetArg(j, current(original[phiTac->GetDst()->GetId()]));
+        }
       }
+    }
+    const std::vector<BasicBlock*> &children = domTree.Children(block);
+    if (next < children.size())
+      walk.push_back(std::make_pair(children[next], 0));
+    else
+    {
+      for (size_t w = writtenBefore.back(); w < written.size(); w++)
+        versions[written[w]->GetId()].pop_back();
+      written.resize(writtenBefore.back());
+      writtenBefore.pop_back();
+      walk.pop_back();
+    }
+  }
+
+  List<Instruction*> rewritten;
+  for (int j = 0; j < numBlocks; j++)
+    rewritten.AppendAll(blocks->Nth(j)->code);
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("ssa", "%s: %d phis, %d copies folded, %d locations after "
+             "renaming", labelTac->GetLabel(), numPhis, numFolded,
+             locations->NumElements());
+  code->ReplaceRange(start, numInstructions, rewritten);
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
+}
+
+// What constant propagation knows of a variable: nothing yet (none of
+// its writes has run), the one constant all those that ran give it,
+// or that it varies
+struct LatticeValue {
+  enum { Undefined, Constant, Varying } state;
+  int constant;
+};
+
+static LatticeValue Meet(LatticeValue a, LatticeValue b)
+{
+  if (a.state == LatticeValue::Undefined)
+    return b;
+  if (b.state == LatticeValue::Undefined)
+    return a;
+  if (a.state == LatticeValue::Constant && b.state == LatticeValue::Constant &&
+      a.constant == b.constant)
+    return a;
+  return {LatticeValue::Varying, 0};
+}
+
+void CodeGenerator::PropagateConstants(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  BuildCFG(start);
+  auto blocks = &beginFuncTac->blocks;
+  int numBlocks = blocks->NumElements(), numInstructions = 0;
+  int numLocations = locations->NumElements();
 
-      if (*newLiveVarsOut != *(tac->liveVarsOut))
+  // Where each variable is read, and which are never written: the
+  // formals and what is read before being written vary
+  std::vector<std::vector<std::pair<int, int> > > uses(numLocations);
+  BitVector written(numLocations);
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    numInstructions += block->code.NumElements();
+    for (int k = 0; k < block->code.NumElements(); k++)
+    {
+      auto tac = block->code.Nth(k);
+      if (auto phiTac = TacCast<Phi>(tac))
       {
-        changed = true;
+        for (int e = 0; e < phiTac->NumArgs(); e++)
+          uses[phiTac->GetArg(e)->GetId()].push_back(std::make_pair(j, k));
       }
-      tac->liveVarsOut = newLiveVarsOut;
-      *(tac->liveVarsIn) = *newLiveVarsOut;
-      auto gens = tac->GetGenVars();
-      auto kills = tac->GetKillVars();
-      for (auto killedLoc : *(kills))
-        tac->liveVarsIn->erase(killedLoc);
-      tac->liveVarsIn->insert(gens->begin(), gens->end());
+      else
+        for (auto var : tac->GetGenVars())
+          uses[var->GetId()].push_back(std::make_pair(j, k));
+      for (auto var : tac->GetKillVars())
+        written.Set(var->GetId());
     }
   }
+  std::vector<LatticeValue> values(numLocations, {LatticeValue::Undefined, 0});
+  for (int id = 0; id < numLocations; id++)
+    if (!written.Test(id))
+      values[id].state = LatticeValue::Varying;
+  auto valueOf = [&](Location *var) {
+    if (var->GetSegment() != fpRelative)
+      return LatticeValue{LatticeValue::Varying, 0};
+    return values[var->GetId()];
+  };
+
+  // Sparse conditional constant propagation (Wegman and Zadeck, 1991):
+  // the blocks run from the entry along the edges found executable,
+  // and a variable's value only ever moves from undefined to constant
+  // to varying. An instruction is looked at again only when one of its
+  // operands changes, or a phi when another edge into it is found.
+  std::vector<std::vector<bool> > executable(numBlocks);
+  for (int j = 0; j < numBlocks; j++)
+    executable[j].assign(blocks->Nth(j)->preds.NumElements(), false);
+  std::vector<bool> visited(numBlocks, false);
+  std::vector<std::pair<BasicBlock*, int> > flowWorklist; // block, succ
+  std::vector<std::pair<int, int> > ssaWorklist;          // block, instruction
+
+  // which way a branch goes: -1 if it is not known yet, 2 for both
+  auto branchOutcome = [&](Instruction *tac) {
+    LatticeValue a, b;
+    Mips::OpCode test;
+    if (auto ifTac = TacCast<IfZ>(tac))
+    {
+      a = valueOf(ifTac->GetTest());
+      b = {LatticeValue::Constant, 0};
+      test = Mips::Eq;
+    }
+    else
+    {
+      auto relTac = TacCast<IfRel>(tac);
+      a = valueOf(relTac->GetOp1());
+      b = relTac->GetOp2() ? valueOf(relTac->GetOp2())
+                           : LatticeValue{LatticeValue::Constant, relTac->GetImmediate()};
+      test = relTac->GetCode();
+    }
+    int taken;
+    if (a.state == LatticeValue::Varying || b.state == LatticeValue::Varying)
+      return 2;
+    if (a.state == LatticeValue::Undefined || b.state == LatticeValue::Undefined)
+      return -1;
+    BinaryOp::Evaluate(test, a.constant, b.constant, &taken);
+    return taken ? 0 : 1; // the branch target is the first successor
+  };
+
+  auto evaluate = [&](int j, int k) {
+    auto block = blocks->Nth(j);
+    auto tac = block->code.Nth(k);
+    LatticeValue result = {LatticeValue::Varying, 0};
+    switch (tac->GetOpcode())
+    {
+      case TacIfZ:
+      case TacIfRel:
+      {
+        int outcome = branchOutcome(tac);
+        for (int i = 0; i < block->succs.NumElements(); i++)
+          if (outcome == 2 || outcome == i)
+            flowWorklist.push_back(std::make_pair(block, i));
+        return;
+      }
+      case TacLoadConstant:
+        result = {LatticeValue::Constant, static_cast<LoadConstant*>(tac)->GetValue()};
+        break;
+      case TacAssign:
+        result = valueOf(static_cast<Assign*>(tac)->GetSrc());
+        break;
+      case TacBinaryOp:
+      {
+        auto binaryTac = static_cast<BinaryOp*>(tac);
+        LatticeValue a = valueOf(binaryTac->GetOp1());
+        LatticeValue b = binaryTac->GetOp2() ? valueOf(binaryTac->GetOp2())
+            : LatticeValue{LatticeValue::Constant, binaryTac->GetImmediate()};
+        if (a.state == LatticeValue::Varying || b.state == LatticeValue::Varying)
+          result = {LatticeValue::Varying, 0};
+        else if (a.state == LatticeValue::Undefined || b.state == LatticeValue::Undefined)
+          result = {LatticeValue::Undefined, 0};
+        else if (BinaryOp::Evaluate(binaryTac->GetCode(), a.constant, b.constant,
+                                    &result.constant))
+          result.state = LatticeValue::Constant;
+        break;
+      }
+      case TacPhi:
+      {
+        auto phiTac = static_cast<Phi*>(tac);
+        result = {LatticeValue::Undefined, 0};
+        for (int e = 0; e < phiTac->NumArgs(); e++)
+          if (executable[j][e])
+            result = Meet(result, valueOf(phiTac->GetArg(e)));
+        break;
+      }
+      default:
+        break;
+    }
+    for (auto var : tac->GetKillVars())
+    {
+      LatticeValue &value = values[var->GetId()];
+      LatticeValue lowered = Meet(value, result);
+      if (lowered.state == value.state && lowered.constant == value.constant)
+        continue;
+      value = lowered;
+      for (auto &use : uses[var->GetId()])
+        ssaWorklist.push_back(use);
+    }
+  };
 
-  ////// debug output
+  auto visit = [&](int j) {
+    auto block = blocks->Nth(j);
+    visited[j] = true;
+    for (int k = 0; k < block->code.NumElements(); k++)
+      evaluate(j, k);
+    auto opcode = block->Last()->GetOpcode();
+    if (opcode != TacIfZ && opcode != TacIfRel)
+      for (int i = 0; i < block->succs.NumElements(); i++)
+        flowWorklist.push_back(std::make_pair(block, i));
+  };
 
-  // for (int i = 0; i < code->NumElements(); i++)
-  // {
-  //   auto tac = code->Nth(i);
-  //   tac->Print();
+  visit(0);
+  while (!flowWorklist.empty() || !ssaWorklist.empty())
+  {
+    while (!flowWorklist.empty())
+    {
+      BasicBlock *from = flowWorklist.back().first;
+      int i = flowWorklist.back().second;
+      flowWorklist.pop_back();
+      BasicBlock *to = from->succs.Nth(i);
+      int j = to->GetIndex(), e = PredIndex(from, i);
+      if (executable[j][e])
+        continue;
+      executable[j][e] = true;
+      if (!visited[j])
+        visit(j);
+      else
+        for (int k = PhiStart(to); k < to->code.NumElements() &&
+                                   TacCast<Phi>(to->code.Nth(k)); k++)
+          evaluate(j, k);
+    }
+    while (!ssaWorklist.empty())
+    {
+      auto use = ssaWorklist.back();
+      ssaWorklist.pop_back();
+      if (visited[use.first])
+        evaluate(use.first, use.second);
+    }
+  }
 
-  //   // std::cout << "Kills: ";
-  //   // auto kills = tac->GetKillVars();
-  //   // for (auto loc : *(kills))
-  //   //   std::cout << loc->GetName() << " ";
-  //   // std::cout << std::endl;
+  // The variables found constant are loaded as such, the branches
+  // decided are dropped or become Gotos, and the blocks never reached
+  // go, but for the EndFunc. The phis keep the args of the edges left.
+  int numFolded = 0, numResolved = 0, numRemoved = 0;
+  auto constantOf = [&](Location *var) {
+    return var->GetSegment() == fpRelative &&
+           values[var->GetId()].state == LatticeValue::Constant;
+  };
+  List<Instruction*> rewritten;
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    if (!visited[j])
+    {
+      if (block->Last()->GetOpcode() == TacEndFunc)
+        rewritten.Append(block->Last());
+      numRemoved++;
+      continue;
+    }
+    List<Instruction*> phis, body;
+    for (int k = 0; k < block->code.NumElements(); k++)
+    {
+      auto tac = block->code.Nth(k);
+      Location *dst = tac->GetKillVars().NumElements() ? tac->GetKillVars().Nth(0) : NULL;
+      auto opcode = tac->GetOpcode();
+      if (dst && constantOf(dst) && (opcode == TacPhi || opcode == TacAssign ||
+                                     opcode == TacBinaryOp))
+      {
+        body.Append(new LoadConstant(dst, values[dst->GetId()].constant));
+        numFolded++;
+      }
+      else if (auto phiTac = TacCast<Phi>(tac))
+      {
+        int numArgs = 0;
+        for (int e = 0; e < phiTac->NumArgs(); e++)
+          numArgs += executable[j][e];
+        if (numArgs < phiTac->NumArgs())
+        {
+          Phi *kept = new Phi(phiTac->GetDst(), numArgs);
+          for (int e = 0, a = 0; e < phiTac->NumArgs(); e++)
+            if (executable[j][e])
+              kept->SetArg(a++, phiTac->GetArg(e));
+          tac = kept;
+        }
+        phis.Append(tac);
+      }
+      else if (opcode == TacIfZ || opcode == TacIfRel)
+      {
+        int outcome = branchOutcome(tac);
+        if (outcome == 0)
+          body.Append(new Goto(opcode == TacIfZ ? static_cast<IfZ*>(tac)->GetLabel()
+                                                : static_cast<IfRel*>(tac)->GetLabel()));
+        else if (outcome != 1)
+          body.Append(tac);
+        numResolved += outcome == 0 || outcome == 1;
+      }
+      else if (TacCast<Label>(tac) && k == 0)
+        rewritten.Append(tac); // ahead of the phis
+      else
+        body.Append(tac);
+    }
+    rewritten.AppendAll(phis);
+    rewritten.AppendAll(body);
+  }
 
-  //   // std::cout << "Gens: ";
-  //   // auto gens = tac->GetGenVars();
-  //   // for (auto loc : *(gens))
-  //   //   std::cout << loc->GetName() << " ";
-  //   // std::cout << std::endl;
+  // a Goto to the label right after it is a fall through
+  List<Instruction*> rewrittenNoJumps;
+  for (int i = 0; i < rewritten.NumElements(); i++)
+  {
+    auto gotoTac = TacCast<Goto>(rewritten.Nth(i));
+    auto labelTac = i + 1 < rewritten.NumElements() ?
+                    TacCast<Label>(rewritten.Nth(i + 1)) : NULL;
+    if (!gotoTac || !labelTac || strcmp(gotoTac->GetLabel(), labelTac->GetLabel()))
+      rewrittenNoJumps.Append(rewritten.Nth(i));
+  }
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("sccp", "%s: %d values folded, %d branches decided, %d blocks "
+             "removed", labelTac->GetLabel(), numFolded, numResolved, numRemoved);
+  code->ReplaceRange(start, numInstructions, rewrittenNoJumps);
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
+}
 
-  //   std::cout << "IN set: ";
-  //   for (auto loc : *(tac->liveVarsIn))
-  //     std::cout << loc->GetName() << " ";
-  //   std::cout << std::endl;
-  //   std::cout << "Out set: ";
-  //   for (auto loc : *(tac->liveVarsOut))
-  //     std::cout << loc->GetName() << " ";
-  //   std::cout << std::endl;
-  // }
+// Whether a call is to one of the built-ins, which write no memory
+// the program can already see: they do I/O or allocate a new block
+static bool IsBuiltIn(const char *label)
+{
+  for (auto &b : builtins)
+    if (!strcmp(b.label, label))
+      return true;
+  return false;
 }
 
-void CodeGenerator::BuildInterferenceGraph()
+void CodeGenerator::NumberValues(int start)
 {
-  InterferenceGraph* currentGraph = nullptr;
-  for (int i = 0; i < code->NumElements(); i++)
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  BuildCFG(start);
+  auto blocks = &beginFuncTac->blocks;
+  int numBlocks = blocks->NumElements(), numInstructions = 0;
+  int numLocations = locations->NumElements();
+  DominatorTree domTree(blocks);
+
+  // the blocks that may write memory: with a store, or a call that is
+  // not to a built-in
+  std::vector<bool> writesMemory(numBlocks, false);
+  for (int j = 0; j < numBlocks; j++)
   {
-    auto tac = code->Nth(i);
-    if (auto beginFuncTac = dynamic_cast<BeginFunc*> (tac))
+    auto block = blocks->Nth(j);
+    numInstructions += block->code.NumElements();
+    for (int k = 0; k < block->code.NumElements(); k++)
     {
-      currentGraph = &(beginFuncTac->interferenceGraph);
+      auto tac = block->code.Nth(k);
+      auto callTac = TacCast<LCall>(tac);
+      if (TacCast<Store>(tac) || TacCast<ACall>(tac) ||
+          (callTac && !IsBuiltIn(callTac->GetLabel())))
+        writesMemory[j] = true;
     }
-    if (currentGraph)
+  }
+
+  // Value numbers: two variables get the same number when they hold
+  // the same value, an expression over the same numbers giving the
+  // same number. A load also keys on the version of memory it reads,
+  // and every write to memory starts a new version, but for the
+  // invariant loads, which read the same whatever the version.
+  typedef std::array<int, 5> Key; // opcode, then operands
+  std::map<Key, int> expressions;
+  std::map<std::string, int> labels;
+  std::vector<int> valueOf(numLocations, -1);
+  int numValues = 0;
+  auto numberOf = [&](Location *var) {
+    if (var->GetSegment() != fpRelative)
+      return -1; // a global, which the calls may change
+    int &value = valueOf[var->GetId()];
+    if (value < 0)
+      value = numValues++; // read before any write: a formal, say
+    return value;
+  };
+  auto lookup = [&](const Key &key) {
+    auto found = expressions.find(key);
+    if (found != expressions.end())
+      return found->second;
+    expressions[key] = numValues;
+    return numValues++;
+  };
+
+  // The memory a block starts with is that its idom ends with, unless
+  // something may write to it on a path from the one to the other
+  std::vector<int> memoryAtEnd(numBlocks, -1), searched(numBlocks, -1);
+  auto memoryOnEntry = [&](BasicBlock *block) {
+    BasicBlock *idom = domTree.IDom(block);
+    if (!idom)
+      return numValues++;
+    std::vector<BasicBlock*> worklist;
+    for (int p = 0; p < block->preds.NumElements(); p++)
+      worklist.push_back(block->preds.Nth(p));
+    while (!worklist.empty())
+    {
+      BasicBlock *pred = worklist.back();
+      worklist.pop_back();
+      int i = pred->GetIndex();
+      if (pred == idom || searched[i] == block->GetIndex() ||
+          !domTree.IsReachable(pred))
+        continue;
+      searched[i] = block->GetIndex();
+      if (writesMemory[i])
+        return numValues++;
+      for (int p = 0; p < pred->preds.NumElements(); p++)
+        worklist.push_back(pred->preds.Nth(p));
+    }
+    return memoryAtEnd[idom->GetIndex()];
+  };
+
+  // Down the dominator tree, a value computed again where an earlier
+  // variable holding it is available, in a dominating block, is not:
+  // its variable is renamed to the earlier one (in SSA form that one
+  // reaches every use of the other)
+  std::vector<Location*> leader;               // by value number
+  std::vector<Location*> renamed(numLocations, NULL);
+  std::vector<int> madeAvailable;              // the values, to undo
+  std::vector<size_t> availableBefore;
+  int numRedundant = 0;
+  auto available = [&](int value) {
+    return value < (int) leader.size() ? leader[value] : NULL;
+  };
+  auto makeAvailable = [&](int value, Location *var) {
+    if (value >= (int) leader.size())
+      leader.resize(value + 1, NULL);
+    leader[value] = var;
+    madeAvailable.push_back(value);
+  };
+  std::vector<std::pair<BasicBlock*, size_t> > walk; // block, next child
+  walk.push_back(std::make_pair(blocks->Nth(0), 0));
+  while (!walk.empty())
+  {
+    BasicBlock *block = walk.back().first;
+    size_t next = walk.back().second++;
+    if (next == 0)
     {
-      for (auto fromTac : *(tac->liveVarsIn))
+      availableBefore.push_back(madeAvailable.size());
+      int memory = memoryOnEntry(block);
+      List<Instruction*> kept;
+      for (int k = 0; k < block->code.NumElements(); k++)
       {
-        if (currentGraph->find(fromTac) == currentGraph->end())
-          (*currentGraph)[fromTac] = {};
-        for (auto toTac : *(tac->liveVarsIn))
+        auto tac = block->code.Nth(k);
+        Location *dst = NULL;
+        int value = -1;
+        switch (tac->GetOpcode())
         {
-          if (fromTac != toTac)
+          case TacPhi:
+          {
+            // the same value from every predecessor is that value
+            auto phiTac = static_cast<Phi*>(tac);
+            dst = phiTac->GetDst();
+            for (int e = 0; e < phiTac->NumArgs(); e++)
+            {
+              Location *arg = phiTac->GetArg(e);
+              int argValue = arg->GetSegment() == fpRelative ?
+                             valueOf[arg->GetId()] : -1;
+              if (argValue < 0 || (e > 0 && argValue != value))
+              {
+                value = -1;
+                break;
+              }
+              value = argValue;
+            }
+            break;
+          }
+          case TacLoadConstant:
+          {
+            auto constTac = static_cast<LoadConstant*>(tac);
+            value = lookup({TacLoadConstant, constTac->GetValue(), 0, 0, 0});
+            if (numberOf(constTac->GetDst()) >= 0)
+            {
+              valueOf[constTac->GetDst()->GetId()] = value;
+              if (!available(value))
+                makeAvailable(value, constTac->GetDst());
+            }
+            kept.Append(tac); // as cheap to load again as to keep
+            continue;
+          }
+          case TacLoadLabel:
+          {
+            auto labelTac = static_cast<LoadLabel*>(tac);
+            auto found = labels.find(labelTac->GetLabel());
+            value = found != labels.end() ? found->second :
+                    (labels[labelTac->GetLabel()] = numValues++);
+            if (numberOf(labelTac->GetDst()) >= 0)
+            {
+              valueOf[labelTac->GetDst()->GetId()] = value;
+              if (!available(value))
+                makeAvailable(value, labelTac->GetDst());
+            }
+            kept.Append(tac);
+            continue;
+          }
+          case TacAssign:
+          {
+            auto copyTac = static_cast<Assign*>(tac);
+            int srcValue = numberOf(copyTac->GetSrc());
+            if (srcValue >= 0 && numberOf(copyTac->GetDst()) >= 0)
+              valueOf[copyTac->GetDst()->GetId()] = srcValue;
+            else
+              for (auto var : tac->GetKillVars())
+                if (var->GetSegment() == fpRelative)
+                  valueOf[var->GetId()] = numValues++;
+            kept.Append(tac);
+            continue;
+          }
+          case TacBinaryOp:
+          {
+            auto binaryTac = static_cast<BinaryOp*>(tac);
+            Mips::OpCode opCode = binaryTac->GetCode();
+            dst = binaryTac->GetDst();
+            int a = numberOf(binaryTac->GetOp1()), b;
+            if (binaryTac->GetOp2())
+            {
+              b = numberOf(binaryTac->GetOp2());
+              bool commutes = opCode == Mips::Add || opCode == Mips::Mul ||
+                  opCode == Mips::Eq || opCode == Mips::Ne ||
+                  opCode == Mips::And || opCode == Mips::Or ||
+                  opCode == Mips::Xor;
+              if (commutes && a > b)
+                std::swap(a, b);
+              if (a >= 0 && b >= 0)
+                value = lookup({TacBinaryOp, opCode, a, b, 0});
+            }
+            else if (a >= 0)
+              value = lookup({TacBinaryOp, opCode, a, binaryTac->GetImmediate(), 1});
+            break;
+          }
+          case TacLoad:
+          {
+            auto loadTac = static_cast<Load*>(tac);
+            dst = loadTac->GetDst();
+            int base = numberOf(loadTac->GetSrc());
+            if (base >= 0)
+              value = lookup({TacLoad, base, loadTac->GetOffset(),
+                              loadTac->IsInvariant() ? -1 : memory, 0});
+            break;
+          }
+          case TacStore:
+          {
+            // a new version of memory, in which the word stored holds
+            // the value stored
+            auto storeTac = static_cast<Store*>(tac);
+            memory = numValues++;
+            int base = numberOf(storeTac->GetDst()),
+                stored = numberOf(storeTac->GetSrc());
+            if (base >= 0 && stored >= 0)
+            {
+              expressions[{TacLoad, base, storeTac->GetOffset(), memory, 0}] = stored;
+              if (!available(stored))
+                makeAvailable(stored, storeTac->GetSrc());
+            }
+            kept.Append(tac);
+            continue;
+          }
+          case TacLCall:
+          case TacACall:
           {
-            (*currentGraph)[fromTac].insert(toTac);
+            auto callTac = TacCast<LCall>(tac);
+            if (!callTac || !IsBuiltIn(callTac->GetLabel()))
+              memory = numValues++;
+            break;
           }
+          default:
+            break;
         }
-      }
 
-      for (auto killTac : *(tac->GetKillVars()))
-      {
-        if (currentGraph->find(killTac) == currentGraph->end())
-          (*currentGraph)[killTac] = {};
-        for (auto outTac : *(tac->liveVarsOut))
+        if (value >= 0 && dst->GetSegment() == fpRelative)
         {
-          if (killTac != outTac)
+          valueOf[dst->GetId()] = value;
+          if (Location *earlier = available(value))
           {
-            (*currentGraph)[killTac].insert(outTac);
-            (*currentGraph)[outTac].insert(killTac);
+            renamed[dst->GetId()] = earlier;
+            numRedundant++;
+            continue;
           }
+          makeAvailable(value, dst);
+        }
+        else
+          for (auto var : tac->GetKillVars())
+            if (var->GetSegment() == fpRelative)
+              valueOf[var->GetId()] = numValues++;
+        kept.Append(tac);
+      }
+      block->code = kept;
+      memoryAtEnd[block->GetIndex()] = memory;
+    }
+    const std::vector<BasicBlock*> &children = domTree.Children(block);
+    if (next < children.size())
+      walk.push_back(std::make_pair(children[next], 0));
+    else
+    {
+      for (size_t a = availableBefore.back(); a < madeAvailable.size(); a++)
+        leader[madeAvailable[a]] = NULL;
+      madeAvailable.resize(availableBefore.back());
+      availableBefore.pop_back();
+      walk.pop_back();
+    }
+  }
+
+  // the reads of the variables dropped read the earlier ones instead
+  List<Instruction*> rewritten;
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    for (int k = 0; k < block->code.NumElements(); k++)
+    {
+      auto tac = block->code.Nth(k);
+      if (auto phiTac = TacCast<Phi>(tac))
+      {
+        for (int e = 0; e < phiTac->NumArgs(); e++)
+        {
+          Location *arg = phiTac->GetArg(e);
+          if (arg->GetSegment() == fpRelative && renamed[arg->GetId()])
+            phiTac->SetArg(e, renamed[arg->GetId()]);
         }
       }
+      else
+        for (auto var : tac->GetGenVars())
+          if (renamed[var->GetId()])
+            tac = tac->Rename(var, renamed[var->GetId()]);
+      rewritten.Append(tac);
     }
+  }
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("gvn", "%s: %d redundant values removed, %d values numbered",
+             labelTac->GetLabel(), numRedundant, numValues);
+  code->ReplaceRange(start, numInstructions, rewritten);
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
+}
 
-    // debug output
-    // tac->Print();
-    // if (auto beginFuncTac = dynamic_cast<EndFunc*> (tac))
-    // {
-    //   std::cout << ">>> InferenceGraph begin: " << std::endl;
-    //   for (auto& kv : *currentGraph)
-    //   {
-    //     std::cout << kv.first->GetName() << " -> ";
-    //     for (auto toTac : kv.second)
-    //     {
-    //       std::cout << toTac->GetName() << " ";
-    //     }
-    //     std::cout << std::endl;
-    //   }
-    //   std::cout << ">>> InferenceGraph end." << std::endl;
-    // }
+// Whether tac only writes its dst, which it may as well not do when
+// nothing reads it. A division may trap, and a load other than of a
+// length may be of a null pointer.
+static bool IsPure(Instruction *tac)
+{
+  switch (tac->GetOpcode())
+  {
+    case TacLoadConstant:
+    case TacLoadStringConstant:
+    case TacLoadLabel:
+    case TacAssign:
+    case TacPhi:
+      break;
+    case TacBinaryOp:
+    {
+      Mips::OpCode code = static_cast<BinaryOp*>(tac)->GetCode();
+      if (code == Mips::Div || code == Mips::Mod)
+        return false;
+      break;
+    }
+    case TacLoad:
+      if (!static_cast<Load*>(tac)->IsInvariant())
+        return false;
+      break;
+    default:
+      return false;
   }
+  return tac->GetKillVars().NumElements() == 1; // and not a global
 }
 
-void CodeGenerator::ColorInterferenceGraph()
+void CodeGenerator::HoistInvariants(int start)
 {
-  InterferenceGraph* currentGraph = nullptr;
-  for (int i = 0; i < code->NumElements(); i++)
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  BuildCFG(start);
+  auto blocks = &beginFuncTac->blocks;
+  int numBlocks = blocks->NumElements(), numInstructions = 0;
+  int numLocations = locations->NumElements();
+  DominatorTree domTree(blocks);
+  std::vector<Loop> loops;
+  FindLoops(blocks, &loops);
+
+  // the block writing each variable (in SSA form there is one), and the
+  // blocks loading or storing through it
+  std::vector<BasicBlock*> defBlock(numLocations, NULL);
+  std::vector<Instruction*> defOf(numLocations, NULL);
+  std::vector<std::vector<BasicBlock*> > dereferenced(numLocations);
+  for (int j = 0; j < numBlocks; j++)
   {
-    auto tac = code->Nth(i);
-    if (auto beginFuncTac = dynamic_cast<BeginFunc*> (tac))
+    auto block = blocks->Nth(j);
+    numInstructions += block->code.NumElements();
+    for (int k = 0; k < block->code.NumElements(); k++)
+    {
+      auto tac = block->code.Nth(k);
+      for (auto var : tac->GetKillVars())
+        if (var->GetSegment() == fpRelative)
+        {
+          defBlock[var->GetId()] = block;
+          defOf[var->GetId()] = tac;
+        }
+      Location *address = NULL;
+      if (auto loadTac = TacCast<Load>(tac))
+        address = loadTac->GetSrc();
+      else if (auto storeTac = TacCast<Store>(tac))
+        address = storeTac->GetDst();
+      if (address && address->GetSegment() == fpRelative)
+        dereferenced[address->GetId()].push_back(block);
+    }
+  }
+
+  // Whether var cannot be null where the block at ends: it is this, a
+  // vtable loaded from a pointer that cannot be, or something already
+  // loaded or stored through on every path to there
+  auto nonNull = [&](Location *var, BasicBlock *at) {
+    while (var->GetSegment() == fpRelative)
+    {
+      if (!defOf[var->GetId()] && !strcmp(var->GetName(), "this"))
+        return true;
+      for (auto block : dereferenced[var->GetId()])
+        if (domTree.Dominates(block, at))
+          return true;
+      auto loadTac = TacCast<Load>(defOf[var->GetId()]);
+      if (!loadTac || !loadTac->IsInvariant() || loadTac->GetOffset() != 0)
+        return false;
+      var = loadTac->GetSrc();
+    }
+    return false;
+  };
+
+  // Innermost loops first, what a loop computes from values it does not
+  // change moves to its preheader, where the loops around it may take
+  // it further out. The preheader is the one block entering the loop,
+  // which goes nowhere else; a loop without one is left alone.
+  // A preheader a check was moved to is no longer one block, and is
+  // left alone by the loops around it.
+  int numHoisted = 0, numLoops = 0;
+  std::vector<bool> split(numBlocks, false);
+  for (int l = (int) loops.size() - 1; l >= 0; l--)
+  {
+    Loop &loop = loops[l];
+    BasicBlock *head = loop.head, *preheader = NULL;
+    int numEntries = 0;
+    for (int p = 0; p < head->preds.NumElements(); p++)
+      if (!loop.body.Test(head->preds.Nth(p)->GetIndex()))
+      {
+        preheader = head->preds.Nth(p);
+        numEntries++;
+      }
+    if (numEntries != 1 || preheader->succs.NumElements() != 1 ||
+        !domTree.IsReachable(preheader))
+      continue;
+
+    // what the loop may write to memory, and whether it calls anything
+    // (the blocks that halt being left out)
+    std::vector<Store*> stores;
+    bool calls = false, anyCalls = false; // but to the built-ins, and any
+    for (int j = loop.body.NextSetBit(0); j >= 0; j = loop.body.NextSetBit(j + 1))
+    {
+      auto block = blocks->Nth(j);
+      if (BoundsProver::Halts(block))
+        continue;
+      for (int k = 0; k < block->code.NumElements(); k++)
+      {
+        auto tac = block->code.Nth(k);
+        auto callTac = TacCast<LCall>(tac);
+        if (auto storeTac = TacCast<Store>(tac))
+          stores.push_back(storeTac);
+        else if (TacCast<ACall>(tac) || (callTac && !IsBuiltIn(callTac->GetLabel())))
+          calls = true;
+        anyCalls = anyCalls || tac->IsCall();
+      }
+    }
+    auto invariant = [&](Location *var) {
+      BasicBlock *block = defBlock[var->GetId()];
+      return !block || !loop.body.Test(block->GetIndex());
+    };
+
+    // The loop surely runs once when its first test, from the values
+    // the head's phis take on entry, goes into the loop
+    auto defOfLocal = [&](Location *var) {
+      return var->GetSegment() == fpRelative ? defOf[var->GetId()] : NULL;
+    };
+    auto onEntry = [&](Location *var, int *value) {
+      auto phiTac = TacCast<Phi>(defOfLocal(var));
+      if (phiTac && defBlock[var->GetId()] == head)
+        for (int p = 0; p < head->preds.NumElements(); p++)
+          if (head->preds.Nth(p) == preheader)
+            var = phiTac->GetArg(p);
+      auto constTac = TacCast<LoadConstant>(defOfLocal(var));
+      if (constTac)
+        *value = constTac->GetValue();
+      return constTac != NULL;
+    };
+    auto headTac = TacCast<IfZ>(head->Last());
+    auto testTac = headTac ? TacCast<BinaryOp>(defOfLocal(headTac->GetTest())) : NULL;
+    int a, b, result;
+    bool runsOnce = testTac && head->succs.NumElements() == 2 &&
+        loop.body.Test(head->succs.Nth(1)->GetIndex()) && onEntry(testTac->GetOp1(), &a) &&
+        (testTac->GetOp2() ? onEntry(testTac->GetOp2(), &b) :
+                             (b = testTac->GetImmediate(), true)) &&
+        BinaryOp::Evaluate(testTac->GetCode(), a, b, &result) && result != 0;
+
+    // An instruction is invariant when what it reads is, and it moves
+    // if running it on entry, whether or not the loop would have, is
+    // safe: a division may trap (the other operators wrap around, with
+    // addu and subu, and cannot), and a load needs its address to be
+    // valid and its word not to be written in the loop. The address is
+    // valid if the pointer cannot be null, or if the loop was sure to
+    // load it before doing anything else: in its head, or on the way
+    // from there through the checks of a loop that surely runs once.
+    // An invariant check on that way is made before the loop instead
+    // (EliminateChecks then drops the one in the loop). A constant is
+    // as cheap to load again as to keep in a register across a call,
+    // so it stays in a loop that calls, and what a block that halts
+    // computes, it computes once. In reverse postorder each comes
+    // after the instructions it reads, and the way is taken in order.
+    List<Instruction*> moved;
+    BasicBlock *first = head; // the next block on the way, if any
+    bool checked = false;
+    for (auto block : domTree.ReversePostorder())
     {
-      currentGraph = &(beginFuncTac->interferenceGraph);
-      std::stack<Location*> removedNodes;
-      InterferenceGraph removedEdges;
-      while (!currentGraph->empty())
+      if (!loop.body.Test(block->GetIndex()) || BoundsProver::Halts(block) ||
+          split[block->GetIndex()])
+        continue;
+      bool onTheWay = block == first;
+      Instruction *last = block->code.NumElements() ? block->Last() : NULL;
+      if (last && !last->IsBlockEnd())
+        last = NULL;
+      List<Instruction*> kept;
+      for (int k = 0; k < block->code.NumElements(); k++)
       {
-        Location* maxNode = nullptr;
-        int maxNodeSize = -1;
-        for (auto& kv : *currentGraph)
+        auto tac = block->code.Nth(k);
+        bool movable = tac->GetKillVars().NumElements() == 1 &&
+                       tac->GetGlobalsRead().NumElements() == 0 &&
+                       tac->GetGlobalsWritten().NumElements() == 0;
+        for (auto var : tac->GetGenVars())
+          movable = movable && invariant(var);
+        bool effect = false; // or a fault, left in the loop
+        switch (tac->GetOpcode())
         {
-          if ( ((int) kv.second.size()) > maxNodeSize)
+          case TacLoadConstant:
+          case TacLoadStringConstant:
+          case TacLoadLabel:
+            movable = movable && !anyCalls;
+            break;
+          case TacAssign:
+            break;
+          case TacBinaryOp:
           {
-            maxNode = kv.first;
-            maxNodeSize = (int) kv.second.size();
+            Mips::OpCode opCode = static_cast<BinaryOp*>(tac)->GetCode();
+            movable = movable && opCode != Mips::Div && opCode != Mips::Mod;
+            effect = opCode == Mips::Div || opCode == Mips::Mod;
+            break;
           }
+          case TacLoad:
+          {
+            auto loadTac = static_cast<Load*>(tac);
+            effect = true;
+            if (!movable)
+              break;
+            if (!loadTac->IsInvariant())
+            {
+              movable = !calls;
+              for (auto storeTac : stores)
+                movable = movable && !MayAlias(loadTac->GetMemory(), loadTac->GetOffset(),
+                                               storeTac->GetMemory(), storeTac->GetOffset());
+            }
+            bool pointer = loadTac->IsInvariant() || loadTac->GetMemory() == FieldMemory;
+            movable = movable && (onTheWay ||
+                                  (pointer && nonNull(loadTac->GetSrc(), preheader)));
+            break;
+          }
+          case TacLabel:
+          case TacPhi:
+          case TacPushParam:
+          case TacPopParams:
+            movable = false;
+            break;
+          default:
+            movable = false;
+            effect = true;
+            break;
+        }
+        if (movable)
+        {
+          moved.Append(tac);
+          defBlock[tac->GetKillVars().Nth(0)->GetId()] = preheader;
+        }
+        else
+        {
+          kept.Append(tac);
+          onTheWay = onTheWay && (!effect || tac == last);
+        }
+      }
+      block->code = kept;
+      if (!onTheWay)
+        continue;
+
+      // the way goes on to the one block in the loop after this one, a
+      // check's being the block it passes to
+      first = NULL;
+      auto ifTac = TacCast<IfZ>(last);
+      BasicBlock *next = block->succs.Nth(0);
+      if (block == head)
+        first = runsOnce ? head->succs.Nth(1) : NULL;
+      else if (ifTac && block->succs.NumElements() == 2 && invariant(ifTac->GetTest()) &&
+               BoundsProver::Halts(block->succs.Nth(1)) &&
+               block->succs.Nth(1)->preds.NumElements() == 1)
+      {
+        // the check, with a copy of its halting block of its own
+        BasicBlock *halt = block->succs.Nth(1);
+        std::map<int, Location*> copies;
+        List<Instruction*> haltCode;
+        bool readsLoop = false;
+        for (int k = 0; k < halt->code.NumElements(); k++)
+        {
+          Instruction *tac = halt->code.Nth(k);
+          if (TacCast<Label>(tac) || TacCast<Goto>(tac))
+            continue;
+          for (auto var : tac->GetGenVars())
+            if (copies.count(var->GetId()))
+              tac = tac->Rename(var, copies[var->GetId()]);
+            else
+              readsLoop = readsLoop || !invariant(var);
+          for (auto var : tac->GetKillVars())
+          {
+            Location *copy = locations->Intern(fpRelative,
+                OffsetToFirstLocal - beginFuncTac->GetFrameSize(), "_check");
+            beginFuncTac->SetFrameSize(beginFuncTac->GetFrameSize() + VarSize);
+            copies[var->GetId()] = copy;
+            tac = tac->RenameDst(copy);
+          }
+          haltCode.Append(tac);
         }
-        Assert(maxNode);
-        removedNodes.push(maxNode);
-        removedEdges[maxNode] = (*currentGraph)[maxNode];
-        currentGraph->erase(maxNode);
-        for (auto& kv : *currentGraph)
+        if (!readsLoop)
         {
-          kv.second.erase(maxNode);
+          const char *passed = NewLabel();
+          moved.Append(new IfZ(ifTac->GetTest(), passed));
+          moved.AppendAll(haltCode);
+          moved.Append(new Label(passed));
+          checked = true;
+          first = next;
         }
       }
+      else if (block->succs.NumElements() == 1)
+        first = next;
+      for (int p = 0; first && p < first->preds.NumElements(); p++)
+        if (first->preds.Nth(p) != block && !BoundsProver::Halts(first->preds.Nth(p)))
+          first = NULL;
+    }
+    if (moved.NumElements() == 0)
+      continue;
+    int at = preheader->code.NumElements();
+    if (at > 0 && preheader->Last()->IsBlockEnd())
+      at--; // a Goto to the head
+    for (int k = 0; k < moved.NumElements(); k++)
+      preheader->code.InsertAt(moved.Nth(k), at + k);
+    split[preheader->GetIndex()] = split[preheader->GetIndex()] || checked;
+    numHoisted += moved.NumElements();
+    numLoops++;
+  }
 
-      while (!removedNodes.empty())
+  List<Instruction*> rewritten;
+  for (int j = 0; j < numBlocks; j++)
+    rewritten.AppendAll(blocks->Nth(j)->code);
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("licm", "%s: %d instructions hoisted out of %d loops",
+             labelTac->GetLabel(), numHoisted, numLoops);
+  code->ReplaceRange(start, numInstructions, rewritten);
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
+}
+
+void CodeGenerator::EliminateChecks(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  BuildCFG(start);
+  auto blocks = &beginFuncTac->blocks;
+  int numBlocks = blocks->NumElements(), numInstructions = 0;
+  for (int j = 0; j < numBlocks; j++)
+    numInstructions += blocks->Nth(j)->code.NumElements();
+  DominatorTree domTree(blocks);
+  BoundsProver prover(blocks, &domTree, locations);
+
+  // A check branches around a block that halts unless its test is
+  // false. The checks proven to branch become Gotos and their halting
+  // blocks go; of a test that is the Or of two, a side proven false
+  // is left out.
+  std::vector<bool> removed(numBlocks, false);
+  int numRemoved = 0, numNarrowed = 0, numDead = 0;
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    auto ifTac = TacCast<IfZ>(block->Last());
+    if (!ifTac || !domTree.IsReachable(block))
+      continue;
+    BasicBlock *halt = block->succs.Nth(1);
+    if (halt == block->succs.Nth(0) || halt->preds.NumElements() != 1 ||
+        !BoundsProver::Halts(halt))
+      continue;
+    Location *test = ifTac->GetTest();
+    Instruction *branch = NULL;
+    auto orTac = TacCast<BinaryOp>(prover.Def(test));
+    if (prover.Prove(test, false, block))
+    {
+      branch = new Goto(ifTac->GetLabel());
+      removed[halt->GetIndex()] = true;
+      numRemoved++;
+    }
+    else if (orTac && orTac->GetCode() == Mips::Or && orTac->GetOp2())
+    {
+      if (prover.Prove(orTac->GetOp1(), false, block))
+        branch = new IfZ(orTac->GetOp2(), ifTac->GetLabel());
+      else if (prover.Prove(orTac->GetOp2(), false, block))
+        branch = new IfZ(orTac->GetOp1(), ifTac->GetLabel());
+      numNarrowed += branch != NULL;
+    }
+    if (branch)
+    {
+      block->code.RemoveAt(block->code.NumElements() - 1);
+      block->code.Append(branch);
+    }
+  }
+
+  // the phis lose the args of the blocks removed
+  List<Instruction*> rewritten;
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    if (removed[j])
+      continue;
+    for (int k = 0; k < block->code.NumElements(); k++)
+    {
+      auto tac = block->code.Nth(k);
+      if (auto phiTac = TacCast<Phi>(tac))
       {
-        auto node = removedNodes.top();
-        removedNodes.pop();
-        std::set<Mips::Register> generalPurposeRegs
-          = {Mips::t0, Mips::t1, Mips::t2, Mips::t3, Mips::t4, Mips::t5, Mips::t6, 
-             Mips::t7, Mips::t8, Mips::t9, Mips::s0, Mips::s1, Mips::s2, Mips::s3,
-             Mips::s4, Mips::s5, Mips::s6, Mips::s7};
-        for (auto toNode : removedEdges[node])
+        int numArgs = 0;
+        for (int e = 0; e < phiTac->NumArgs(); e++)
+          numArgs += !removed[block->preds.Nth(e)->GetIndex()];
+        if (numArgs < phiTac->NumArgs())
         {
-          generalPurposeRegs.erase(toNode->GetRegister());
+          Phi *kept = new Phi(phiTac->GetDst(), numArgs);
+          for (int e = 0, a = 0; e < phiTac->NumArgs(); e++)
+            if (!removed[block->preds.Nth(e)->GetIndex()])
+              kept->SetArg(a++, phiTac->GetArg(e));
+          tac = kept;
         }
-        node->SetRegister(*(generalPurposeRegs.begin()));
-        removedEdges.erase(node);
       }
+      rewritten.Append(tac);
+    }
+  }
+
+  // Then what nothing reads goes, and what only it read, and so on.
+  // In SSA form each variable has the one write.
+  int numLocations = locations->NumElements();
+  std::vector<int> numUses(numLocations, 0), writtenAt(numLocations, -1);
+  auto readsOf = [&](Instruction *tac) {
+    std::vector<Location*> reads;
+    if (auto phiTac = TacCast<Phi>(tac))
+    {
+      for (int e = 0; e < phiTac->NumArgs(); e++)
+        if (phiTac->GetArg(e)->GetSegment() == fpRelative)
+          reads.push_back(phiTac->GetArg(e));
     }
+    else
+      for (auto var : tac->GetGenVars())
+        reads.push_back(var);
+    return reads;
+  };
+  for (int i = 0; i < rewritten.NumElements(); i++)
+  {
+    auto tac = rewritten.Nth(i);
+    for (auto var : readsOf(tac))
+      numUses[var->GetId()]++;
+    for (auto var : tac->GetKillVars())
+      writtenAt[var->GetId()] = i;
+  }
+  std::vector<bool> dead(rewritten.NumElements(), false);
+  std::vector<int> worklist;
+  for (int i = 0; i < rewritten.NumElements(); i++)
+    worklist.push_back(i);
+  while (!worklist.empty())
+  {
+    int i = worklist.back();
+    worklist.pop_back();
+    auto tac = rewritten.Nth(i);
+    if (dead[i] || !IsPure(tac) || numUses[tac->GetKillVars().Nth(0)->GetId()] > 0)
+      continue;
+    dead[i] = true;
+    numDead++;
+    for (auto var : readsOf(tac))
+      if (--numUses[var->GetId()] == 0 && writtenAt[var->GetId()] >= 0)
+        worklist.push_back(writtenAt[var->GetId()]);
   }
 
-  // debug output
-  // for (int i = 0; i < code->NumElements(); i++)
-  // {
-  //   auto tac = code->Nth(i);
-  //   tac->Print();
-  //   std::cout << "IN set: ";
-  //   for (auto loc : *(tac->liveVarsIn))
-  //     std::cout << loc->GetName() << ":" << Mips().regs[loc->GetRegister()].name << " ";
-  //   std::cout << std::endl;
-  //   std::cout << "Out set: ";
-  //   for (auto loc : *(tac->liveVarsOut))
-  //     std::cout << loc->GetName() << ":" << Mips().regs[loc->GetRegister()].name << " ";
-  //   std::cout << std::endl;
-  //   std::cout << "----------------" << std::endl;
-  // }
+  // and a Goto to the label right after it is a fall through
+  List<Instruction*> kept;
+  for (int i = 0; i < rewritten.NumElements(); i++)
+    if (!dead[i])
+      kept.Append(rewritten.Nth(i));
+  rewritten.Clear();
+  for (int i = 0; i < kept.NumElements(); i++)
+  {
+    auto gotoTac = TacCast<Goto>(kept.Nth(i));
+    auto labelTac = i + 1 < kept.NumElements() ?
+                    TacCast<Label>(kept.Nth(i + 1)) : NULL;
+    if (!gotoTac || !labelTac || strcmp(gotoTac->GetLabel(), labelTac->GetLabel()))
+      rewritten.Append(kept.Nth(i));
+  }
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("bounds", "%s: %d checks removed, %d narrowed, %d dead "
+             "instructions removed", labelTac->GetLabel(), numRemoved,
+             numNarrowed, numDead);
+  code->ReplaceRange(start, numInstructions, rewritten);
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
 }
 
+void CodeGenerator::FromSSA(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  BuildCFG(start);
+  auto blocks = &beginFuncTac->blocks;
+  int numBlocks = blocks->NumElements(), numInstructions = 0;
+  for (int j = 0; j < numBlocks; j++)
+    numInstructions += blocks->Nth(j)->code.NumElements();
+
+  // A phi is a copy at the end of each predecessor, all the phis of a
+  // block copying at once. On an edge from a block that branches two
+  // ways, the copies go on the edge itself: after the branch for the
+  // edge falling through, and for the other in a block of their own at
+  // the end of the function that the branch is pointed at.
+  std::vector<List<Instruction*> > beforeLast(numBlocks), afterLast(numBlocks);
+  std::vector<std::vector<Phi*> > phis(numBlocks);
+  std::vector<Instruction*> last(numBlocks);
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    for (int k = PhiStart(block); k < block->code.NumElements(); k++)
+    {
+      auto phiTac = TacCast<Phi>(block->code.Nth(k));
+      if (!phiTac)
+        break;
+      phis[j].push_back(phiTac);
+    }
+    block->code.ReplaceRange(PhiStart(block), phis[j].size(), List<Instruction*>());
+    last[j] = block->Last();
+  }
+
+  List<Instruction*> edges; // the blocks on branch edges
+  Location *swap = NULL;
+  int numCopies = 0, numSplit = 0;
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    for (int e = 0; e < block->preds.NumElements(); e++)
+    {
+      // the copies of the edge, in an order that reads each source
+      // before it is overwritten: a copy whose dst no other copy reads
+      // goes first, and a cycle is broken by saving one dst aside
+      std::vector<std::pair<Location*, Location*> > pending; // dst, src
+      for (auto phiTac : phis[j])
+        if (phiTac->GetArg(e) != phiTac->GetDst())
+          pending.push_back(std::make_pair(phiTac->GetDst(), phiTac->GetArg(e)));
+      List<Instruction*> copies;
+      while (!pending.empty())
+      {
+        size_t c = 0;
+        for (; c < pending.size(); c++)
+        {
+          bool read = false;
+          for (auto &other : pending)
+            read |= other.second == pending[c].first;
+          if (!read)
+            break;
+        }
+        if (c == pending.size())
+        {
+          if (!swap)
+          {
+            swap = locations->Intern(fpRelative,
+                OffsetToFirstLocal - beginFuncTac->GetFrameSize(), "_swap");
+            beginFuncTac->SetFrameSize(beginFuncTac->GetFrameSize() + VarSize);
+          }
+          c = 0;
+          copies.Append(new Assign(swap, pending[c].first));
+          for (auto &other : pending)
+            if (other.second == pending[c].first)
+              other.second = swap;
+        }
+        copies.Append(new Assign(pending[c].first, pending[c].second));
+        pending.erase(pending.begin() + c);
+        numCopies++;
+      }
+      if (copies.NumElements() == 0)
+        continue;
+
+      BasicBlock *pred = block->preds.Nth(e);
+      int p = pred->GetIndex();
+      if (pred->succs.NumElements() == 1)
+      {
+        if (pred->Last()->GetOpcode() == TacGoto)
+          beforeLast[p].AppendAll(copies);
+        else
+          afterLast[p].AppendAll(copies);
+        continue;
+      }
+      int s = 0;
+      while (pred->succs.Nth(s) != block || PredIndex(pred, s) != e)
+        s++;
+      if (s == 1) // falling through
+      {
+        afterLast[p].AppendAll(copies);
+        continue;
+      }
+      auto labelTac = TacCast<Label>(block->First());
+      Assert(labelTac != NULL);
+      char *edgeLabel = NewLabel();
+      numSplit++;
+      edges.Append(new Label(edgeLabel));
+      edges.AppendAll(copies);
+      edges.Append(new Goto(labelTac->GetLabel()));
+      if (auto ifTac = TacCast<IfZ>(last[p]))
+        last[p] = new IfZ(ifTac->GetTest(), edgeLabel);
+      else if (auto relTac = TacCast<IfRel>(last[p]))
+        last[p] = relTac->GetOp2()
+            ? new IfRel(relTac->GetCode(), relTac->GetOp1(), relTac->GetOp2(), edgeLabel)
+            : new IfRel(relTac->GetCode(), relTac->GetOp1(), relTac->GetImmediate(), edgeLabel);
+      else
+        Failure("Unexpected branch to a block with phis");
+    }
+  }
+
+  List<Instruction*> rewritten;
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    for (int k = 0; k < block->code.NumElements() - 1; k++)
+      rewritten.Append(block->code.Nth(k));
+    if (last[j]->GetOpcode() == TacEndFunc && edges.NumElements() > 0)
+    {
+      // the edge blocks go before the end, jumped over
+      Instruction *before = rewritten.Nth(rewritten.NumElements() - 1);
+      if (before->GetOpcode() == TacGoto || before->GetOpcode() == TacReturn)
+        rewritten.AppendAll(edges);
+      else
+      {
+        char *endLabel = NewLabel();
+        rewritten.Append(new Goto(endLabel));
+        rewritten.AppendAll(edges);
+        rewritten.Append(new Label(endLabel));
+      }
+    }
+    rewritten.AppendAll(beforeLast[j]);
+    rewritten.Append(last[j]);
+    rewritten.AppendAll(afterLast[j]);
+  }
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("ssa", "%s: %d copies out of SSA, %d edges split",
+             labelTac->GetLabel(), numCopies, numSplit);
+  code->ReplaceRange(start, numInstructions, rewritten);
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
+}
+
+void CodeGenerator::CoalesceCopies(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  int end = start;
+  bool anyCopies = false;
+  for (; code->Nth(end)->GetOpcode() != TacEndFunc; end++)
+    if (auto copyTac = TacCast<Assign>(code->Nth(end)))
+      anyCopies |= copyTac->GetDst()->GetSegment() == fpRelative &&
+                   copyTac->GetSrc()->GetSegment() == fpRelative;
+  if (!anyCopies)
+    return;
+  BuildCFG(start);
+  LiveVariableAnalysis(start);
+  int numLocations = locations->NumElements();
+
+  // the copies between locals, those in the deepest loops first
+  struct Copy { Location *dst, *src; int loopDepth; };
+  std::vector<Copy> copies;
+  BitVector unrelated(numLocations); // to no copy
+  for (int id = 0; id < numLocations; id++)
+    unrelated.Set(id);
+  auto blocks = &beginFuncTac->blocks;
+  int numInstructions = 0;
+  for (int j = 0; j < blocks->NumElements(); j++)
+  {
+    auto block = blocks->Nth(j);
+    numInstructions += block->code.NumElements();
+    for (int k = 0; k < block->code.NumElements(); k++)
+    {
+      auto copyTac = TacCast<Assign>(block->code.Nth(k));
+      if (copyTac && copyTac->GetDst()->GetSegment() == fpRelative &&
+          copyTac->GetSrc()->GetSegment() == fpRelative)
+      {
+        copies.push_back({copyTac->GetDst(), copyTac->GetSrc(), block->loopDepth});
+        unrelated.Reset(copyTac->GetDst()->GetId());
+        unrelated.Reset(copyTac->GetSrc()->GetId());
+      }
+    }
+  }
+  std::stable_sort(copies.begin(), copies.end(), [](const Copy &a, const Copy &b) {
+    return a.loopDepth > b.loopDepth;
+  });
+
+  // Which of those interfere, as in BuildInterferenceGraph: each write
+  // with what is live after it (but the source of a copy with its
+  // destination), and the variables live on entry with each other.
+  // Only the variables of the copies are looked at, so this is cheap
+  // even where the whole graph would not be.
+  std::set<std::pair<int, int> > interfering;
+  auto addEdges = [&](int a, const BitVector &live, Location *except) {
+    BitVector related = live;
+    related.Subtract(unrelated);
+    for (int b = related.NextSetBit(0); b >= 0; b = related.NextSetBit(b + 1))
+      if (b != a && (!except || b != except->GetId()))
+        interfering.insert(std::make_pair(std::min(a, b), std::max(a, b)));
+  };
+  for (int j = 0; j < blocks->NumElements(); j++)
+  {
+    auto block = blocks->Nth(j);
+    BitVector live = block->liveOut->GetBits(); // after the instruction
+    for (int k = block->code.NumElements() - 1; k >= 0; k--)
+    {
+      auto tac = block->code.Nth(k);
+      auto copyTac = TacCast<Assign>(tac);
+      for (auto var : tac->GetKillVars())
+        if (!unrelated.Test(var->GetId()))
+          addEdges(var->GetId(), live, copyTac ? copyTac->GetSrc() : NULL);
+      for (auto var : tac->GetKillVars())
+        live.Reset(var->GetId());
+      for (auto var : tac->GetGenVars())
+        live.Set(var->GetId());
+    }
+    if (j == 0)
+      for (int a = live.NextSetBit(0); a >= 0; a = live.NextSetBit(a + 1))
+        if (!unrelated.Test(a))
+          addEdges(a, live, NULL);
+  }
+  auto interferes = [&](int a, int b) {
+    return interfering.count(std::make_pair(std::min(a, b), std::max(a, b))) > 0;
+  };
+
+  // The two ends of a copy become one variable unless some version
+  // merged into one interferes with some merged into the other. A
+  // formal stays itself, as BeginFunc names it.
+  std::vector<int> root(numLocations);
+  std::vector<std::vector<int> > members(numLocations);
+  for (int id = 0; id < numLocations; id++)
+  {
+    root[id] = id;
+    members[id].push_back(id);
+  }
+  BitVector formal(numLocations);
+  List<Location*> *formals = beginFuncTac->GetFormals();
+  for (int i = 0; i < formals->NumElements(); i++)
+    formal.Set(formals->Nth(i)->GetId());
+  auto find = [&](int id) {
+    while (root[id] != id)
+      id = root[id] = root[root[id]];
+    return id;
+  };
+  int numCoalesced = 0;
+  for (auto &copy : copies)
+  {
+    int a = find(copy.dst->GetId()), b = find(copy.src->GetId());
+    if (a == b || (formal.Test(a) && formal.Test(b)))
+      continue;
+    bool interfere = false;
+    for (size_t x = 0; x < members[a].size() && !interfere; x++)
+      for (size_t y = 0; y < members[b].size() && !interfere; y++)
+        interfere = interferes(members[a][x], members[b][y]);
+    if (interfere)
+      continue;
+    if (formal.Test(b))
+      std::swap(a, b);
+    root[b] = a;
+    members[a].insert(members[a].end(), members[b].begin(), members[b].end());
+    members[b].clear();
+    numCoalesced++;
+  }
+
+  List<Instruction*> rewritten;
+  for (int i = start; i < start + numInstructions; i++)
+  {
+    auto tac = code->Nth(i);
+    VarList vars;
+    for (auto var : tac->GetGenVars())
+      vars.Add(var);
+    for (auto var : tac->GetKillVars())
+      vars.Add(var);
+    for (auto var : vars)
+      if (find(var->GetId()) != var->GetId())
+        tac = tac->Rename(var, locations->Nth(find(var->GetId())));
+    auto copyTac = TacCast<Assign>(tac);
+    if (!copyTac || copyTac->GetDst() != copyTac->GetSrc())
+      rewritten.Append(tac);
+  }
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("ssa", "%s: %d of %d copies coalesced", labelTac->GetLabel(),
+             numCoalesced, (int) copies.size());
+  code->ReplaceRange(start, numInstructions, rewritten);
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
+}
+
+// Copies an instruction of a loop duplicated, by the copy constructor
+// of its class
+class CopyInstruction : public TacVisitor<CopyInstruction, Instruction*> {
+  public:
+    Instruction *VisitLoadConstant(LoadConstant *tac) { return new LoadConstant(*tac); }
+    Instruction *VisitLoadStringConstant(LoadStringConstant *tac)
+        { return new LoadStringConstant(*tac); }
+    Instruction *VisitLoadLabel(LoadLabel *tac) { return new LoadLabel(*tac); }
+    Instruction *VisitAssign(Assign *tac)       { return new Assign(*tac); }
+    Instruction *VisitLoad(Load *tac)           { return new Load(*tac); }
+    Instruction *VisitStore(Store *tac)         { return new Store(*tac); }
+    Instruction *VisitBinaryOp(BinaryOp *tac)   { return new BinaryOp(*tac); }
+    Instruction *VisitLabel(Label *tac)         { return new Label(*tac); }
+    Instruction *VisitGoto(Goto *tac)           { return new Goto(*tac); }
+    Instruction *VisitIfZ(IfZ *tac)             { return new IfZ(*tac); }
+    Instruction *VisitIfRel(IfRel *tac)         { return new IfRel(*tac); }
+    Instruction *VisitReturn(Return *tac)       { return new Return(*tac); }
+    Instruction *VisitPushParam(PushParam *tac) { return new PushParam(*tac); }
+    Instruction *VisitPopParams(PopParams *tac) { return new PopParams(*tac); }
+    Instruction *VisitLCall(LCall *tac)         { return new LCall(*tac); }
+    Instruction *VisitACall(ACall *tac)         { return new ACall(*tac); }
+    Instruction *VisitInstruction(Instruction *tac)
+        { Failure("Cannot copy Tac opcode %d", tac->GetOpcode()); return NULL; }
+};
+
+bool CodeGenerator::VersionLoops(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  BuildCFG(start);
+  auto blocks = &beginFuncTac->blocks;
+  int numBlocks = blocks->NumElements(), numInstructions = 0;
+  int numLocations = locations->NumElements();
+  std::vector<Loop> loops;
+  FindLoops(blocks, &loops);
+
+  // What the variables written once are written with (most temps),
+  // and the blocks by label
+  std::vector<int> numWrites(numLocations, 0);
+  std::vector<Instruction*> writtenBy(numLocations, NULL);
+  std::map<std::string, int> blockOf;
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    numInstructions += block->code.NumElements();
+    if (auto labelTac = TacCast<Label>(block->First()))
+      blockOf[labelTac->GetLabel()] = j;
+    for (int k = 0; k < block->code.NumElements(); k++)
+      for (auto var : block->code.Nth(k)->GetKillVars())
+      {
+        numWrites[var->GetId()]++;
+        writtenBy[var->GetId()] = block->code.Nth(k);
+      }
+  }
+  auto def = [&](Location *var) -> Instruction* {
+    if (!var || var->GetSegment() != fpRelative || numWrites[var->GetId()] != 1)
+      return NULL;
+    return writtenBy[var->GetId()];
+  };
+  auto constant = [&](Location *var, int *value) {
+    auto constTac = TacCast<LoadConstant>(def(var));
+    if (constTac)
+      *value = constTac->GetValue();
+    return constTac != NULL;
+  };
+  auto newTemp = [&]() {
+    Location *temp = locations->Intern(fpRelative,
+        OffsetToFirstLocal - beginFuncTac->GetFrameSize(), "_guard");
+    beginFuncTac->SetFrameSize(beginFuncTac->GetFrameSize() + VarSize);
+    return temp;
+  };
+  auto fallsThrough = [&](BasicBlock *block) {
+    auto opcode = block->Last()->GetOpcode();
+    return opcode != TacGoto && opcode != TacReturn && opcode != TacEndFunc;
+  };
+
+  // The loops taken are entered only by falling into the head, which
+  // tests i < n (or <=) for an i only ever stepped up, or i > n (or >=)
+  // for one stepped down, and n not written in the loop. A check on a
+  // subscript i + k, into an array not written in the loop either, is
+  // sure to pass when i + k starts at or above 0 and n + k is at most
+  // the length (likewise going down), so the guard tests that for the
+  // least and greatest k.
+  std::vector<List<Instruction*> > guards(numBlocks); // before the heads
+  std::vector<const char*> copyLabel(numBlocks, NULL);  // of the blocks copied
+  int numVersioned = 0;
+  for (auto &loop : loops)
+  {
+    BasicBlock *head = loop.head;
+    int h = head->GetIndex(), size = 0;
+    if (!loop.innermost || h == 0)
+      continue;
+    BitVector written(numLocations);
+    bool nextToGuard = false;
+    for (int j = loop.body.NextSetBit(0); j >= 0; j = loop.body.NextSetBit(j + 1))
+    {
+      auto block = blocks->Nth(j);
+      size += block->code.NumElements();
+      for (int k = 0; k < block->code.NumElements(); k++)
+        for (auto var : block->code.Nth(k)->GetKillVars())
+          written.Set(var->GetId());
+      if (fallsThrough(block) && j + 1 < numBlocks && !loop.body.Test(j + 1))
+        nextToGuard |= guards[j + 1].NumElements() > 0;
+    }
+    BasicBlock *before = blocks->Nth(h - 1);
+    if (size > MaxVersionedLoop || nextToGuard || copyLabel[h - 1] ||
+        !fallsThrough(before))
+      continue;
+    bool enteredOnce = true;
+    for (int p = 0; p < head->preds.NumElements(); p++)
+      enteredOnce &= loop.body.Test(head->preds.Nth(p)->GetIndex()) ||
+                     head->preds.Nth(p) == before;
+    auto beforeIf = TacCast<IfZ>(before->Last());
+    auto beforeRel = TacCast<IfRel>(before->Last());
+    auto headLabel = TacCast<Label>(head->First());
+    if (!enteredOnce || !headLabel ||
+        (beforeIf && !strcmp(beforeIf->GetLabel(), headLabel->GetLabel())) ||
+        (beforeRel && !strcmp(beforeRel->GetLabel(), headLabel->GetLabel())))
+      continue;
+
+    auto exitTac = TacCast<IfZ>(head->Last());
+    if (!exitTac || loop.body.Test(head->succs.Nth(0)->GetIndex()))
+      continue;
+    auto testTac = TacCast<BinaryOp>(def(exitTac->GetTest()));
+    if (!testTac)
+      continue;
+    Mips::OpCode rel = testTac->GetCode();
+    Location *i = testTac->GetOp1(), *n = testTac->GetOp2();
+    int bound = testTac->GetImmediate();
+    bool constantBound = !n || constant(n, &bound);
+    bool up = rel == Mips::Less || rel == Mips::Le;
+    if ((!up && rel != Mips::Gt && rel != Mips::Ge) ||
+        i->GetSegment() != fpRelative ||
+        (!constantBound && (n->GetSegment() != fpRelative || written.Test(n->GetId()))))
+      continue;
+
+    // the constant added to i, by i + k (or i - k); and the offset of
+    // a variable from i: 0 for i itself, k for one holding i + k
+    auto stepOf = [&](Instruction *tac, int *k) {
+      auto binaryTac = TacCast<BinaryOp>(tac);
+      if (!binaryTac || binaryTac->GetOp1() != i ||
+          (binaryTac->GetCode() != Mips::Add && binaryTac->GetCode() != Mips::Sub))
+        return false;
+      int value = binaryTac->GetImmediate();
+      if (binaryTac->GetOp2() && !constant(binaryTac->GetOp2(), &value))
+        return false;
+      *k = binaryTac->GetCode() == Mips::Add ? value : -value;
+      return *k >= -MaxVersionedOffset && *k <= MaxVersionedOffset;
+    };
+    auto offsetFrom = [&](Location *var, int *k) {
+      *k = 0;
+      return var == i || stepOf(def(var), k);
+    };
+    bool stepped = true;
+    for (int j = loop.body.NextSetBit(0); j >= 0; j = loop.body.NextSetBit(j + 1))
+    {
+      auto block = blocks->Nth(j);
+      for (int k = 0; k < block->code.NumElements(); k++)
+      {
+        // i = i + step, or a copy of a variable holding that
+        auto tac = block->code.Nth(k);
+        auto copyTac = TacCast<Assign>(tac);
+        int step = 0;
+        if (!tac->GetKillVars().Contains(i))
+          continue;
+        if (copyTac)
+          stepped &= offsetFrom(copyTac->GetSrc(), &step);
+        else
+          stepped &= stepOf(tac, &step);
+        stepped &= up ? step > 0 : step < 0;
+      }
+    }
+    if (!stepped)
+      continue;
+
+    // the subscripts of the checks left: i + k < 0, and i + k < the
+    // length of an array
+    std::vector<Location*> arrays;
+    int minOffset = MaxVersionedOffset, maxOffset = -MaxVersionedOffset;
+    int numChecks = 0;
+    for (int j = loop.body.NextSetBit(0); j >= 0; j = loop.body.NextSetBit(j + 1))
+    {
+      auto block = blocks->Nth(j);
+      auto ifTac = TacCast<IfZ>(block->Last());
+      if (!ifTac || block->succs.NumElements() != 2 ||
+          !loop.body.Test(block->succs.Nth(1)->GetIndex()) ||
+          !BoundsProver::Halts(block->succs.Nth(1)))
+        continue;
+      std::vector<Location*> tests(1, ifTac->GetTest());
+      while (!tests.empty())
+      {
+        auto binaryTac = TacCast<BinaryOp>(def(tests.back()));
+        tests.pop_back();
+        if (!binaryTac || !binaryTac->GetOp2())
+          continue;
+        if (binaryTac->GetCode() == Mips::Or)
+        {
+          tests.push_back(binaryTac->GetOp1());
+          tests.push_back(binaryTac->GetOp2());
+        }
+        else if (binaryTac->GetCode() == Mips::Eq) // not the one below
+          tests.push_back(binaryTac->GetOp1());
+        else if (binaryTac->GetCode() == Mips::Less)
+        {
+          int k;
+          auto lengthTac = TacCast<Load>(def(binaryTac->GetOp2()));
+          Location *array = lengthTac && lengthTac->GetOffset() == -4 ?
+                            lengthTac->GetSrc() : NULL;
+          if (!offsetFrom(binaryTac->GetOp1(), &k) ||
+              (array && (array->GetSegment() != fpRelative ||
+                         written.Test(array->GetId()))))
+            continue;
+          minOffset = std::min(minOffset, k);
+          maxOffset = std::max(maxOffset, k);
+          numChecks++;
+          if (array && std::find(arrays.begin(), arrays.end(), array) == arrays.end())
+            arrays.push_back(array);
+        }
+      }
+    }
+    if (numChecks == 0 || (constantBound && up &&
+        !Mips::FitsImmediate(Mips::Less, bound + maxOffset)))
+      continue;
+
+    // The guard goes to the copy, which keeps the checks, unless the
+    // loop as it is keeps within the arrays: going up, from
+    //   i >= -minOffset and n <= length - maxOffset (or < for <=)
+    // and going down, from
+    //   i < length - maxOffset and n >= -1 - minOffset (or -minOffset)
+    const char *slowLabel = NewLabel();
+    List<Instruction*> &guard = guards[h];
+    if (up)
+      guard.Append(new IfRel(Mips::Less, i, -minOffset, slowLabel));
+    else if (!constantBound)
+      guard.Append(new IfRel(Mips::Less, n, (rel == Mips::Gt ? -1 : 0) - minOffset,
+                             slowLabel));
+    for (auto array : arrays)
+    {
+      Location *length = newTemp(), *limit = length;
+      guard.Append(new IfZ(array, slowLabel));
+      guard.Append(new Load(length, array, -4, true));
+      if (maxOffset > 0 && (!up || !constantBound))
+      {
+        limit = newTemp();
+        guard.Append(new BinaryOp(Mips::Sub, limit, length, maxOffset));
+      }
+      else if (maxOffset < 0 && (!up || !constantBound))
+      {
+        limit = newTemp();
+        guard.Append(new BinaryOp(Mips::Add, limit, length, -maxOffset));
+      }
+      if (!up)
+        guard.Append(new IfRel(Mips::Ge, i, limit, slowLabel));
+      else if (constantBound)
+        guard.Append(new IfRel(rel == Mips::Less ? Mips::Less : Mips::Le, length,
+                               bound + maxOffset, slowLabel));
+      else
+        guard.Append(new IfRel(rel == Mips::Less ? Mips::Gt : Mips::Ge, n, limit,
+                               slowLabel));
+    }
+    // (and into a block of its own, which what it tested holds in)
+    guard.Append(new Label(NewLabel()));
+    for (int j = loop.body.NextSetBit(0); j >= 0; j = loop.body.NextSetBit(j + 1))
+      copyLabel[j] = j == h ? slowLabel : NewLabel();
+    numVersioned++;
+  }
+  if (numVersioned == 0)
+  {
+    beginFuncTac->blocks.Clear();
+    functionArena.Release();
+    return false;
+  }
+
+  // The copies go before the end of the function, with their jumps
+  // within the loop retargeted and a jump for each fall through out of
+  // it (to a label added where there is none)
+  std::vector<const char*> addedLabel(numBlocks, NULL);
+  auto retargeted = [&](const char *label) {
+    auto found = blockOf.find(label);
+    return found != blockOf.end() && copyLabel[found->second] ?
+           copyLabel[found->second] : label;
+  };
+  List<Instruction*> copies;
+  CopyInstruction copier;
+  for (int j = 0; j < numBlocks; j++)
+  {
+    if (!copyLabel[j])
+      continue;
+    auto block = blocks->Nth(j);
+    copies.Append(new Label(copyLabel[j]));
+    for (int k = 0; k < block->code.NumElements(); k++)
+    {
+      auto tac = block->code.Nth(k);
+      if (k == 0 && TacCast<Label>(tac))
+        continue;
+      if (auto gotoTac = TacCast<Goto>(tac))
+        tac = new Goto(retargeted(gotoTac->GetLabel()));
+      else if (auto ifTac = TacCast<IfZ>(tac))
+        tac = new IfZ(ifTac->GetTest(), retargeted(ifTac->GetLabel()));
+      else if (auto relTac = TacCast<IfRel>(tac))
+        tac = relTac->GetOp2()
+            ? new IfRel(relTac->GetCode(), relTac->GetOp1(), relTac->GetOp2(),
+                        retargeted(relTac->GetLabel()))
+            : new IfRel(relTac->GetCode(), relTac->GetOp1(), relTac->GetImmediate(),
+                        retargeted(relTac->GetLabel()));
+      else
+        tac = copier.Visit(tac);
+      copies.Append(tac);
+    }
+    if (fallsThrough(block) && !copyLabel[j + 1])
+    {
+      auto labelTac = TacCast<Label>(blocks->Nth(j + 1)->First());
+      if (!labelTac && !addedLabel[j + 1])
+        addedLabel[j + 1] = NewLabel();
+      copies.Append(new Goto(labelTac ? labelTac->GetLabel() : addedLabel[j + 1]));
+    }
+  }
+
+  List<Instruction*> rewritten;
+  for (int j = 0; j < numBlocks; j++)
+  {
+    auto block = blocks->Nth(j);
+    rewritten.AppendAll(guards[j]);
+    if (addedLabel[j])
+      rewritten.Append(new Label(addedLabel[j]));
+    for (int k = 0; k < block->code.NumElements() - 1; k++)
+      rewritten.Append(block->code.Nth(k));
+    if (block->Last()->GetOpcode() == TacEndFunc)
+    {
+      // jumped over, as the edge blocks of FromSSA
+      Instruction *before = rewritten.Nth(rewritten.NumElements() - 1);
+      if (before->GetOpcode() == TacGoto || before->GetOpcode() == TacReturn)
+        rewritten.AppendAll(copies);
+      else
+      {
+        char *endLabel = NewLabel();
+        rewritten.Append(new Goto(endLabel));
+        rewritten.AppendAll(copies);
+        rewritten.Append(new Label(endLabel));
+      }
+    }
+    rewritten.Append(block->Last());
+  }
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("bounds", "%s: %d loops versioned", labelTac->GetLabel(), numVersioned);
+  code->ReplaceRange(start, numInstructions, rewritten);
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
+  return true;
+}
+
+// The operators whose operands may be swapped, the second one
+// becoming the one folded: Le and Ge swap into each other
+static bool SwapOperands(Mips::OpCode *code)
+{
+  switch (*code)
+  {
+    case Mips::Add: case Mips::Mul: case Mips::Eq: case Mips::Ne:
+    case Mips::And: case Mips::Or: case Mips::Xor:
+      return true;
+    case Mips::Le: *code = Mips::Ge; return true;
+    case Mips::Ge: *code = Mips::Le; return true;
+    default:
+      return false;
+  }
+}
+
+void CodeGenerator::SelectInstructions(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  int numLocations = locations->NumElements();
+
+  // The temps holding a constant: defined once, by a LoadConstant. The
+  // Tac gives each one value a temp of its own, defined before its
+  // uses, so the constant is what every use sees.
+  std::vector<int> uses(numLocations, 0), defs(numLocations, 0);
+  std::vector<LoadConstant*> constant(numLocations, NULL);
+  int end = start;
+  for (; code->Nth(end)->GetOpcode() != TacEndFunc; end++)
+  {
+    auto tac = code->Nth(end);
+    for (auto var : tac->GetGenVars())
+      uses[var->GetId()]++;
+    for (auto var : tac->GetKillVars())
+      defs[var->GetId()]++;
+    if (auto loadTac = TacCast<LoadConstant>(tac))
+      if (loadTac->GetDst()->GetSegment() == fpRelative)
+        constant[loadTac->GetDst()->GetId()] = loadTac;
+  }
+  List<Location*> *formals = beginFuncTac->GetFormals();
+  for (int i = 0; i < formals->NumElements(); i++)
+    defs[formals->Nth(i)->GetId()]++;
+  for (int id = 0; id < numLocations; id++)
+    if (defs[id] != 1)
+      constant[id] = NULL;
+  auto constantOf = [&](Location *var) {
+    return var->GetSegment() == fpRelative ? constant[var->GetId()] : NULL;
+  };
+
+  // Each BinaryOp with a constant operand that fits takes the immediate
+  // form, and a copy of a constant loads it directly
+  std::vector<Instruction*> body;
+  for (int i = start; i < end; i++)
+    body.push_back(code->Nth(i));
+  int numFolded = 0;
+  for (auto &tac : body)
+  {
+    Instruction *selected = NULL;
+    if (auto binaryTac = TacCast<BinaryOp>(tac))
+    {
+      Mips::OpCode op = binaryTac->GetCode();
+      Location *op1 = binaryTac->GetOp1(), *op2 = binaryTac->GetOp2();
+      if (op2 && op1 != op2)
+      {
+        LoadConstant *c1 = constantOf(op1), *c2 = constantOf(op2);
+        if (c1 && !c2 && SwapOperands(&op))
+        {
+          Location *t = op1; op1 = op2; op2 = t;
+          c2 = c1;
+        }
+        if (c2 && Mips::FitsImmediate(op, c2->GetValue()))
+        {
+          uses[op2->GetId()]--;
+          selected = new BinaryOp(op, binaryTac->GetDst(), op1, c2->GetValue());
+        }
+      }
+    }
+    else if (auto assignTac = TacCast<Assign>(tac))
+    {
+      if (auto c = constantOf(assignTac->GetSrc()))
+      {
+        uses[assignTac->GetSrc()->GetId()]--;
+        selected = new LoadConstant(assignTac->GetDst(), c->GetValue());
+      }
+    }
+    if (selected)
+    {
+      tac = selected;
+      numFolded++;
+    }
+  }
+
+  // A test computed only for the IfZ right after it is fused with it
+  // into one compare-and-branch, on the opposite comparison; so is a
+  // logical not, leaving a test of the operand against 0
+  int numFused = 0;
+  for (size_t k = 1; k < body.size(); k++)
+  {
+    auto ifTac = TacCast<IfZ>(body[k]);
+    auto testTac = TacCast<BinaryOp>(body[k - 1]);
+    if (!ifTac || !testTac || testTac->GetDst() != ifTac->GetTest() ||
+        ifTac->GetTest()->GetSegment() != fpRelative ||
+        uses[ifTac->GetTest()->GetId()] != 1 || defs[ifTac->GetTest()->GetId()] != 1)
+      continue;
+    Mips::OpCode op;
+    Location *op1 = testTac->GetOp1(), *op2 = testTac->GetOp2();
+    int imm = testTac->GetImmediate();
+    switch (testTac->GetCode())
+    {
+      case Mips::Eq:   op = Mips::Ne; break;
+      case Mips::Ne:   op = Mips::Eq; break;
+      case Mips::Less: op = Mips::Ge; break;
+      case Mips::Le:   op = Mips::Gt; break;
+      case Mips::Gt:   op = Mips::Le; break;
+      case Mips::Ge:   op = Mips::Less; break;
+      case Mips::Xor:
+        if (op2 || imm != 1)
+          continue;
+        op = Mips::Ne;
+        imm = 0;
+        break;
+      default:
+        continue;
+    }
+    if (op2)
+      body[k - 1] = new IfRel(op, op1, op2, ifTac->GetLabel());
+    else
+      body[k - 1] = new IfRel(op, op1, imm, ifTac->GetLabel());
+    body[k] = NULL;
+    numFused++;
+  }
+
+  // and the constants no longer used need no register nor slot
+  List<Instruction*> rewritten;
+  for (auto tac : body)
+  {
+    if (!tac)
+      continue;
+    auto loadTac = TacCast<LoadConstant>(tac);
+    if (!loadTac || constantOf(loadTac->GetDst()) != loadTac ||
+        uses[loadTac->GetDst()->GetId()] > 0)
+      rewritten.Append(tac);
+  }
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("select", "%d constants folded in %s, %d branches fused",
+             numFolded, labelTac->GetLabel(), numFused);
+  code->ReplaceRange(start, end - start, rewritten);
+}
+
+void CodeGenerator::ReduceStrength(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  BuildCFG(start);
+  LiveVariableAnalysis(start);
+  auto blocks = &beginFuncTac->blocks;
+  int numBlocks = blocks->NumElements(), numInstructions = 0;
+  for (int j = 0; j < numBlocks; j++)
+    numInstructions += blocks->Nth(j)->code.NumElements();
+  std::vector<Loop> loops;
+  FindLoops(blocks, &loops);
+  auto newTemp = [&](const char *name) {
+    Location *temp = locations->Intern(fpRelative,
+        OffsetToFirstLocal - beginFuncTac->GetFrameSize(), name);
+    beginFuncTac->SetFrameSize(beginFuncTac->GetFrameSize() + VarSize);
+    return temp;
+  };
+  auto addConstant = [&](Location *dst, Location *src, int value,
+                         List<Instruction*> *out) {
+    if (value == 0)
+      out->Append(new Assign(dst, src));
+    else if (Mips::FitsImmediate(Mips::Add, value))
+      out->Append(new BinaryOp(Mips::Add, dst, src, value));
+    else
+    {
+      Location *temp = newTemp("_offset");
+      out->Append(new LoadConstant(temp, value));
+      out->Append(new BinaryOp(Mips::Add, dst, src, temp));
+    }
+  };
+
+  // An index is a local the loop only steps, by a constant, and an
+  // address computed from it base + index*k, with the base not written
+  // in the loop, is worth a pointer of its own: set to it before the
+  // loop and stepped by k times as much right after the index, so it
+  // always is base + index*k (mod 2^32, as the multiply and the add
+  // would give). The address must be read only as one, before the
+  // index is stepped again, in its block or those it alone goes to,
+  // and the product only for such addresses in its block, which
+  // leaves neither to compute. The loops inside
+  // go first, their pointers being set in the body of the loop around.
+  struct Pointer { Location *index; int k; Location *base, *p; };
+  int numReduced = 0, numPointers = 0, numReplaced = 0;
+  for (int l = (int) loops.size() - 1; l >= 0; l--)
+  {
+    Loop &loop = loops[l];
+    BasicBlock *head = loop.head, *preheader = NULL;
+    int numEntries = 0;
+    for (int p = 0; p < head->preds.NumElements(); p++)
+      if (!loop.body.Test(head->preds.Nth(p)->GetIndex()))
+      {
+        preheader = head->preds.Nth(p);
+        numEntries++;
+      }
+    if (numEntries != 1 || preheader->succs.NumElements() != 1)
+      continue;
+
+    // the reads and writes of each variable, and the steps in the loop
+    int numLocations = locations->NumElements();
+    std::vector<int> reads(numLocations, 0), writes(numLocations, 0);
+    std::vector<int> loopWrites(numLocations, 0), numSteps(numLocations, 0);
+    std::map<Instruction*, int> step; // by how much
+    for (int j = 0; j < numBlocks; j++)
+    {
+      auto block = blocks->Nth(j);
+      bool inLoop = loop.body.Test(j);
+      for (int k = 0; k < block->code.NumElements(); k++)
+      {
+        auto tac = block->code.Nth(k);
+        for (auto var : tac->GetGenVars())
+          reads[var->GetId()]++;
+        for (auto var : tac->GetKillVars())
+        {
+          writes[var->GetId()]++;
+          loopWrites[var->GetId()] += inLoop;
+        }
+        auto binaryTac = TacCast<BinaryOp>(tac);
+        if (!inLoop || !binaryTac || binaryTac->GetOp2() ||
+            binaryTac->GetDst() != binaryTac->GetOp1() ||
+            binaryTac->GetDst()->GetSegment() != fpRelative)
+          continue;
+        if (binaryTac->GetCode() == Mips::Add)
+          step[tac] = binaryTac->GetImmediate();
+        else if (binaryTac->GetCode() == Mips::Sub)
+          step[tac] = -binaryTac->GetImmediate();
+        else
+          continue;
+        numSteps[binaryTac->GetDst()->GetId()]++;
+      }
+    }
+    auto isIndex = [&](Location *var) {
+      int id = var->GetId();
+      return var->GetSegment() == fpRelative && numSteps[id] > 0 &&
+             numSteps[id] == loopWrites[id];
+    };
+    auto stepsFit = [&](Location *index, long long k) {
+      for (auto &s : step)
+        if (s.first->GetKillVars().Nth(0) == index &&
+            (k * s.second != (int) (k * s.second) ||
+             !Mips::FitsImmediate(Mips::Add, k * s.second)))
+          return false;
+      return true;
+    };
+
+    // the products reduced and the addresses they are found in
+    std::vector<Pointer> pointers;
+    std::set<Instruction*> dropped;
+    std::map<int, Location*> pointerFor; // by address id
+    for (int j = loop.body.NextSetBit(0); j >= 0; j = loop.body.NextSetBit(j + 1))
+    {
+      auto block = blocks->Nth(j);
+      if (BoundsProver::Halts(block))
+        continue;
+      for (int k = 0; k < block->code.NumElements(); k++)
+      {
+        auto mulTac = TacCast<BinaryOp>(block->code.Nth(k));
+        if (!mulTac || mulTac->GetCode() != Mips::Mul || mulTac->GetOp2() ||
+            !isIndex(mulTac->GetOp1()) || writes[mulTac->GetDst()->GetId()] != 1 ||
+            mulTac->GetDst() == mulTac->GetOp1() ||
+            !stepsFit(mulTac->GetOp1(), mulTac->GetImmediate()))
+          continue;
+        Location *index = mulTac->GetOp1(), *product = mulTac->GetDst();
+        std::vector<BinaryOp*> adds;
+        int productReads = 0;
+        bool stepped = false;
+        for (int m = k + 1; m < block->code.NumElements() && !stepped; m++)
+        {
+          auto tac = block->code.Nth(m);
+          for (auto var : tac->GetGenVars())
+            productReads += var == product;
+          for (auto var : tac->GetKillVars())
+            stepped = stepped || var == index;
+          auto addTac = TacCast<BinaryOp>(tac);
+          if (!addTac || addTac->GetCode() != Mips::Add || !addTac->GetOp2() ||
+              addTac->GetOp1() == addTac->GetOp2() ||
+              (addTac->GetOp1() != product && addTac->GetOp2() != product))
+            continue;
+          Location *base = addTac->GetOp1() == product ? addTac->GetOp2() : addTac->GetOp1(),
+              *address = addTac->GetDst();
+          if (base->GetSegment() != fpRelative || loopWrites[base->GetId()] > 0 ||
+              address->GetSegment() != fpRelative || writes[address->GetId()] != 1)
+            break;
+          int addressReads = 0;
+          bool steps = false;
+          for (BasicBlock *at = block; at && !steps; )
+          {
+            for (int u = at == block ? m + 1 : 0; u < at->code.NumElements() && !steps; u++)
+            {
+              auto useTac = at->code.Nth(u);
+              auto loadTac = TacCast<Load>(useTac);
+              auto storeTac = TacCast<Store>(useTac);
+              if ((loadTac && loadTac->GetSrc() == address) ||
+                  (storeTac && storeTac->GetDst() == address && storeTac->GetSrc() != address))
+                addressReads++;
+              for (auto var : useTac->GetKillVars())
+                steps = steps || var == index;
+            }
+            // on into a block only this one goes to
+            BasicBlock *next = at->succs.NumElements() == 1 ? at->succs.Nth(0) : NULL;
+            at = next && next != head && next->preds.NumElements() == 1 &&
+                 loop.body.Test(next->GetIndex()) ? next : NULL;
+          }
+          if (addressReads != reads[address->GetId()])
+            break;
+          adds.push_back(addTac);
+        }
+        if (productReads != reads[product->GetId()] ||
+            (int) adds.size() != reads[product->GetId()])
+          continue;
+
+        dropped.insert(mulTac);
+        for (auto addTac : adds)
+        {
+          Location *base = addTac->GetOp1() == product ? addTac->GetOp2() : addTac->GetOp1();
+          Location *p = NULL;
+          for (auto &pointer : pointers)
+            if (pointer.index == index && pointer.k == mulTac->GetImmediate() &&
+                pointer.base == base)
+              p = pointer.p;
+          if (!p)
+          {
+            p = newTemp("_ptr");
+            pointers.push_back({index, mulTac->GetImmediate(), base, p});
+          }
+          dropped.insert(addTac);
+          pointerFor[addTac->GetDst()->GetId()] = p;
+          numReduced++;
+        }
+      }
+    }
+    if (pointers.empty())
+      continue;
+    numPointers += pointers.size();
+
+    // The index's value on entry, when it is a constant set on the way
+    // there; a block of its own writing it then is where
+    auto entryValue = [&](Location *index, int *value, Instruction **def) {
+      BasicBlock *block = preheader;
+      for (int n = 0; n < numBlocks; n++)
+      {
+        for (int k = block->code.NumElements() - 1; k >= 0; k--)
+          for (auto var : block->code.Nth(k)->GetKillVars())
+            if (var == index)
+            {
+              auto constTac = TacCast<LoadConstant>(block->code.Nth(k));
+              if (constTac)
+                *value = constTac->GetValue();
+              *def = block == preheader ? constTac : NULL;
+              return constTac != NULL;
+            }
+        if (block->preds.NumElements() != 1)
+          return false;
+        block = block->preds.Nth(0);
+      }
+      return false;
+    };
+
+    // An index then read only by the test in the head, against a
+    // constant, and dead where the loop exits, is needed no more: the
+    // test is made on one of its pointers instead, against base + k
+    // times the bound. Stepping toward the bound, each step in the loop
+    // and not one inside, the index stays between its start and the
+    // bound plus the steps, and for small ones the pointer stays close
+    // enough to its base (an array, or null) not to wrap: it compares
+    // as the index does.
+    List<Instruction*> setUp;
+    std::map<Instruction*, Instruction*> replaced;
+    std::set<int> indices;
+    for (auto &pointer : pointers)
+      indices.insert(pointer.index->GetId());
+    for (auto &pointer : pointers)
+    {
+      Location *index = pointer.index;
+      int entry = 0;
+      Instruction *def = NULL;
+      long long k = pointer.k;
+      bool known = entryValue(index, &entry, &def) && k * entry == (int) (k * entry);
+      if (known)
+        addConstant(pointer.p, pointer.base, (int) (k * entry), &setUp);
+      else
+      {
+        Location *temp = newTemp("_offset");
+        setUp.Append(new BinaryOp(Mips::Mul, temp, index, pointer.k));
+        setUp.Append(new BinaryOp(Mips::Add, pointer.p, pointer.base, temp));
+      }
+      if (!indices.count(index->GetId()))
+        continue; // the test is on another of its pointers
+      indices.erase(index->GetId());
+
+      auto ifTac = TacCast<IfRel>(head->Last());
+      if (!known || !ifTac || ifTac->GetOp1() != index || ifTac->GetOp2() || k == 0 ||
+          loop.body.Test(head->succs.Nth(0)->GetIndex()) ==
+          loop.body.Test(head->succs.Nth(1)->GetIndex()))
+        continue;
+      bool exitsIfTrue = !loop.body.Test(head->succs.Nth(0)->GetIndex());
+      Mips::OpCode exit = ifTac->GetCode();
+      if (!exitsIfTrue)
+        switch (exit)
+        {
+          case Mips::Less: exit = Mips::Ge; break;
+          case Mips::Le:   exit = Mips::Gt; break;
+          case Mips::Gt:   exit = Mips::Le; break;
+          case Mips::Ge:   exit = Mips::Less; break;
+          default:         break;
+        }
+      bool up = true, down = true;
+      int indexReads = 0;
+      long long reach = std::max(llabs(entry), llabs(ifTac->GetImmediate()));
+      for (int j = loop.body.NextSetBit(0); j >= 0; j = loop.body.NextSetBit(j + 1))
+      {
+        auto block = blocks->Nth(j);
+        for (int s = 0; s < block->succs.NumElements(); s++)
+          if (!loop.body.Test(block->succs.Nth(s)->GetIndex()) &&
+              block->succs.Nth(s)->liveIn->Contains(index))
+            up = down = false;
+        for (int m = 0; m < block->code.NumElements(); m++)
+        {
+          auto tac = block->code.Nth(m);
+          if (step.count(tac) && tac->GetKillVars().Nth(0) == index)
+          {
+            up = up && step[tac] > 0 && block->loopDepth == head->loopDepth;
+            down = down && step[tac] < 0 && block->loopDepth == head->loopDepth;
+            reach += llabs(step[tac]);
+          }
+          else if (!dropped.count(tac))
+            for (auto var : tac->GetGenVars())
+              indexReads += var == index;
+        }
+      }
+      for (int m = 0; def && m < preheader->code.NumElements(); m++)
+        for (auto var : preheader->code.Nth(m)->GetGenVars())
+          if (var == index)
+            def = NULL; // still read
+      if (indexReads != 1 || llabs(k) * reach > MaxPointerReach || !((up && (exit == Mips::Ge || exit == Mips::Gt)) ||
+                               (down && (exit == Mips::Le || exit == Mips::Less))))
+        continue;
+
+      Location *limit = newTemp("_limit");
+      addConstant(limit, pointer.base, (int) (k * ifTac->GetImmediate()), &setUp);
+      Mips::OpCode code = ifTac->GetCode();
+      if (k < 0)
+        switch (code)
+        {
+          case Mips::Less: code = Mips::Gt; break;
+          case Mips::Le:   code = Mips::Ge; break;
+          case Mips::Gt:   code = Mips::Less; break;
+          case Mips::Ge:   code = Mips::Le; break;
+          default:         break;
+        }
+      replaced[ifTac] = new IfRel(code, pointer.p, limit, ifTac->GetLabel());
+      for (auto &s : step)
+        if (s.first->GetKillVars().Nth(0) == index)
+          dropped.insert(s.first);
+      if (def)
+        dropped.insert(def);
+      numReplaced++;
+    }
+
+    // the addresses read from the pointers, stepped after the indices
+    for (int j = loop.body.NextSetBit(0); j >= 0; j = loop.body.NextSetBit(j + 1))
+    {
+      auto block = blocks->Nth(j);
+      List<Instruction*> kept;
+      for (int k = 0; k < block->code.NumElements(); k++)
+      {
+        auto tac = block->code.Nth(k);
+        if (replaced.count(tac))
+          tac = replaced[tac];
+        for (auto var : tac->GetGenVars())
+          if (pointerFor.count(var->GetId()))
+            tac = tac->Rename(var, pointerFor[var->GetId()]);
+        if (!dropped.count(block->code.Nth(k)))
+          kept.Append(tac);
+        if (!step.count(block->code.Nth(k)))
+          continue;
+        for (auto &pointer : pointers)
+          if (pointer.index == block->code.Nth(k)->GetKillVars().Nth(0))
+            kept.Append(new BinaryOp(Mips::Add, pointer.p, pointer.p,
+                                     pointer.k * step[block->code.Nth(k)]));
+      }
+      block->code = kept;
+    }
+    List<Instruction*> kept;
+    for (int k = 0; k < preheader->code.NumElements(); k++)
+      if (!dropped.count(preheader->code.Nth(k)))
+        kept.Append(preheader->code.Nth(k));
+    int at = kept.NumElements();
+    if (at > 0 && kept.Nth(at - 1)->IsBlockEnd())
+      at--; // a Goto to the head
+    for (int k = 0; k < setUp.NumElements(); k++)
+      kept.InsertAt(setUp.Nth(k), at + k);
+    preheader->code = kept;
+  }
+
+  List<Instruction*> rewritten;
+  for (int j = 0; j < numBlocks; j++)
+    rewritten.AppendAll(blocks->Nth(j)->code);
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("sr", "%s: %d addresses stepped as %d pointers, %d tests replaced",
+             labelTac->GetLabel(), numReduced, numPointers, numReplaced);
+  code->ReplaceRange(start, numInstructions, rewritten);
+  beginFuncTac->blocks.Clear();
+  functionArena.Release();
+}
+
+bool CodeGenerator::OverBudget(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  int numInstructions = 0;
+  while (code->Nth(start + numInstructions)->GetOpcode() != TacEndFunc)
+    numInstructions++;
+  return numInstructions > GetAllocatorBudget() ||
+         beginFuncTac->locations->NumElements() > GetAllocatorBudget();
+}
+
+void CodeGenerator::AllocateRegisters(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  beginFuncTac->locations->Register(Mips::v0); // for the moves of results
+  for (int i = 0; i < Mips::NumArgRegs; i++)     // and of arguments
+    beginFuncTac->locations->Register(Mips::Register(Mips::a0 + i));
+
+  // coloring the interference graph of a huge function takes too long
+  bool linearScan = GetRegisterAllocator() == LinearScanAllocator;
+  if (GetRegisterAllocator() == AutomaticAllocator)
+    linearScan = OverBudget(start);
+
+  for (int round = 1; ; round++)
+  {
+    BuildCFG(start);
+    LiveVariableAnalysis(start);
+    List<Spill> spills;
+    if (linearScan)
+      LinearScanAllocate(start, &spills);
+    else
+    {
+      BuildInterferenceGraph(beginFuncTac);
+      List<Location*> uncolored;
+      ColorInterferenceGraph(beginFuncTac, &uncolored);
+      for (int i = 0; i < uncolored.NumElements(); i++)
+        spills.Append({uncolored.Nth(i), 0});
+    }
+    if (spills.NumElements() == 0)
+      break;
+
+    // Whatever is still uncolored after the last round just stays in
+    // memory, which the Mips emitter handles with its own scratch
+    // registers, so giving up is always safe.
+    PrintDebug("regalloc", "round %d: %d locations spilled", round,
+               spills.NumElements());
+    if (round == MaxAllocationRounds)
+      break;
+    beginFuncTac->blocks.Clear();
+    functionArena.Release();
+    RewriteSpills(start, &spills);
+  }
+
+  // the callee-saved registers the function uses are saved on entry
+  auto locations = beginFuncTac->locations;
+  bool used[Mips::NumRegs] = {false};
+  for (int i = 0; i < locations->NumElements(); i++)
+    used[locations->Nth(i)->GetRegister()] = true;
+  for (int r = 0; r < Mips::NumRegs; r++)
+    if (used[r] && Mips::IsCalleeSaved((Mips::Register) r))
+      beginFuncTac->calleeSaved.Append((Mips::Register) r);
+
+  AllocateFrameSlots(beginFuncTac);
+}
+
+void CodeGenerator::BuildCFG(int start)
+{
+  BeginFunc* currentFunc = TacCast<BeginFunc>(code->Nth(start));
+  BasicBlock* block = nullptr;
+  Hashtable<BasicBlock*> labelToBlock;
+  for (int i = start; i < code->NumElements(); i++)
+  {
+    auto tac = code->Nth(i);
+
+    // a label starts a new block, and so does whatever follows a jump
+    auto labelTac = TacCast<Label>(tac);
+    if (!block || labelTac)
+    {
+      block = functionArena.New<BasicBlock>(currentFunc->blocks.NumElements());
+      currentFunc->blocks.Append(block);
+    }
+    block->code.Append(tac);
+    if (labelTac)
+      labelToBlock.Enter(labelTac->GetLabel(), block);
+
+    if (tac->IsBlockEnd())
+      block = nullptr;
+
+    if (tac->GetOpcode() == TacEndFunc)
+      break;
+  }
+
+  auto blocks = &currentFunc->blocks;
+  for (int j = 0; j < blocks->NumElements(); j++)
+  {
+    auto from = blocks->Nth(j);
+    auto last = from->Last();
+    switch (last->GetOpcode())
+    {
+      case TacIfZ:
+        from->AddSuccessor(labelToBlock.Lookup(static_cast<IfZ*>(last)->GetLabel()));
+        from->AddSuccessor(blocks->Nth(j + 1));
+        break;
+      case TacIfRel:
+        from->AddSuccessor(labelToBlock.Lookup(static_cast<IfRel*>(last)->GetLabel()));
+        from->AddSuccessor(blocks->Nth(j + 1));
+        break;
+      case TacGoto:
+        from->AddSuccessor(labelToBlock.Lookup(static_cast<Goto*>(last)->GetLabel()));
+        break;
+      case TacReturn:
+      case TacEndFunc:
+        break;
+      default:
+        from->AddSuccessor(blocks->Nth(j + 1));
+        break;
+    }
+  }
+  ComputeLoopDepths(blocks);
+}
+
+
+void CodeGenerator::LiveVariableAnalysis(int start)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  auto blocks = &beginFuncTac->blocks;
+  for (int j = 0; j < blocks->NumElements(); j++)
+    blocks->Nth(j)->ComputeUseDef(&functionArena, locations);
+
+  LiveVariables liveness(locations);
+  DataflowSolver<LiveVariables, Backward> solver(&liveness, blocks);
+  solver.Solve();
+  auto labelTac = TacCast<Label>(code->Nth(start - 1)); // function label
+  PrintDebug("dataflow", "liveness of %s: %d blocks, %d locations, "
+             "%d block visits in %d passes", labelTac->GetLabel(),
+             blocks->NumElements(), locations->NumElements(),
+             solver.NumVisits(), solver.NumPasses());
+
+  for (int j = 0; j < blocks->NumElements(); j++)
+  {
+    auto block = blocks->Nth(j);
+    block->liveIn = functionArena.New<LiveVars>(locations);
+    block->liveOut = functionArena.New<LiveVars>(locations);
+    block->liveIn->GetBits() = solver.In(block);
+    block->liveOut->GetBits() = solver.Out(block);
+  }
+}
+
+void CodeGenerator::BuildInterferenceGraph(BeginFunc *beginFuncTac)
+{
+  auto locations = beginFuncTac->locations;
+  auto blocks = &beginFuncTac->blocks;
+  auto currentGraph = functionArena.New<InterferenceGraph>(locations->NumElements());
+  beginFuncTac->interferenceGraph = currentGraph;
+
+  // spilled locations live in memory and stay out of the graph
+  BitVector inMemory(locations->NumElements());
+  for (int i = 0; i < beginFuncTac->spilled.NumElements(); i++)
+    inMemory.Set(beginFuncTac->spilled.Nth(i)->GetId());
+
+  // Calls leave their result in $v0 and Return wants its value there,
+  // so each is a move from or to the (precolored) node for $v0, which
+  // interferes with whatever is live across a call
+  int returnReg = locations->Register(Mips::v0)->GetId();
+  currentGraph->AddNode(returnReg);
+
+  // Likewise the first arguments of a call are moves to the nodes for
+  // $a0-$a3, and the formals moves from them on entry. An argument
+  // register written by a PushParam holds its value up to the call, so
+  // whatever is written in between interferes with it, and a call
+  // leaves none of them as it was.
+  int argReg[Mips::NumArgRegs];
+  for (int i = 0; i < Mips::NumArgRegs; i++)
+  {
+    argReg[i] = locations->Register(Mips::Register(Mips::a0 + i))->GetId();
+    currentGraph->AddNode(argReg[i]);
+  }
+
+  BitVector gen(locations->NumElements()), kill(locations->NumElements());
+  for (int j = 0; j < blocks->NumElements(); j++)
+  {
+    // each load or store a spill would need is weighted by 10 per
+    // enclosing loop
+    auto block = blocks->Nth(j);
+    double weight = 1;
+    for (int d = 0; d < block->loopDepth; d++)
+      weight *= 10;
+
+    // walk the block backwards from its live-out set, recovering the
+    // live-in and live-out sets of each instruction in turn
+    LiveVars liveVarsOut(*(block->liveOut));
+    LiveVars liveVarsIn(locations);
+    int argsPending = 0; // the argument registers holding values for a call
+    for (int k = block->code.NumElements() - 1; k >= 0; k--)
+    {
+      auto tac = block->code.Nth(k);
+      GetGenKill(tac, gen, kill);
+      liveVarsIn.GetBits().AssignTransfer(gen, liveVarsOut.GetBits(), kill);
+
+      // the moves; the source of a copy needs no edge to its
+      // destination, as they hold the same value
+      Location *moveSrc = NULL;
+      auto &genVars = tac->GetGenVars(), &killVars = tac->GetKillVars();
+      if (tac->GetOpcode() == TacAssign && genVars.NumElements() == 1 &&
+          killVars.NumElements() == 1 && !inMemory.Test(genVars.Nth(0)->GetId()) &&
+          !inMemory.Test(killVars.Nth(0)->GetId()))
+      {
+        moveSrc = genVars.Nth(0);
+        currentGraph->AddMove(killVars.Nth(0)->GetId(), moveSrc->GetId());
+      }
+      else if (tac->IsCall())
+      {
+        Location *result = killVars.NumElements() ? killVars.Nth(0) : NULL;
+        if (result && !inMemory.Test(result->GetId()))
+          currentGraph->AddMove(result->GetId(), returnReg);
+        for (auto outTac : liveVarsOut)
+          if (outTac != result && !inMemory.Test(outTac->GetId()))
+          {
+            currentGraph->AddEdge(returnReg, outTac->GetId());
+            for (int i = 0; i < Mips::NumArgRegs; i++)
+              currentGraph->AddEdge(argReg[i], outTac->GetId());
+          }
+      }
+      else if (tac->GetOpcode() == TacReturn && genVars.NumElements() == 1 &&
+               !inMemory.Test(genVars.Nth(0)->GetId()))
+        currentGraph->AddMove(returnReg, genVars.Nth(0)->GetId());
+      else if (auto pushTac = TacCast<PushParam>(tac))
+      {
+        // pushed from the last argument down, so the registers of the
+        // arguments still to come are written later
+        int i = pushTac->GetIndex();
+        if (i < Mips::NumArgRegs)
+        {
+          Location *param = genVars.NumElements() ? genVars.Nth(0) : NULL;
+          if (param && !inMemory.Test(param->GetId()))
+            currentGraph->AddMove(argReg[i], param->GetId());
+          for (auto outTac : liveVarsOut)
+            if (outTac != param && !inMemory.Test(outTac->GetId()))
+              currentGraph->AddEdge(argReg[i], outTac->GetId());
+          argsPending = i;
+        }
+      }
+      else if (auto beginTac = TacCast<BeginFunc>(tac))
+      {
+        List<Location*> *formals = beginTac->GetFormals();
+        for (int i = 0; i < formals->NumElements() && i < Mips::NumArgRegs; i++)
+        {
+          Location *formal = formals->Nth(i);
+          if (liveVarsOut.Contains(formal) && !inMemory.Test(formal->GetId()))
+            currentGraph->AddMove(formal->GetId(), argReg[i]);
+          for (auto outTac : liveVarsOut)
+            if (outTac != formal && !inMemory.Test(outTac->GetId()))
+              currentGraph->AddEdge(argReg[i], outTac->GetId());
+        }
+      }
+
+      // two variables live at the same point got there by one of them
+      // being written while the other was live, so edges are only
+      // needed from each write to what is live after it
+      for (auto killTac : killVars)
+      {
+        if (inMemory.Test(killTac->GetId()))
+          continue;
+        currentGraph->AddNode(killTac->GetId());
+        currentGraph->AddSpillCost(killTac->GetId(), weight);
+        for (auto outTac : liveVarsOut)
+          if (outTac != moveSrc && !inMemory.Test(outTac->GetId()))
+            currentGraph->AddEdge(killTac->GetId(), outTac->GetId());
+        for (int i = 0; i < argsPending; i++)
+          currentGraph->AddEdge(killTac->GetId(), argReg[i]);
+      }
+      for (auto genTac : genVars)
+      {
+        if (inMemory.Test(genTac->GetId()))
+          continue;
+        currentGraph->AddNode(genTac->GetId());
+        currentGraph->AddSpillCost(genTac->GetId(), weight);
+      }
+
+      // the registers to save around a call are those holding values
+      // needed after it, less the call's own result
+      if (auto callTac = TacCast<FnCall>(tac))
+      {
+        callTac->liveVarsAcross = functionArena.New<LiveVars>(liveVarsOut);
+        callTac->liveVarsAcross->GetBits().Subtract(kill);
+        argsPending = callTac->GetNumArgs() < Mips::NumArgRegs ?
+                      callTac->GetNumArgs() : Mips::NumArgRegs;
+      }
+
+      liveVarsOut = liveVarsIn;
+    }
+
+    // except for the variables live on entry (the parameters), which
+    // are all written at once by BeginFunc
+    if (j == 0)
+      for (auto fromTac : liveVarsOut)
+        for (auto toTac : liveVarsOut)
+          if (!inMemory.Test(fromTac->GetId()) && !inMemory.Test(toTac->GetId()))
+            currentGraph->AddEdge(fromTac->GetId(), toTac->GetId());
+  }
+
+  // spilling a spill temp again would gain nothing
+  for (int i = 0; i < beginFuncTac->spillTemps.NumElements(); i++)
+    currentGraph->SetUnspillable(beginFuncTac->spillTemps.Nth(i)->GetId());
+
+  currentGraph->SetUnspillable(returnReg);
+  for (int i = 0; i < Mips::NumArgRegs; i++)
+    currentGraph->SetUnspillable(argReg[i]);
+
+  PrintDebug("regalloc", "interference graph of %d locations, %d edges, "
+             "%d moves", locations->NumElements(), currentGraph->NumEdges(),
+             (int) currentGraph->Moves().size());
+}
+
+
+// The registers given to locations, in order of preference. The
+// caller-saved ones come first, as they cost nothing unless they are
+// live across a call, and a callee-saved one must be saved on entry.
+// Nothing live across a call can have $v0; the moves of call results
+// and return values get it by coalescing.
+static const int generalPurposeRegs[]
+  = {Mips::t0, Mips::t1, Mips::t2, Mips::t3, Mips::t4, Mips::t5, Mips::t6,
+     Mips::t7, Mips::t8, Mips::v0, Mips::s0, Mips::s1, Mips::s2, Mips::s3,
+     Mips::s4, Mips::s5, Mips::s6, Mips::s7};
+static const int K = sizeof(generalPurposeRegs) / sizeof(generalPurposeRegs[0]);
+
+// For values live across calls the other way round: a callee-saved
+// register is saved once per call of the function, a caller-saved one
+// around every call the value is live across
+static const int acrossCallRegs[]
+  = {Mips::s0, Mips::s1, Mips::s2, Mips::s3, Mips::s4, Mips::s5, Mips::s6,
+     Mips::s7, Mips::t0, Mips::t1, Mips::t2, Mips::t3, Mips::t4, Mips::t5,
+     Mips::t6, Mips::t7, Mips::t8};
+static const int NumAcrossCallRegs = sizeof(acrossCallRegs) / sizeof(acrossCallRegs[0]);
+
+void CodeGenerator::ColorInterferenceGraph(BeginFunc *beginFuncTac,
+                                           List<Location*> *spills)
+{
+  auto currentGraph = beginFuncTac->interferenceGraph;
+  auto locations = beginFuncTac->locations;
+  int numNodes = currentGraph->NumNodes();
+
+  std::vector<int> palette(generalPurposeRegs, generalPurposeRegs + K);
+  std::vector<int> precolored(numNodes);
+  for (int i = 0; i < numNodes; i++)
+    if (locations->IsRegister(locations->Nth(i)))
+      precolored[i] = locations->Nth(i)->GetRegister();
+
+  std::vector<int> crossingPalette(acrossCallRegs, acrossCallRegs + NumAcrossCallRegs);
+  GraphColoring coloring(currentGraph, palette, precolored);
+  // values live across calls prefer the callee-saved registers
+  auto blocks = &beginFuncTac->blocks;
+  BitVector crossesCall(numNodes);
+  for (int j = 0; j < blocks->NumElements(); j++)
+    for (int i = 0; i < blocks->Nth(j)->code.NumElements(); i++)
+      if (auto callTac = TacCast<FnCall>(blocks->Nth(j)->code.Nth(i)))
+        crossesCall.UnionWith(callTac->liveVarsAcross->GetBits());
+  for (int i = crossesCall.NextSetBit(0); i >= 0; i = crossesCall.NextSetBit(i + 1))
+    coloring.Prefer(i, &crossingPalette);
+  coloring.Color();
+  for (int i = 0; i < numNodes; i++)
+    if (!precolored[i])
+      locations->Nth(i)->SetRegister((Mips::Register) coloring.ColorOf(i));
+  for (auto node : coloring.Spilled())
+    spills->Append(locations->Nth(node));
+  PrintDebug("regalloc", "%d moves coalesced", coloring.NumCoalesced());
+}
+
+
+void CodeGenerator::LinearScanAllocate(int start, List<Spill> *spills)
+{
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  auto blocks = &beginFuncTac->blocks;
+  int numLocations = locations->NumElements();
+  BitVector inMemory(numLocations), unspillable(numLocations);
+  for (int i = 0; i < beginFuncTac->spilled.NumElements(); i++)
+    inMemory.Set(beginFuncTac->spilled.Nth(i)->GetId());
+  for (int i = 0; i < beginFuncTac->spillTemps.NumElements(); i++)
+    unspillable.Set(beginFuncTac->spillTemps.Nth(i)->GetId());
+
+  // Instruction k (counted from the BeginFunc) reads at position 2k and
+  // writes at 2k+1. The interval of a location spans the positions it
+  // is used, defined, or live in or out of a block at, so it costs the
+  // size of the block liveness sets to find, rather than a walk over
+  // the live variables of every instruction.
+  std::vector<int> first(numLocations, -1), last(numLocations, -1);
+  auto extend = [&](Location *loc, int pos) {
+    int id = loc->GetId();
+    if (first[id] < 0 || pos < first[id])
+      first[id] = pos;
+    if (pos > last[id])
+      last[id] = pos;
+  };
+  std::vector<int> blockFirst(blocks->NumElements());
+  std::vector<int> blockLast(blocks->NumElements());
+  std::vector<int> callsBefore(1, 0); // calls at positions < p
+  int k = 0;
+  for (int j = 0; j < blocks->NumElements(); j++)
+  {
+    auto block = blocks->Nth(j);
+    bool hasCall = false;
+    blockFirst[j] = k;
+    for (auto var : *(block->liveIn))
+      extend(var, 2 * k);
+    for (int i = 0; i < block->code.NumElements(); i++, k++)
+    {
+      auto tac = block->code.Nth(i);
+      for (auto var : tac->GetGenVars())
+        extend(var, 2 * k);
+      for (auto var : tac->GetKillVars())
+        extend(var, 2 * k + 1);
+      hasCall |= tac->IsCall();
+      callsBefore.push_back(callsBefore.back() + tac->IsCall());
+      callsBefore.push_back(callsBefore.back());
+    }
+    blockLast[j] = k - 1;
+    for (auto var : *(block->liveOut))
+      extend(var, 2 * k - 1);
+
+    // the registers to save around a call are those holding values
+    // needed after it, less the call's own result; the walk back to
+    // each call updates the live set one variable at a time
+    if (!hasCall)
+      continue;
+    LiveVars liveVarsOut(*(block->liveOut));
+    for (int i = block->code.NumElements() - 1; i >= 0; i--)
+    {
+      auto tac = block->code.Nth(i);
+      for (auto var : tac->GetKillVars())
+        liveVarsOut.Erase(var);
+      if (auto callTac = TacCast<FnCall>(tac))
+        callTac->liveVarsAcross = functionArena.New<LiveVars>(liveVarsOut);
+      for (auto var : tac->GetGenVars())
+        liveVarsOut.Insert(var);
+    }
+  }
+
+  std::vector<LiveInterval> intervals;
+  for (int id = 0; id < numLocations; id++)
+  {
+    Location *loc = locations->Nth(id);
+    if (locations->IsRegister(loc))
+      continue;
+    loc->SetRegister(Mips::zero);
+    if (first[id] < 0 || inMemory.Test(id))
+      continue;
+    bool crossesCall = callsBefore[last[id]] > callsBefore[first[id]];
+    intervals.push_back({id, first[id], last[id], crossesCall,
+                         unspillable.Test(id)});
+  }
+  PrintDebug("regalloc", "linear scan over %d intervals, %d instructions",
+             (int) intervals.size(), k);
+
+  std::vector<int> palette(generalPurposeRegs, generalPurposeRegs + K);
+  std::vector<int> crossingPalette(acrossCallRegs, acrossCallRegs + NumAcrossCallRegs);
+  LinearScan scan(numLocations, palette, crossingPalette);
+  scan.Allocate(intervals);
+  for (auto &interval : intervals)
+    locations->Nth(interval.id)->SetRegister((Mips::Register) scan.ColorOf(interval.id));
+
+  // An interval split at position at keeps its register up to the
+  // instruction at / 2. That is only right if no value can reach the
+  // part before from the part after, i.e. no block in the first part
+  // that the location is live into is entered from the second part (by
+  // a loop back edge); otherwise the whole interval is spilled.
+  for (auto &split : scan.Splits())
+  {
+    Location *var = locations->Nth(split.id);
+    int from = split.at / 2;
+    if (from <= first[split.id] / 2)
+      from = 0;
+    for (int j = 0; j < blocks->NumElements() && from; j++)
+    {
+      auto block = blocks->Nth(j);
+      if (2 * blockFirst[j] < first[split.id] || 2 * blockFirst[j] >= split.at ||
+          !block->liveIn->Contains(var))
+        continue;
+      for (int p = 0; p < block->preds.NumElements(); p++)
+        if (blockLast[block->preds.Nth(p)->GetIndex()] >= from)
+          from = 0;
+    }
+    spills->Append({var, from});
+  }
+}
+
+
+void CodeGenerator::AllocateFrameSlots(BeginFunc *beginFuncTac)
+{
+  // Every local and temp was given a slot of its own as it was made,
+  // but only two kinds of location are ever in memory: those with no
+  // register, and those whose caller-saved register is stored around a
+  // call they are live across. Locations with the same offset (a
+  // spilled variable, its home and its spill temps) share one slot.
+  auto locations = beginFuncTac->locations;
+  auto blocks = &beginFuncTac->blocks;
+  int numLocations = locations->NumElements();
+  auto slotOf = [](Location *loc) {
+    return loc->GetSegment() == fpRelative &&
+           loc->GetOffset() <= CodeGenerator::OffsetToFirstLocal ?
+           (CodeGenerator::OffsetToFirstLocal - loc->GetOffset()) / VarSize : -1;
+  };
+  int numSlots = 0;
+  BitVector inMemory(numLocations);
+  for (int id = 0; id < numLocations; id++)
+  {
+    Location *loc = locations->Nth(id);
+    if (locations->IsRegister(loc) || slotOf(loc) < 0)
+      continue;
+    if (slotOf(loc) >= numSlots)
+      numSlots = slotOf(loc) + 1;
+    if (!loc->GetRegister())
+      inMemory.Set(id);
+  }
+
+  // Two slots interfere when one is written while the other holds a
+  // value still needed, or both are live across the same call; the
+  // usual walk back from the end of each block finds them.
+  InterferenceGraph slots(numSlots);
+  for (int j = 0; j < blocks->NumElements(); j++)
+  {
+    auto block = blocks->Nth(j);
+    LiveVars live(*(block->liveOut));
+    for (int k = block->code.NumElements() - 1; k >= 0; k--)
+    {
+      auto tac = block->code.Nth(k);
+      if (auto callTac = TacCast<FnCall>(tac))
+      {
+        List<int> saved;
+        for (auto var : *(callTac->liveVarsAcross))
+          if (slotOf(var) >= 0 && (inMemory.Test(var->GetId()) ||
+              !Mips::IsCalleeSaved(var->GetRegister())))
+            saved.Append(slotOf(var));
+        for (int a = 0; a < saved.NumElements(); a++)
+        {
+          slots.AddNode(saved.Nth(a));
+          for (int b = 0; b < a; b++)
+            slots.AddEdge(saved.Nth(a), saved.Nth(b));
+        }
+      }
+      for (auto var : tac->GetKillVars())
+      {
+        live.Erase(var);
+        if (!inMemory.Test(var->GetId()))
+          continue;
+        slots.AddNode(slotOf(var));
+        for (auto other : live)
+          if (inMemory.Test(other->GetId()))
+            slots.AddEdge(slotOf(var), slotOf(other));
+      }
+      for (auto var : tac->GetGenVars())
+      {
+        live.Insert(var);
+        if (inMemory.Test(var->GetId()))
+          slots.AddNode(slotOf(var));
+      }
+    }
+
+    // locals read before they are written hold whatever the slot does
+    if (j == 0)
+      for (auto var : live)
+        if (inMemory.Test(var->GetId()))
+          for (auto other : live)
+            if (inMemory.Test(other->GetId()))
+              slots.AddEdge(slotOf(var), slotOf(other));
+  }
+
+  // Few locations are left in memory, so first fit is good enough
+  std::vector<int> newSlot(numSlots, -1);
+  std::vector<bool> taken;
+  int frameSlots = 0;
+  for (int s = 0; s < numSlots; s++)
+  {
+    if (!slots.Contains(s))
+      continue;
+    taken.assign(frameSlots + 1, false);
+    for (auto t : slots.Adjacent(s))
+      if (newSlot[t] >= 0)
+        taken[newSlot[t]] = true;
+    newSlot[s] = 0;
+    while (taken[newSlot[s]])
+      newSlot[s]++;
+    if (newSlot[s] == frameSlots)
+      frameSlots++;
+  }
+  for (int id = 0; id < numLocations; id++)
+  {
+    Location *loc = locations->Nth(id);
+    if (locations->IsRegister(loc) || slotOf(loc) < 0)
+      continue;
+    if (newSlot[slotOf(loc)] >= 0)
+      loc->SetOffset(OffsetToFirstLocal - VarSize * newSlot[slotOf(loc)]);
+  }
+  PrintDebug("frame", "%d of %d frame slots kept", frameSlots, numSlots);
+  beginFuncTac->SetFrameSize(VarSize * frameSlots);
+}
+
+
+void CodeGenerator::RewriteSpills(int start, List<Spill> *spills)
+{
+  // Each spilled location gets its home in memory, and every
+  // instruction that uses it gets a fresh temp of its own instead, loaded
+  // just before and stored just after the instruction. The temps share
+  // the home's frame slot, so they are right even if they end up in
+  // memory themselves. A location spilled only from some instruction on
+  // keeps its register before that, and each write to it there is also
+  // stored to the home, which is another Location for the same slot.
+  static int nextSpillNum;
+  auto beginFuncTac = TacCast<BeginFunc>(code->Nth(start));
+  auto locations = beginFuncTac->locations;
+  BitVector isSpilled(locations->NumElements());
+  std::vector<Location*> home(locations->NumElements());
+  std::vector<int> spillFrom(locations->NumElements());
+  for (int i = 0; i < spills->NumElements(); i++)
+  {
+    Location *var = spills->Nth(i).var;
+    isSpilled.Set(var->GetId());
+    spillFrom[var->GetId()] = spills->Nth(i).from;
+    home[var->GetId()] = var;
+    if (spills->Nth(i).from > 0)
+    {
+      char name[16];
+      sprintf(name, "_home%d", nextSpillNum++);
+      home[var->GetId()] = locations->Intern(fpRelative, var->GetOffset(), name);
+    }
+    beginFuncTac->spilled.Append(home[var->GetId()]);
+  }
+
+  List<Instruction*> rewritten;
+  int end = start;
+  for (; code->Nth(end)->GetOpcode() != TacEndFunc; end++)
+  {
+    auto tac = code->Nth(end);
+    List<Instruction*> stores;
+    VarList vars;
+    for (auto var : tac->GetGenVars())
+      vars.Add(var);
+    for (auto var : tac->GetKillVars())
+      vars.Add(var);
+    for (auto var : vars)
+    {
+      if (!isSpilled.Test(var->GetId()))
+        continue;
+      Location *varHome = home[var->GetId()];
+      if (end - start < spillFrom[var->GetId()])
+      {
+        if (tac->GetKillVars().Contains(var))
+          stores.Append(new Assign(varHome, var));
+        continue;
+      }
+      char name[16];
+      sprintf(name, "_spill%d", nextSpillNum++);
+      Location *temp = locations->Intern(fpRelative, var->GetOffset(), name);
+      beginFuncTac->spillTemps.Append(temp);
+      if (tac->GetGenVars().Contains(var))
+        rewritten.Append(new Assign(temp, varHome));
+      if (tac->GetKillVars().Contains(var))
+        stores.Append(new Assign(varHome, temp));
+      tac = tac->Rename(var, temp);
+    }
+    // the formals passed in registers have nothing in their homes yet
+    if (end == start)
+    {
+      List<Location*> *formals = beginFuncTac->GetFormals();
+      for (int i = 0; i < formals->NumElements() && i < Mips::NumArgRegs; i++)
+      {
+        Location *formal = formals->Nth(i);
+        if (isSpilled.Test(formal->GetId()) && spillFrom[formal->GetId()] > 0)
+          stores.Append(new Assign(home[formal->GetId()], formal));
+      }
+    }
+    rewritten.Append(tac);
+    rewritten.AppendAll(stores);
+  }
+  code->ReplaceRange(start, end - start, rewritten);
+}
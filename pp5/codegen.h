@@ -17,6 +17,8 @@
 #include <stdlib.h>
 #include "list.h"
 #include "tac.h"
+#include "arena.h"
+#include "modref.h"
 
 class FnDecl;
 
@@ -28,6 +30,10 @@ class CodeGenerator {
   private:
     List<Instruction*> *code;
     FnDecl *fn;
+    LocationTable *globals;   // the global variables
+    LocationTable *locals;    // locations of the function being generated
+    BeginFunc *beginFunc;     // of the function being generated
+    int numParams;            // pushed since the last call
 
   public:
            // Here are some class constants to remind you of the offsets
@@ -51,6 +57,12 @@ class CodeGenerator {
          // generate any Tac instructions (see GenLabel below if needed)
     char *NewLabel();
 
+         // Returns the Location for a variable, interned in the table
+         // of globals (gpRelative) or of the current function
+         // (fpRelative). All globals must be created before the first
+         // function. Does not generate any Tac instructions
+    Location *GenLocation(Segment seg, int offset, const char *name);
+
          // Creates and returns a Location for a new uniquely named
          // temp variable. Does not generate any Tac instructions
     Location *GenTempVariable();
@@ -77,7 +89,9 @@ class CodeGenerator {
          // (most likely computed from an array or field offset calculation).
          // The optional offset argument can be used to offset the addr by a
          // positive/negative number of bytes. If not given, 0 is assumed.
-    void GenStore(Location *addr, Location *val, int offset = 0);
+         // The memory class (see MemoryClass) says what the word may be.
+    void GenStore(Location *addr, Location *val, int offset = 0,
+                  MemoryClass memory = AnyMemory);
 
          // Generates Tac instructions to dereference addr and load contents
          // from a memory location into a new temp var. addr should hold a
@@ -85,8 +99,11 @@ class CodeGenerator {
          // field offset calculation). Returns the Location for the new
          // temporary variable where the result was stored. The optional
          // offset argument can be used to offset the addr by a positive or
-         // negative number of bytes. If not given, 0 is assumed.
-    Location *GenLoad(Location *addr, int offset = 0);
+         // negative number of bytes. If not given, 0 is assumed. An
+         // invariant load (see Load) may be reused across stores and calls.
+         // The memory class (see MemoryClass) says what the word may be.
+    Location *GenLoad(Location *addr, int offset = 0, bool invariant = false,
+                      MemoryClass memory = AnyMemory);
 
     
          // Generates Tac instructions to perform one of the binary ops
@@ -99,12 +116,15 @@ class CodeGenerator {
          // Generates the Tac instruction for pushing a single
          // parameter. Used to set up for ACall and LCall instructions.
          // The Decaf convention is that parameters are pushed right
-         // to left (so the first argument is pushed last)
-    void GenPushParam(Location *param);
+         // to left (so the first argument, index 0, is pushed last).
+         // The first four are passed in $a0-$a3, the others in the
+         // caller's outgoing area, where the callee finds its formals.
+    void GenPushParam(Location *param, int index);
 
          // Generates the Tac instruction for popping parameters to
-         // clean up after an ACall or LCall instruction. All parameters
-         // are removed with one adjustment of the stack pointer.
+         // clean up after an ACall or LCall instruction. It marks the
+         // end of the call: the outgoing area is part of the caller's
+         // frame, so no code is needed.
     void GenPopParams(int numBytesOfParams);
 
          // Generates the Tac instructions for a LCall, a jump to
@@ -168,14 +188,98 @@ class CodeGenerator {
     void DoFinalCodeGen();
 
 private:
+        // Appends a call to the parameters pushed since the last one,
+        // keeping track of the outgoing area the function needs
+    void AppendCall(FnCall *call);
+
+        // Holds what the register allocator builds for the function
+        // being emitted; released after each function
+    Arena functionArena;
+
+        // Coloring rounds before the remaining spills are simply left
+        // in memory
+    static const int MaxAllocationRounds = 8;
+
+        // The biggest loop (in Tac instructions) copied to take the
+        // checks out of, and the biggest step or subscript offset
+    static const int MaxVersionedLoop = 80, MaxVersionedOffset = 1024;
+
+        // How far from its base a pointer whose test replaces an
+        // index's may get, the heap being further from a wrap
+    static const int MaxPointerReach = 1 << 24;
+
+        // A location to keep in memory from instruction from (counted
+        // from the BeginFunc) on; before that it keeps its register
+    struct Spill { Location *var; int from; };
+
+        // The analyses below work on one function, given by its
+        // BeginFunc or by the position of the BeginFunc in code.
+        // Keep the globals the function uses often in locals of their
+        // own, loaded on entry and stored back on the way out and
+        // around the calls that may use them
+    void PromoteGlobals(int start, ModRef *modRef);
+        // Whether the function is too big for the costlier passes: it
+        // has more Tac instructions or Locations than the budget
+    bool OverBudget(int start);
+        // Put the function in SSA form: phis where the versions of a
+        // live variable meet, then every write to a version of its own
+    void ToSSA(int start);
+        // Fold the values found constant, on the paths that can run,
+        // and drop the branches decided and the code never reached
+    void PropagateConstants(int start);
+        // Give the same number to the variables holding the same value
+        // and drop what computes or loads one already available
+    void NumberValues(int start);
+        // Move what a loop computes the same on every iteration to
+        // before it, where that is safe, the innermost loops first
+    void HoistInvariants(int start);
+        // Drop the runtime checks (on array subscripts and sizes)
+        // proven to pass, and then the code computing only what is
+        // never read
+    void EliminateChecks(int start);
+        // Take it out of SSA form again, the phis becoming copies on
+        // the edges into their blocks
+    void FromSSA(int start);
+        // Merge the two ends of each copy between locals into one
+        // variable where they never interfere, which undoes most of
+        // the copies leaving SSA adds (and any others)
+    void CoalesceCopies(int start);
+        // Copy each innermost loop whose subscripts the checks were left
+        // on, and choose between the two on entry: the loop as it was
+        // when the subscripts may be out of bounds, and otherwise one
+        // where, from that guard, they are proven not to be. Returns
+        // whether it did, the checks then being for EliminateChecks to
+        // take out once more.
+    bool VersionLoops(int start);
+        // Fold the constants that fit into the instructions using them,
+        // as immediate operands, and drop the loads no longer needed
+    void SelectInstructions(int start);
+        // Turn the addresses a loop computes from an index into
+        // pointers stepped with it, and the index into a test on one
+        // of them where that is all it is still read for
+    void ReduceStrength(int start);
+        // Assign registers: color, rewrite spills, color again, ...
+        // (or the same with linear scan, for functions too big to color)
+    void AllocateRegisters(int start);
         // Construct Intra-procedural CFG for Liveness analysis.
-    void BuildCFG();
+    void BuildCFG(int start);
         // Conduct Liveness Analysis
-    void LiveVariableAnalysis();
+    void LiveVariableAnalysis(int start);
         // Build interference graph
-    void BuildInterferenceGraph();
-        // Color interference graph
-    void ColorInterferenceGraph();
+    void BuildInterferenceGraph(BeginFunc *fn);
+        // Color interference graph, adding the nodes left without a
+        // register to spills
+    void ColorInterferenceGraph(BeginFunc *fn, List<Location*> *spills);
+        // Build the live intervals and allocate them by linear scan,
+        // adding the intervals split or left without a register to spills
+    void LinearScanAllocate(int start, List<Spill> *spills);
+        // Rewrite the function so the spilled locations are only used
+        // by short loads and stores around each instruction
+    void RewriteSpills(int start, List<Spill> *spills);
+        // Give frame slots only to the locations that are kept in
+        // memory or saved around a call, sharing a slot between those
+        // never needed at the same time, and shrink the frame to fit
+    void AllocateFrameSlots(BeginFunc *fn);
 };
 
 #endif
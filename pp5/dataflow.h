@@ -0,0 +1,198 @@
+/* File: dataflow.h
+ * ----------------
+ * A generic iterative solver for dataflow problems over the basic
+ * blocks of one function. The solver knows nothing about the sets being
+ * computed; a problem is described by a Lattice class that provides
+ *
+ *     typedef ... Value;          the fact attached to a block boundary
+ *     Value Initial();            starting value at every block boundary
+ *                                 (empty for "may" problems such as
+ *                                 liveness or reaching definitions, full
+ *                                 for "must" problems such as available
+ *                                 expressions)
+ *     Value Boundary();           value flowing into the entry block
+ *                                 (forward) or out of exit blocks
+ *                                 (backward)
+ *     void Meet(Value &acc, const Value &v);
+ *                                 combine v into acc at a join point
+ *     bool Transfer(BasicBlock *b, const Value &input, Value &output);
+ *                                 apply b to input, store the result
+ *                                 into output and return true if
+ *                                 output changed
+ *
+ * For a Forward problem input is the value on entry to the block and
+ * output the value on exit; for a Backward problem it is the other way
+ * around. Blocks are kept on a worklist ordered by reverse postorder
+ * (postorder for backward problems), so that in an acyclic region each
+ * block is normally visited only after everything that flows into it,
+ * and a change only requeues the blocks it can affect.
+ */
+
+#ifndef _H_dataflow
+#define _H_dataflow
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "list.h"
+#include "bitvector.h"
+#include "cfg.h"
+
+typedef enum {Forward, Backward} Direction;
+
+template <class Lattice, Direction dir>
+class DataflowSolver {
+  public:
+    typedef typename Lattice::Value Value;
+
+  private:
+    Lattice *lattice;
+    List<BasicBlock*> *blocks;
+    std::vector<Value> in, out;   // indexed by BasicBlock::GetIndex()
+    std::vector<BasicBlock*> order;
+    std::vector<int> rank;        // position of each block in order
+    int numVisits, numPasses;
+
+    void ComputeOrder();
+
+  public:
+    DataflowSolver(Lattice *l, List<BasicBlock*> *b)
+      : lattice(l), blocks(b), numVisits(0), numPasses(0) {}
+
+         // Iterates until no block's value changes
+    void Solve();
+
+         // The values on entry to and exit from a block after Solve()
+    Value &In(BasicBlock *b)  { return in[b->GetIndex()]; }
+    Value &Out(BasicBlock *b) { return out[b->GetIndex()]; }
+
+         // Number of transfer function applications made by Solve(),
+         // and number of sweeps over the worklist order
+    int NumVisits() { return numVisits; }
+    int NumPasses() { return numPasses; }
+};
+
+
+    // Computes a postorder of the blocks reachable from the entry block
+    // with an explicit stack, then appends the unreachable blocks so they
+    // still get a solution. Forward problems use the reverse order.
+template <class Lattice, Direction dir>
+void DataflowSolver<Lattice, dir>::ComputeOrder()
+{
+  int n = blocks->NumElements();
+  std::vector<bool> visited(n, false);
+  std::vector<std::pair<BasicBlock*, int> > stack;
+  order.clear();
+  if (n > 0)
+  {
+    stack.push_back(std::make_pair(blocks->Nth(0), 0));
+    visited[0] = true;
+  }
+  while (!stack.empty())
+  {
+    BasicBlock *b = stack.back().first;
+    int next = stack.back().second++;
+    if (next < b->succs.NumElements())
+    {
+      BasicBlock *succ = b->succs.Nth(next);
+      if (!visited[succ->GetIndex()])
+      {
+        visited[succ->GetIndex()] = true;
+        stack.push_back(std::make_pair(succ, 0));
+      }
+    }
+    else
+    {
+      order.push_back(b);
+      stack.pop_back();
+    }
+  }
+  if (dir == Forward)
+    std::reverse(order.begin(), order.end());
+  for (int i = 0; i < n; i++)
+    if (!visited[i])
+      order.push_back(blocks->Nth(i));
+
+  rank.assign(n, 0);
+  for (int i = 0; i < n; i++)
+    rank[order[i]->GetIndex()] = i;
+}
+
+template <class Lattice, Direction dir>
+void DataflowSolver<Lattice, dir>::Solve()
+{
+  int n = blocks->NumElements();
+  ComputeOrder();
+  in.assign(n, lattice->Initial());
+  out.assign(n, lattice->Initial());
+
+  BitVector pending(n); // ranks of the blocks on the worklist
+  for (int i = 0; i < n; i++)
+    pending.Set(i);
+
+  int cursor = 0;
+  numPasses = n > 0 ? 1 : 0;
+  while (true)
+  {
+    int r = pending.NextSetBit(cursor);
+    if (r < 0)
+    {
+      r = pending.NextSetBit(0);
+      if (r < 0)
+        break;
+      numPasses++;
+    }
+    pending.Reset(r);
+    cursor = r + 1;
+    numVisits++;
+
+    BasicBlock *b = order[r];
+    List<BasicBlock*> *sources = (dir == Forward) ? &b->preds : &b->succs;
+    List<BasicBlock*> *targets = (dir == Forward) ? &b->succs : &b->preds;
+    Value &input = (dir == Forward) ? In(b) : Out(b);
+    Value &output = (dir == Forward) ? Out(b) : In(b);
+
+    // meet over the blocks flowing into b; the function's entry (or
+    // exit) also sees the boundary value
+    bool isBoundary = (dir == Forward) ? b == blocks->Nth(0)
+                                       : b->succs.NumElements() == 0;
+    if (isBoundary || sources->NumElements() == 0)
+      input = lattice->Boundary();
+    else
+      input = (dir == Forward) ? Out(sources->Nth(0)) : In(sources->Nth(0));
+    for (int i = 0; i < sources->NumElements(); i++)
+    {
+      BasicBlock *s = sources->Nth(i);
+      lattice->Meet(input, (dir == Forward) ? Out(s) : In(s));
+    }
+
+    if (lattice->Transfer(b, input, output))
+    {
+      for (int i = 0; i < targets->NumElements(); i++)
+        pending.Set(rank[targets->Nth(i)->GetIndex()]);
+    }
+  }
+}
+
+
+  // Live variables: a variable is live at a point if some path from the
+  // point reads it before writing it. Backward, may-analysis over the
+  // use/def summaries computed by BasicBlock::ComputeUseDef.
+class LiveVariables {
+    int numLocations;
+
+  public:
+    typedef BitVector Value;
+
+    LiveVariables(LocationTable *locations)
+      : numLocations(locations->NumElements()) {}
+
+    Value Initial()  { return BitVector(numLocations); }
+    Value Boundary() { return BitVector(numLocations); }
+    void Meet(Value &acc, const Value &v) { acc.UnionWith(v); }
+    bool Transfer(BasicBlock *b, const Value &liveOut, Value &liveIn)
+        { return liveIn.AssignTransfer(b->use->GetBits(), liveOut,
+                                       b->def->GetBits()); }
+};
+
+#endif
@@ -0,0 +1,145 @@
+/* File: dominators.cc
+ * -------------------
+ * Implementation of the DominatorTree class.
+ */
+
+#include "dominators.h"
+#include <utility>
+
+DominatorTree::DominatorTree(List<BasicBlock*> *b) : blocks(b)
+{
+  int n = blocks->NumElements();
+  idom.assign(n, -1);
+  rpoNumber.assign(n, -1);
+  children.resize(n);
+  frontier.resize(n);
+  preorder.assign(n, -1);
+  postorder.assign(n, -1);
+  if (n == 0)
+    return;
+
+  // postorder of a depth-first search from the entry
+  std::vector<bool> seen(n, false);
+  std::vector<std::pair<BasicBlock*, int> > stack;
+  stack.push_back(std::make_pair(blocks->Nth(0), 0));
+  seen[0] = true;
+  while (!stack.empty())
+  {
+    BasicBlock *block = stack.back().first;
+    int next = stack.back().second++;
+    if (next < block->succs.NumElements())
+    {
+      BasicBlock *succ = block->succs.Nth(next);
+      if (!seen[succ->GetIndex()])
+      {
+        seen[succ->GetIndex()] = true;
+        stack.push_back(std::make_pair(succ, 0));
+      }
+    }
+    else
+    {
+      order.push_back(block);
+      stack.pop_back();
+    }
+  }
+  for (size_t i = 0, j = order.size() - 1; i < j; i++, j--)
+    std::swap(order[i], order[j]);
+  for (size_t i = 0; i < order.size(); i++)
+    rpoNumber[order[i]->GetIndex()] = i;
+
+  // the entry is its own idom while the others are found
+  idom[0] = 0;
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (size_t i = 1; i < order.size(); i++)
+    {
+      BasicBlock *block = order[i];
+      int newIdom = -1;
+      for (int p = 0; p < block->preds.NumElements(); p++)
+      {
+        int pred = block->preds.Nth(p)->GetIndex();
+        if (idom[pred] < 0)
+          continue; // not processed yet, or unreachable
+        newIdom = newIdom < 0 ? pred : Intersect(pred, newIdom);
+      }
+      if (idom[block->GetIndex()] != newIdom)
+      {
+        idom[block->GetIndex()] = newIdom;
+        changed = true;
+      }
+    }
+  }
+  idom[0] = -1;
+  for (size_t i = 1; i < order.size(); i++)
+    children[idom[order[i]->GetIndex()]].push_back(order[i]);
+
+  // each join point is in the frontier of the blocks from its
+  // predecessors up to its idom
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    BasicBlock *block = order[i];
+    if (block->preds.NumElements() < 2)
+      continue;
+    int b = block->GetIndex();
+    for (int p = 0; p < block->preds.NumElements(); p++)
+    {
+      int runner = block->preds.Nth(p)->GetIndex();
+      if (rpoNumber[runner] < 0)
+        continue;
+      while (runner != idom[b])
+      {
+        std::vector<BasicBlock*> &df = frontier[runner];
+        if (df.empty() || df.back() != block)
+          df.push_back(block);
+        runner = idom[runner];
+      }
+    }
+  }
+
+  // numbering the tree walk: a dominates b when b's interval is
+  // inside a's
+  int clock = 0;
+  std::vector<std::pair<BasicBlock*, size_t> > walk;
+  walk.push_back(std::make_pair(blocks->Nth(0), 0));
+  preorder[0] = clock++;
+  while (!walk.empty())
+  {
+    BasicBlock *block = walk.back().first;
+    size_t next = walk.back().second++;
+    if (next < children[block->GetIndex()].size())
+    {
+      BasicBlock *child = children[block->GetIndex()][next];
+      preorder[child->GetIndex()] = clock++;
+      walk.push_back(std::make_pair(child, 0));
+    }
+    else
+    {
+      postorder[block->GetIndex()] = clock++;
+      walk.pop_back();
+    }
+  }
+}
+
+// The closest common dominator of a and b, walking up from whichever
+// comes later in reverse postorder
+int DominatorTree::Intersect(int a, int b)
+{
+  while (a != b)
+  {
+    while (rpoNumber[a] > rpoNumber[b])
+      a = idom[a];
+    while (rpoNumber[b] > rpoNumber[a])
+      b = idom[b];
+  }
+  return a;
+}
+
+bool DominatorTree::Dominates(BasicBlock *a, BasicBlock *b)
+{
+  int i = a->GetIndex(), j = b->GetIndex();
+  if (preorder[i] < 0 || preorder[j] < 0)
+    return false;
+  return preorder[i] <= preorder[j] && postorder[j] <= postorder[i];
+}
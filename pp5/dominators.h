@@ -0,0 +1,60 @@
+/* File: dominators.h
+ * ------------------
+ * The DominatorTree of a function's CFG: block a dominates block b when
+ * every path from the entry to b goes through a, and the immediate
+ * dominator of b is the closest of those other than b itself. The tree
+ * is found with the iterative algorithm of Cooper, Harvey and Kennedy
+ * ("A Simple, Fast Dominance Algorithm", 2001): visiting the blocks in
+ * reverse postorder, each takes for its idom the common ancestor in the
+ * tree so far of its processed predecessors, until nothing changes. On
+ * Decaf's reducible CFGs this settles in two passes.
+ *
+ * The dominance frontier of a block, where its dominance stops, is
+ * found from the join points: each block with several predecessors is
+ * in the frontier of every block from a predecessor up to (but not
+ * including) its own idom. Blocks the entry cannot reach have no idom
+ * and are in no tree or frontier.
+ */
+
+#ifndef _H_dominators
+#define _H_dominators
+
+#include <vector>
+#include "list.h"
+#include "cfg.h"
+
+class DominatorTree {
+    List<BasicBlock*> *blocks;
+    std::vector<int> idom;                // by block index, -1 for none
+    std::vector<int> rpoNumber;           // -1 if unreachable
+    std::vector<BasicBlock*> order;       // the reachable blocks, in RPO
+    std::vector<std::vector<BasicBlock*> > children, frontier;
+    std::vector<int> preorder, postorder; // of the tree walk
+
+    int Intersect(int a, int b);
+
+  public:
+         // Builds the tree of blocks, the entry block first
+    DominatorTree(List<BasicBlock*> *blocks);
+
+    bool IsReachable(BasicBlock *b) { return rpoNumber[b->GetIndex()] >= 0; }
+
+         // NULL for the entry and for unreachable blocks
+    BasicBlock *IDom(BasicBlock *b)
+        { int d = idom[b->GetIndex()];
+          return d < 0 ? NULL : blocks->Nth(d); }
+    const std::vector<BasicBlock*> &Children(BasicBlock *b)
+        { return children[b->GetIndex()]; }
+    const std::vector<BasicBlock*> &Frontier(BasicBlock *b)
+        { return frontier[b->GetIndex()]; }
+
+         // Whether a dominates b (a block dominates itself), in constant
+         // time from the numbering of a walk of the tree
+    bool Dominates(BasicBlock *a, BasicBlock *b);
+
+         // The reachable blocks in reverse postorder: each after its
+         // dominators, and a loop's head before its body
+    const std::vector<BasicBlock*> &ReversePostorder() { return order; }
+};
+
+#endif
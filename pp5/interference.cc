@@ -0,0 +1,368 @@
+/* File: interference.cc
+ * ---------------------
+ * Implementation of the InterferenceGraph class.
+ */
+
+#include "interference.h"
+#include <limits.h>
+
+InterferenceGraph::InterferenceGraph(int n)
+  : numNodes(n), nodes(n), adjacent(n), spillCost(n, 0), numEdges(0)
+{
+  if (n <= MaxMatrixNodes)
+    matrix.Resize(n * (n - 1) / 2);
+}
+
+bool InterferenceGraph::Interfere(int a, int b)
+{
+  if (a == b)
+    return false;
+  if (numNodes <= MaxMatrixNodes)
+    return matrix.Test(PairIndex(a, b));
+  return pairs.count(PairIndex(a, b)) > 0;
+}
+
+bool InterferenceGraph::AddEdge(int a, int b)
+{
+  if (a == b)
+    return false;
+  nodes.Set(a);
+  nodes.Set(b);
+  long long pair = PairIndex(a, b);
+  if (numNodes <= MaxMatrixNodes)
+  {
+    if (matrix.Test(pair))
+      return false;
+    matrix.Set(pair);
+  }
+  else if (!pairs.insert(pair).second)
+    return false;
+  adjacent[a].push_back(b);
+  adjacent[b].push_back(a);
+  numEdges++;
+  return true;
+}
+
+void InterferenceGraph::AddMove(int dst, int src)
+{
+  if (dst == src)
+    return;
+  nodes.Set(dst);
+  nodes.Set(src);
+  moves.push_back({dst, src});
+}
+
+
+/* The coloring follows the paper's pseudo-code closely, and keeps its
+ * names. Each node is on exactly one worklist, told by its state; a
+ * node that changes lists is pushed onto the new one and the stale
+ * entry left behind is skipped when it comes up. The same goes for
+ * the moves: worklistMoves holds the moves that may be coalescable,
+ * and the moves tried and found not to be yet are active until a
+ * change near them puts them back on it.
+ */
+GraphColoring::GraphColoring(InterferenceGraph *g, const std::vector<int> &p,
+                             const std::vector<int> &precolored)
+  : graph(g), palette(p), K(p.size()), preferred(g->NumNodes(), &palette),
+    state(g->NumNodes(), NotInGraph),
+    degree(g->NumNodes()), alias(g->NumNodes()), color(precolored),
+    spillCost(g->NumNodes()), moveList(g->NumNodes()),
+    mark(g->NumNodes(), 0), markStamp(0), numCoalesced(0)
+{
+  int numNodes = graph->NumNodes();
+  const std::vector<InterferenceGraph::Move> &moves = graph->Moves();
+  moveState.assign(moves.size(), WorklistMove);
+  for (size_t m = 0; m < moves.size(); m++)
+  {
+    moveList[moves[m].dst].push_back(m);
+    moveList[moves[m].src].push_back(m);
+    worklistMoves.push_back(m);
+  }
+
+  for (int i = 0; i < numNodes; i++)
+  {
+    alias[i] = i;
+    degree[i] = graph->Degree(i);
+    spillCost[i] = graph->SpillCost(i);
+    if (color[i])
+    {
+      state[i] = Precolored;
+      degree[i] = INT_MAX / 2; // never simplified nor spilled
+    }
+    else if (!graph->Contains(i))
+      continue;
+    else if (degree[i] >= K)
+      Push(spillWorklist, SpillNode, i);
+    else if (MoveRelated(i))
+      Push(freezeWorklist, FreezeNode, i);
+    else
+      Push(simplifyWorklist, SimplifyNode, i);
+  }
+}
+
+void GraphColoring::Color()
+{
+  while (!simplifyWorklist.empty() || !worklistMoves.empty() ||
+         !freezeWorklist.empty() || !spillWorklist.empty())
+  {
+    if (!simplifyWorklist.empty())
+      Simplify();
+    else if (!worklistMoves.empty())
+      Coalesce();
+    else if (!freezeWorklist.empty())
+      Freeze();
+    else
+      SelectSpill();
+  }
+  AssignColors();
+}
+
+void GraphColoring::AddEdge(int a, int b)
+{
+  if (!graph->AddEdge(a, b))
+    return;
+  if (state[a] != Precolored)
+    degree[a]++;
+  if (state[b] != Precolored)
+    degree[b]++;
+}
+
+// Whether a still has a move that may be coalesced
+bool GraphColoring::MoveRelated(int a)
+{
+  for (auto m : moveList[a])
+    if (moveState[m] == WorklistMove || moveState[m] == ActiveMove)
+      return true;
+  return false;
+}
+
+void GraphColoring::EnableMoves(int a)
+{
+  for (auto m : moveList[a])
+    if (moveState[m] == ActiveMove)
+    {
+      moveState[m] = WorklistMove;
+      worklistMoves.push_back(m);
+    }
+}
+
+// a has lost a neighbour. When its degree drops below K it can be
+// simplified, and the moves of its neighbours may become coalescable.
+void GraphColoring::DecrementDegree(int a)
+{
+  if (state[a] == Precolored || degree[a]-- != K)
+    return;
+  EnableMoves(a);
+  for (auto t : graph->Adjacent(a))
+    if (!Removed(t))
+      EnableMoves(t);
+  if (MoveRelated(a))
+    Push(freezeWorklist, FreezeNode, a);
+  else
+    Push(simplifyWorklist, SimplifyNode, a);
+}
+
+int GraphColoring::GetAlias(int a)
+{
+  while (state[a] == CoalescedNode)
+    a = alias[a];
+  return a;
+}
+
+void GraphColoring::AddWorkList(int a)
+{
+  if (state[a] == FreezeNode && !MoveRelated(a) && degree[a] < K)
+    Push(simplifyWorklist, SimplifyNode, a);
+}
+
+// George's test, for merging into the precolored r: every neighbour t
+// of the other node either interferes with r already or is of low
+// degree, so it will get a color anyway
+bool GraphColoring::OK(int t, int r)
+{
+  return degree[t] < K || state[t] == Precolored || graph->Interfere(t, r);
+}
+
+// Briggs' test: the merged node has fewer than K neighbours of
+// significant degree, so it will get a color anyway
+bool GraphColoring::Conservative(int u, int v)
+{
+  int k = 0;
+  markStamp++;
+  for (auto t : graph->Adjacent(u))
+    if (!Removed(t) && mark[t] != markStamp)
+    {
+      mark[t] = markStamp;
+      if (degree[t] >= K)
+        k++;
+    }
+  for (auto t : graph->Adjacent(v))
+    if (!Removed(t) && mark[t] != markStamp)
+    {
+      mark[t] = markStamp;
+      if (degree[t] >= K)
+        k++;
+    }
+  return k < K;
+}
+
+// Merges v into u
+void GraphColoring::Combine(int u, int v)
+{
+  state[v] = CoalescedNode;
+  alias[v] = u;
+  numCoalesced++;
+  spillCost[u] += spillCost[v];
+  moveList[u].insert(moveList[u].end(), moveList[v].begin(), moveList[v].end());
+  EnableMoves(v);
+  for (auto t : graph->Adjacent(v))
+    if (!Removed(t))
+    {
+      AddEdge(t, u);
+      DecrementDegree(t);
+    }
+  if (degree[u] >= K && state[u] == FreezeNode)
+    Push(spillWorklist, SpillNode, u);
+}
+
+// Gives up on coalescing the moves of u
+void GraphColoring::FreezeMoves(int u)
+{
+  for (auto m : moveList[u])
+  {
+    if (moveState[m] != WorklistMove && moveState[m] != ActiveMove)
+      continue;
+    const InterferenceGraph::Move &move = graph->Moves()[m];
+    int v = GetAlias(move.src) == GetAlias(u) ? GetAlias(move.dst)
+                                              : GetAlias(move.src);
+    moveState[m] = FrozenMove;
+    if (state[v] == FreezeNode && !MoveRelated(v) && degree[v] < K)
+      Push(simplifyWorklist, SimplifyNode, v);
+  }
+}
+
+// A node with fewer than K neighbours will get a color whatever they
+// get, so it can be taken out of the graph and colored last
+void GraphColoring::Simplify()
+{
+  int a = simplifyWorklist.back();
+  simplifyWorklist.pop_back();
+  if (state[a] != SimplifyNode)
+    return;
+  Push(selectStack, OnStack, a);
+  for (auto t : graph->Adjacent(a))
+    if (!Removed(t))
+      DecrementDegree(t);
+}
+
+void GraphColoring::Coalesce()
+{
+  int m = worklistMoves.back();
+  worklistMoves.pop_back();
+  if (moveState[m] != WorklistMove)
+    return;
+  const InterferenceGraph::Move &move = graph->Moves()[m];
+  int u = GetAlias(move.dst), v = GetAlias(move.src);
+  if (state[v] == Precolored)
+  {
+    int t = u; u = v; v = t;
+  }
+
+  bool canCombine = false;
+  if (u == v)
+    moveState[m] = CoalescedMove;
+  else if (state[v] == Precolored || graph->Interfere(u, v))
+  {
+    moveState[m] = ConstrainedMove;
+    AddWorkList(v);
+  }
+  else
+  {
+    if (state[u] == Precolored)
+    {
+      canCombine = true;
+      for (auto t : graph->Adjacent(v))
+        if (!Removed(t) && !OK(t, u))
+        {
+          canCombine = false;
+          break;
+        }
+    }
+    else
+      canCombine = Conservative(u, v);
+    moveState[m] = canCombine ? CoalescedMove : ActiveMove;
+  }
+  if (canCombine)
+    Combine(u, v);
+  AddWorkList(u);
+}
+
+// Every node left is move-related: give up the moves of one of low
+// degree so that it can be simplified
+void GraphColoring::Freeze()
+{
+  int a = freezeWorklist.back();
+  freezeWorklist.pop_back();
+  if (state[a] != FreezeNode)
+    return;
+  Push(simplifyWorklist, SimplifyNode, a);
+  FreezeMoves(a);
+}
+
+// Every node left has K or more neighbours: take out the one whose
+// spill costs least per interference it removes. It is only a
+// candidate; select may still find it a color (Briggs).
+void GraphColoring::SelectSpill()
+{
+  int node = -1;
+  size_t kept = 0;
+  for (size_t h = 0; h < spillWorklist.size(); h++)
+  {
+    int i = spillWorklist[h];
+    if (state[i] != SpillNode)
+      continue;
+    spillWorklist[kept++] = i;
+    if (node < 0 || spillCost[i] * degree[node] < spillCost[node] * degree[i])
+      node = i;
+  }
+  spillWorklist.resize(kept);
+  if (node < 0)
+    return;
+  Push(simplifyWorklist, SimplifyNode, node);
+  FreezeMoves(node);
+}
+
+// Puts the nodes back in reverse, each in the first color none of its
+// neighbours has. A node left without one is spilled; merged nodes
+// take the color of the node they were merged into.
+void GraphColoring::AssignColors()
+{
+  std::vector<bool> taken;
+  while (!selectStack.empty())
+  {
+    int a = selectStack.back();
+    selectStack.pop_back();
+    taken.assign(taken.size(), false);
+    for (auto t : graph->Adjacent(a))
+    {
+      int c = color[GetAlias(t)];
+      if (c >= (int) taken.size())
+        taken.resize(c + 1);
+      if (c)
+        taken[c] = true;
+    }
+    state[a] = SpilledNode;
+    for (auto c : *preferred[a])
+      if (c >= (int) taken.size() || !taken[c])
+      {
+        state[a] = ColoredNode;
+        color[a] = c;
+        break;
+      }
+    if (state[a] == SpilledNode)
+      spilledNodes.push_back(a);
+  }
+  for (int i = 0; i < graph->NumNodes(); i++)
+    if (state[i] == CoalescedNode)
+      color[i] = color[GetAlias(i)];
+}
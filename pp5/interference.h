@@ -0,0 +1,149 @@
+/* File: interference.h
+ * --------------------
+ * The InterferenceGraph of a function has a node for each of its
+ * Locations (numbered by their ids) and an edge between two Locations
+ * that may not share a register because one is written while the other
+ * still holds a value that will be needed.
+ *
+ * The edges are kept twice, the usual way for register allocators: a
+ * triangular bit matrix answers "do a and b interfere?" in constant
+ * time, and an adjacency vector per node lists its neighbours for the
+ * simplify/select phases, which need the degree and the neighbours of
+ * a node rather than random queries. The matrix takes n^2/2 bits, so
+ * for functions with more than MaxMatrixNodes locations a hash set of
+ * pairs stands in for it.
+ *
+ * The graph also records the moves of the function, the copies between
+ * two nodes that disappear if both end up in the same register.
+ * GraphColoring colors it with iterated register coalescing (George and
+ * Appel, "Iterated Register Coalescing", TOPLAS 1996), which merges the
+ * two ends of a move whenever that cannot make the graph harder to
+ * color, and gives up on a move only when simplify and spill leave it
+ * no other choice.
+ */
+
+#ifndef _H_interference
+#define _H_interference
+
+#include <math.h>
+#include <vector>
+#include <unordered_set>
+#include "bitvector.h"
+
+class InterferenceGraph {
+    int numNodes;
+    BitVector nodes;       // the Locations that need a register
+    BitVector matrix;      // one bit per unordered pair of nodes
+    std::unordered_set<long long> pairs; // instead, for large graphs
+    std::vector<std::vector<int> > adjacent;
+    std::vector<double> spillCost;
+    int numEdges;
+
+  public:
+    struct Move { int dst, src; };
+
+  private:
+    std::vector<Move> moves;
+
+         // Index of the pair {a, b}, a != b, in the lower triangle
+    static long long PairIndex(int a, int b)
+        { if (a < b) { int t = a; a = b; b = t; }
+          return (long long)a * (a - 1) / 2 + b; }
+
+  public:
+    static const int MaxMatrixNodes = 8192;   // 4MB of matrix
+
+    InterferenceGraph(int numNodes);
+
+         // Marks a as taking part in register allocation
+    void AddNode(int a)             { nodes.Set(a); }
+    bool Contains(int a)            { return nodes.Test(a); }
+
+         // Adds the edge {a, b} (and both nodes) unless a == b or the
+         // edge is already there. Returns whether it was added.
+    bool AddEdge(int a, int b);
+    bool Interfere(int a, int b);
+
+    const std::vector<int> &Adjacent(int a) { return adjacent[a]; }
+    int Degree(int a)               { return adjacent[a].size(); }
+         // The estimated cost of keeping a in memory: the loads and
+         // stores that would be needed, weighted by how often they run
+    void AddSpillCost(int a, double cost) { spillCost[a] += cost; }
+    void SetUnspillable(int a)      { spillCost[a] = HUGE_VAL; }
+    double SpillCost(int a)         { return spillCost[a]; }
+
+         // Records a copy from src to dst (and both nodes)
+    void AddMove(int dst, int src);
+    const std::vector<Move> &Moves() { return moves; }
+
+    int NumNodes()                  { return numNodes; }
+    int NumEdges()                  { return numEdges; }
+};
+
+
+  // One coloring of an InterferenceGraph. The palette lists the colors
+  // (register numbers) in order of preference, and a node given a
+  // nonzero color in precolored keeps it: it stands for a machine
+  // register that some moves of the function read or write. The
+  // coloring coalesces moves as it goes, merging the graph's nodes and
+  // adding edges to it, so a graph can only be colored once.
+class GraphColoring {
+    enum NodeState { NotInGraph, Precolored, SimplifyNode, FreezeNode,
+                     SpillNode, OnStack, CoalescedNode, ColoredNode,
+                     SpilledNode };
+    enum MoveState { WorklistMove, ActiveMove, CoalescedMove,
+                     ConstrainedMove, FrozenMove };
+
+    InterferenceGraph *graph;
+    std::vector<int> palette;
+    int K;
+    std::vector<const std::vector<int>*> preferred; // order tried, by node
+    std::vector<NodeState> state;
+    std::vector<int> degree, alias, color;
+    std::vector<double> spillCost;
+    std::vector<std::vector<int> > moveList;  // the moves of each node
+    std::vector<MoveState> moveState;
+    std::vector<int> simplifyWorklist, freezeWorklist, spillWorklist;
+    std::vector<int> worklistMoves, selectStack, spilledNodes;
+    std::vector<int> mark;                    // for Conservative
+    int markStamp;
+    int numCoalesced;
+
+    bool Removed(int a)
+        { return state[a] == OnStack || state[a] == CoalescedNode; }
+    void Push(std::vector<int> &worklist, NodeState s, int a)
+        { state[a] = s; worklist.push_back(a); }
+    void AddEdge(int a, int b);
+    bool MoveRelated(int a);
+    void EnableMoves(int a);
+    void DecrementDegree(int a);
+    int GetAlias(int a);
+    void AddWorkList(int a);
+    bool OK(int t, int r);
+    bool Conservative(int u, int v);
+    void Combine(int u, int v);
+    void FreezeMoves(int u);
+    void Simplify();
+    void Coalesce();
+    void Freeze();
+    void SelectSpill();
+    void AssignColors();
+
+  public:
+    GraphColoring(InterferenceGraph *graph, const std::vector<int> &palette,
+                  const std::vector<int> &precolored);
+
+         // Has select try the colors for a in the given order (all
+         // from the palette) instead of the palette's
+    void Prefer(int a, const std::vector<int> *order) { preferred[a] = order; }
+
+    void Color();
+
+         // The color of node a, 0 if a is not in the graph or got none
+    int ColorOf(int a)              { return color[a]; }
+         // The nodes that got no color, and are to be spilled
+    const std::vector<int> &Spilled() { return spilledNodes; }
+    int NumCoalesced()              { return numCoalesced; }
+};
+
+#endif
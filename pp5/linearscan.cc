@@ -0,0 +1,90 @@
+/* File: linearscan.cc
+ * -------------------
+ * Implementation of the LinearScan register allocator.
+ */
+
+#include "linearscan.h"
+#include <algorithm>
+#include <set>
+#include <utility>
+
+LinearScan::LinearScan(int numLocations, const std::vector<int> &p,
+                       const std::vector<int> &crossing)
+  : palette(p), crossingPalette(crossing), color(numLocations, 0) {}
+
+static bool ByStart(const LiveInterval &a, const LiveInterval &b)
+{
+  return a.start < b.start || (a.start == b.start && a.id < b.id);
+}
+
+void LinearScan::Allocate(std::vector<LiveInterval> &intervals)
+{
+  std::sort(intervals.begin(), intervals.end(), ByStart);
+
+  // the intervals holding a register, as (end, index into intervals)
+  std::set<std::pair<int, int> > active;
+  int maxReg = 0;
+  for (auto reg : palette)
+    maxReg = std::max(maxReg, reg);
+  std::vector<bool> free(maxReg + 1, false), survivesCall(maxReg + 1, false);
+  for (auto reg : palette)
+    free[reg] = true;
+  for (auto reg : crossingPalette)
+    survivesCall[reg] = true;
+
+  for (int i = 0; i < (int) intervals.size(); i++)
+  {
+    LiveInterval &cur = intervals[i];
+
+    // the intervals over by now give their registers back
+    while (!active.empty() && active.begin()->first < cur.start)
+    {
+      free[color[intervals[active.begin()->second].id]] = true;
+      active.erase(active.begin());
+    }
+
+    int reg = 0;
+    for (auto r : cur.crossesCall ? crossingPalette : palette)
+      if (free[r])
+      {
+        reg = r;
+        break;
+      }
+
+    if (!reg)
+    {
+      // Nothing free: the active interval that ends last (and whose
+      // register cur can have) is split here, unless cur ends later
+      // still, in which case cur goes to memory instead. Spill temps
+      // are never split; one that finds no register at all just stays
+      // in memory, which the Mips emitter handles with its scratch
+      // registers.
+      auto victim = active.end();
+      for (auto a = active.rbegin(); a != active.rend(); ++a)
+      {
+        LiveInterval &other = intervals[a->second];
+        if (other.unspillable ||
+            (cur.crossesCall && !survivesCall[color[other.id]]))
+          continue;
+        if (other.end > cur.end || cur.unspillable)
+          victim = std::prev(a.base());
+        break;
+      }
+      if (victim == active.end())
+      {
+        if (!cur.unspillable)
+          splits.push_back({cur.id, cur.start});
+        continue;
+      }
+      LiveInterval &other = intervals[victim->second];
+      reg = color[other.id];
+      color[other.id] = 0;
+      splits.push_back({other.id, cur.start});
+      active.erase(victim);
+    }
+
+    color[cur.id] = reg;
+    free[reg] = false;
+    active.insert(std::make_pair(cur.end, i));
+  }
+}
@@ -0,0 +1,57 @@
+/* File: linearscan.h
+ * ------------------
+ * Linear scan register allocation (Poletto and Sarkar, "Linear Scan
+ * Register Allocation", TOPLAS 1999), the fast alternative to coloring
+ * the InterferenceGraph for very large functions.
+ *
+ * The instructions of a function are numbered in code order, each
+ * taking two positions: 2k where instruction k reads its operands and
+ * 2k+1 where it writes its result. The LiveInterval of a Location runs
+ * from the first position it is live at to the last, holes included,
+ * so two Locations may share a register when their intervals do not
+ * overlap. The intervals are visited by start, keeping those that hold
+ * a register in order of their end; when none is free, the interval
+ * that ends last gives its register up at the current position, and
+ * is split there: the part before keeps the register, the rest goes to
+ * memory. The whole allocation takes O(n log n) for n intervals.
+ */
+
+#ifndef _H_linearscan
+#define _H_linearscan
+
+#include <vector>
+
+struct LiveInterval {
+    int id;              // of the Location
+    int start, end;      // positions, both included
+    bool crossesCall;    // live across a call
+    bool unspillable;    // a spill temp: spilling it again gains nothing
+};
+
+class LinearScan {
+  public:
+         // An interval that lost its register from position at on;
+         // at == start if it never had one
+    struct Split { int id; int at; };
+
+  private:
+    std::vector<int> palette, crossingPalette;
+    std::vector<int> color;  // indexed by Location id
+    std::vector<Split> splits;
+
+  public:
+         // Registers are taken from the palette in order of preference,
+         // or from crossingPalette for intervals live across a call
+    LinearScan(int numLocations, const std::vector<int> &palette,
+               const std::vector<int> &crossingPalette);
+
+    void Allocate(std::vector<LiveInterval> &intervals);
+
+         // The register of Location id, 0 if it is to stay in memory.
+         // An interval that was split has none: it is only safe to keep
+         // the register for the first part once the code is rewritten.
+    int ColorOf(int id)               { return color[id]; }
+    const std::vector<Split> &Splits() { return splits; }
+};
+
+#endif
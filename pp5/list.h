@@ -80,6 +80,13 @@ template<class Element> class List {
 	{ Assert(index >= 0 && index < NumElements());
 	  elems.erase(elems.begin() + index); }
 
+	 // Replaces the count elements starting at index with the
+	 // elements of lst
+    void ReplaceRange(int index, int count, const List<Element> &lst)
+	{ Assert(index >= 0 && count >= 0 && index + count <= NumElements());
+	  elems.erase(elems.begin() + index, elems.begin() + index + count);
+	  elems.insert(elems.begin() + index, lst.elems.begin(), lst.elems.end()); }
+
 	 // Removes all elements of a specific value
     void Remove(const Element &elem)
         { elems.erase(std::remove(elems.begin(), elems.end(), elem), elems.end()); }
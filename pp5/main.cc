@@ -12,6 +12,17 @@
 
 void SysCallCodeGen();
 
+/* Function: PrintDelaySlot()
+ * --------------------------
+ * With delayed branches and loads (see GetScheduling), the built-ins
+ * need a nop after each branch and after a load used right away
+ */
+static void PrintDelaySlot()
+{
+    if (GetScheduling() == DelayedScheduling)
+        printf("\t  nop\n");
+}
+
 
 /* Function: main()
  * ----------------
@@ -41,7 +52,6 @@ void SysCallCodeGen()
     printf("	  sw $fp, 8($sp)	# save fp\n");
     printf("	  sw $ra, 4($sp)	# save ra\n");
     printf("	  addiu $fp, $sp, 8	# set up new fp\n");
-    printf("	  lw $a0, 4($fp)	# fill a from $fp+4\n");
     printf("	# LCall _PrintInt\n");
     printf("	  li $v0, 1\n");
     printf("	  syscall\n");
@@ -51,6 +61,7 @@ void SysCallCodeGen()
     printf("	  lw $ra, -4($fp)	# restore saved ra\n");
     printf("	  lw $fp, 0($fp)	# restore saved fp\n");
     printf("	  jr $ra		# return from function\n");
+    PrintDelaySlot();
     printf("\n");
     printf("  _ReadInteger:\n");
     printf("	  subu $sp, $sp, 8	# decrement sp to make space to save ra,fp\n");
@@ -65,6 +76,7 @@ void SysCallCodeGen()
     printf("	  lw $ra, -4($fp)	# restore saved ra\n");
     printf("	  lw $fp, 0($fp)	# restore saved fp\n");
     printf("	  jr $ra		# return from function\n");
+    PrintDelaySlot();
     printf("\n");
     printf("\n");
     printf("  _PrintBool:\n");
@@ -72,11 +84,12 @@ void SysCallCodeGen()
     printf("	  sw $fp, 8($sp)        # save fp\n");
     printf("	  sw $ra, 4($sp)        # save ra\n");
     printf("	  addiu $fp, $sp, 8     # set up new fp\n");
-    printf("	  lw $a0, 4($fp)        # fill a from $fp+4\n");
     printf("	  li $v0, 4\n");
     printf("	  beq $a0, $0, PrintBoolFalse\n");
+    PrintDelaySlot();
     printf("	  la $a0, _PrintBoolTrueString\n");
     printf("	  j PrintBoolEnd\n");
+    PrintDelaySlot();
     printf("  PrintBoolFalse:\n");
     printf(" 	  la $a0, _PrintBoolFalseString\n");
     printf("  PrintBoolEnd:\n");
@@ -87,6 +100,7 @@ void SysCallCodeGen()
     printf("	  lw $ra, -4($fp)       # restore saved ra\n");
     printf("	  lw $fp, 0($fp)        # restore saved fp\n");
     printf("	  jr $ra                # return from function\n");
+    PrintDelaySlot();
     printf("\n");
     printf("      .data			# create string constant marked with label\n");
     printf("      _PrintBoolTrueString: .asciiz \"true\"\n");
@@ -101,7 +115,6 @@ void SysCallCodeGen()
     printf("	  sw $fp, 8($sp)        # save fp\n");
     printf("	  sw $ra, 4($sp)        # save ra\n");
     printf("	  addiu $fp, $sp, 8     # set up new fp\n");
-    printf("	  lw $a0, 4($fp)        # fill a from $fp+4\n");
     printf("	  li $v0, 4\n");
     printf("	  syscall\n");
     printf("	# EndFunc\n");
@@ -110,13 +123,13 @@ void SysCallCodeGen()
     printf("	  lw $ra, -4($fp)       # restore saved ra\n");
     printf("	  lw $fp, 0($fp)        # restore saved fp\n");
     printf("	  jr $ra                # return from function\n");
+    PrintDelaySlot();
     printf("\n");
     printf("  _Alloc:\n");
     printf("	  subu $sp, $sp, 8      # decrement sp to make space to save ra,fp\n");
     printf("	  sw $fp, 8($sp)        # save fp\n");
     printf("	  sw $ra, 4($sp)        # save ra\n");
     printf("	  addiu $fp, $sp, 8     # set up new fp\n");
-    printf("	  lw $a0, 4($fp)        # fill a from $fp+4\n");
     printf("	  li $v0, 9\n");
     printf("	  syscall\n");
     printf("	# EndFunc\n");
@@ -125,6 +138,7 @@ void SysCallCodeGen()
     printf("	  lw $ra, -4($fp)       # restore saved ra\n");
     printf("	  lw $fp, 0($fp)        # restore saved fp\n");
     printf("	  jr $ra                # return from function\n");
+    PrintDelaySlot();
     printf("\n");
     printf("  _Halt:\n");
     printf("	  li $v0, 10\n");
@@ -137,19 +151,22 @@ void SysCallCodeGen()
     printf("	  sw $fp, 8($sp)        # save fp\n");
     printf("	  sw $ra, 4($sp)        # save ra\n");
     printf("	  addiu $fp, $sp, 8     # set up new fp\n");
-    printf("	  lw $a0, 4($fp)        # fill a from $fp+4\n");
-    printf("	  lw $a1, 8($fp)        # fill a from $fp+8\n");
     printf("    li  $v0,1\n");
     printf("	  beq $a0,$a1,Lrunt10\n");
+    PrintDelaySlot();
     printf("  Lrunt12:\n");
     printf("	  lbu  $v0,($a0)\n");
     printf("	  lbu  $a2,($a1)\n");
+    PrintDelaySlot();
     printf("	  bne $v0,$a2,Lrunt11\n");
+    PrintDelaySlot();
     printf("	  addiu $a0,$a0,1\n");
     printf("	  addiu $a1,$a1,1\n");
     printf("	  bne $v0,$0,Lrunt12\n");
+    PrintDelaySlot();
     printf("      li  $v0,1\n");
     printf("      j Lrunt10\n");
+    PrintDelaySlot();
     printf("  Lrunt11:\n");
     printf("	  li  $v0,0\n");
     printf("  Lrunt10:\n");
@@ -159,6 +176,7 @@ void SysCallCodeGen()
     printf("	  lw $ra, -4($fp)       # restore saved ra\n");
     printf("	  lw $fp, 0($fp)        # restore saved fp\n");
     printf("	  jr $ra                # return from function\n");
+    PrintDelaySlot();
     printf("\n");
     printf("\n");
     printf("\n");
@@ -179,9 +197,11 @@ void SysCallCodeGen()
     printf("	  lb $a1,($a0)          # load character at pointer\n");
     printf("	  addiu $a0,$a0,1       # forward pointer\n");
     printf("	  bnez $a1,Lrunt21      # loop until end of string is reached\n");
+    PrintDelaySlot();
     printf("	  lb $a1,-2($a0)        # load character before end of string\n");
     printf("	  li $a2,10             # newline character");
     printf("	  bneq $a1,$a2,Lrunt20  # do not remove last character if not newline\n");
+    PrintDelaySlot();
     printf("	  sb $0,-2($a0)         # Add the terminating character in its place\n");
     printf("  Lrunt20:\n");
     printf("	# EndFunc\n");
@@ -190,4 +210,5 @@ void SysCallCodeGen()
     printf("	  lw $ra, -4($fp)       # restore saved ra\n");
     printf("	  lw $fp, 0($fp)        # restore saved fp\n");
     printf("	  jr $ra                # return from function\n");
+    PrintDelaySlot();
 }
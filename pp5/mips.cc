@@ -22,18 +22,18 @@
 
 #include "mips.h"
 #include "tac.h"
+#include "scheduler.h"
 #include <stdarg.h>
 #include <string.h>
+#include <unordered_map>
 
 // Helper to check if two variable locations are one and the same
-// (same name, segment, and offset)
+// (same name, segment, and offset). Locations are interned, so equal
+// variables have equal ids.
 static bool LocationsAreSame(Location *var1, Location *var2)
 {
    return (var1 == var2 ||
-	     (var1 && var2
-		&& !strcmp(var1->GetName(), var2->GetName())
-		&& var1->GetSegment()  == var2->GetSegment()
-		&& var1->GetOffset() == var2->GetOffset()));
+	     (var1 && var2 && var1->GetId() == var2->GetId()));
 }
 
 
@@ -47,9 +47,9 @@ void Mips::SpillRegister(Location *dst, Register reg)
   Assert(dst);
   const char *offsetFromWhere = dst->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
   Assert(dst->GetOffset() % 4 == 0); // all variables are 4 bytes in size
-  Emit("sw %s, %d(%s)\t# spill %s from %s to %s%+d", regs[reg].name,
-       dst->GetOffset(), offsetFromWhere, dst->GetName(), regs[reg].name,
-       offsetFromWhere,dst->GetOffset());
+  Append(StoreWord, "sw", zero, dst->GetSegment() == fpRelative ? fp : gp,
+         reg, dst->GetOffset(), NULL, "spill %s from %s to %s%+d",
+         dst->GetName(), regs[reg].name, offsetFromWhere, dst->GetOffset());
   regs[reg].isDirty = false;
 }
 
@@ -63,9 +63,9 @@ void Mips::FillRegister(Location *src, Register reg)
   Assert(src);
   const char *offsetFromWhere = src->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
   Assert(src->GetOffset() % 4 == 0); // all variables are 4 bytes in size
-  Emit("lw %s, %d(%s)\t# fill %s to %s from %s%+d", regs[reg].name,
-       src->GetOffset(), offsetFromWhere, src->GetName(), regs[reg].name,
-       offsetFromWhere,src->GetOffset());
+  Append(LoadWord, "lw", reg, src->GetSegment() == fpRelative ? fp : gp,
+         zero, src->GetOffset(), NULL, "fill %s to %s from %s%+d",
+         src->GetName(), regs[reg].name, offsetFromWhere, src->GetOffset());
   regs[reg].isDirty = false;
   regs[reg].var = src;
 }
@@ -74,18 +74,56 @@ void Mips::FillRegister(Location *src, Register reg)
 
 /* Method: Emit
  * ------------
- * General purpose helper used to emit assembly instructions in
- * a reasonable tidy manner.  Takes printf-style formatting strings
+ * Used to emit a line of assembly that is not an instruction (a
+ * comment or a directive). Takes printf-style formatting strings
  * and variable arguments.
  */
 void Mips::Emit(const char *fmt, ...)
 {
   va_list args;
   char buf[1024];
-  
+
   va_start(args, fmt);
   vsprintf(buf, fmt, args);
   va_end(args);
+  MachineInstr instr = {Text, NULL, zero, zero, zero, 0, buf, ""};
+  code.push_back(instr);
+}
+
+
+/* Method: Append
+ * --------------
+ * Used to emit a machine instruction: rd is the register it writes,
+ * rs and rt those it reads (the base and the value for a sw), imm its
+ * constant or offset and label its target. The comment is a printf-
+ * style format for the rest of the arguments. Nothing is printed until
+ * Flush, so that the peephole pass can work on the instructions.
+ */
+void Mips::Append(InstrKind kind, const char *name, Register rd, Register rs,
+                  Register rt, int imm, const char *label,
+                  const char *comment, ...)
+{
+  MachineInstr instr = {kind, name, rd, rs, rt, imm, label ? label : "", ""};
+  if (comment)
+  {
+    va_list args;
+    char buf[1024];
+    va_start(args, comment);
+    vsprintf(buf, comment, args);
+    va_end(args);
+    instr.comment = buf;
+  }
+  code.push_back(instr);
+}
+
+
+/* Method: PrintLine
+ * -----------------
+ * General purpose helper used to print assembly lines in
+ * a reasonable tidy manner.
+ */
+void Mips::PrintLine(const char *buf)
+{
   if (buf[strlen(buf) - 1] != ':') printf("\t"); // don't tab in labels
   if (buf[0] != '#') printf("  ");   // outdent comments a little
   printf("%s", buf);
@@ -93,6 +131,56 @@ void Mips::Emit(const char *fmt, ...)
 }
 
 
+/* Method: Flush
+ * -------------
+ * Runs the peephole pass and the scheduler over the instructions
+ * emitted since the last flush (one function, or the data outside
+ * functions) and prints them.
+ */
+void Mips::Flush()
+{
+  Peephole();
+  if (GetScheduling() != NoScheduling)
+  {
+    Scheduler scheduler(&code, GetScheduling() == DelayedScheduling);
+    scheduler.Run();
+  }
+  for (auto &instr : code)
+  {
+    char buf[1024];
+    const char *rd = regs[instr.rd].name, *rs = regs[instr.rs].name,
+               *rt = regs[instr.rt].name, *label = instr.label.c_str();
+    switch (instr.kind)
+    {
+      case LoadImm:   sprintf(buf, "li %s, %d", rd, instr.imm); break;
+      case LoadAddr:  sprintf(buf, "la %s, %s", rd, label); break;
+      case LoadWord:  sprintf(buf, "lw %s, %d(%s)", rd, instr.imm, rs); break;
+      case StoreWord: sprintf(buf, "sw %s, %d(%s)", rt, instr.imm, rs); break;
+      case Move:      sprintf(buf, "move %s, %s", rd, rs); break;
+      case ThreeReg:  sprintf(buf, "%s %s, %s, %s", instr.name, rd, rs, rt); break;
+      case TwoRegImm: sprintf(buf, "%s %s, %s, %d", instr.name, rd, rs, instr.imm); break;
+      case Branch:    sprintf(buf, "b %s", label); break;
+      case BranchIfZero: sprintf(buf, "%s %s, %s", instr.name, rs, label); break;
+      case BranchCompare: sprintf(buf, "%s %s, %s, %s", instr.name, rs, rt, label); break;
+      case BranchCompareImm:
+        sprintf(buf, "%s %s, %d, %s", instr.name, rs, instr.imm, label);
+        break;
+      case CallLabel: sprintf(buf, "jal %-15s", label); break;
+      case CallReg:   sprintf(buf, "jalr %-15s", rs); break;
+      case JumpReg:   sprintf(buf, "jr %s", rs); break;
+      case LabelDef:  sprintf(buf, "%s:", label); break;
+      case Nop:       sprintf(buf, "nop"); break;
+      case Text:      sprintf(buf, "%s", label); break;
+      case Deleted:   continue;
+    }
+    if (!instr.comment.empty())
+      sprintf(buf + strlen(buf), "\t# %s", instr.comment.c_str());
+    PrintLine(buf);
+  }
+  code.clear();
+}
+
+
 
 /* Method: EmitLoadConstant
  * ------------------------
@@ -102,9 +190,14 @@ void Mips::Emit(const char *fmt, ...)
  */
 void Mips::EmitLoadConstant(Location *dst, int val)
 {
+  if (val == 0 && !dst->GetRegister())
+  {
+    SpillRegister(dst, zero); // no need to load a 0 to store it
+    return;
+  }
   Register reg = dst->GetRegister() ? dst->GetRegister() : rd;
-  Emit("li %s, %d\t\t# load constant value %d into %s", regs[reg].name,
-	 val, val, regs[reg].name);
+  Append(LoadImm, "li", reg, zero, zero, val, NULL,
+         "load constant value %d into %s", val, regs[reg].name);
   regs[reg].var = dst;
   regs[reg].isDirty = true;
   if (!dst->GetRegister()) SpillRegister(dst, reg);
@@ -137,7 +230,7 @@ void Mips::EmitLoadStringConstant(Location *dst, const char *str)
 void Mips::EmitLoadLabel(Location *dst, const char *label)
 {
   Register reg = dst->GetRegister() ? dst->GetRegister() : rd;
-  Emit("la %s, %s\t# load label", regs[reg].name, label);
+  Append(LoadAddr, "la", reg, zero, zero, 0, label, "load label");
   regs[reg].var = dst;
   regs[reg].isDirty = true;
   if (!dst->GetRegister()) SpillRegister(dst, reg);
@@ -148,14 +241,23 @@ void Mips::EmitLoadLabel(Location *dst, const char *label)
  * ----------------
  * Used to copy the value of one variable to another.  Slaves both
  * src and dst into registers and then emits a move instruction to
- * copy the contents from src to dst.
+ * copy the contents from src to dst. When only one of them is in
+ * memory, a single load or store does the copy, and when both are
+ * already in the same register there is nothing to do.
  */
 void Mips::EmitCopy(Location *dst, Location *src)
 {
+  if (dst->GetRegister() && !src->GetRegister()) {
+    FillRegister(src, dst->GetRegister()); // load straight into dst
+    regs[dst->GetRegister()].var = dst;
+    regs[dst->GetRegister()].isDirty = true;
+    return;
+  }
   Register reg = src->GetRegister() ? src->GetRegister() : rd;
   if (!src->GetRegister()) FillRegister(src, reg);
   if (dst->GetRegister()) {
-    Emit("move %s, %s\t# copy regs", regs[dst->GetRegister()].name, regs[reg].name);
+    if (dst->GetRegister() != reg)
+      Append(Move, "move", dst->GetRegister(), reg, zero, 0, NULL, "copy regs");
     regs[dst->GetRegister()].var = dst;
     regs[dst->GetRegister()].isDirty = true;
   } else SpillRegister(dst, reg);
@@ -175,8 +277,7 @@ void Mips::EmitLoad(Location *dst, Location *reference, int offset)
   Register regref = reference->GetRegister() ? reference->GetRegister() : rs;
   Register reg = dst->GetRegister() ? dst->GetRegister() : rd;
   if (!reference->GetRegister()) FillRegister(reference, regref);
-  Emit("lw %s, %d(%s) \t# load with offset", regs[reg].name,
-	 offset, regs[regref].name);
+  Append(LoadWord, "lw", reg, regref, zero, offset, NULL, "load with offset");
   regs[reg].var = dst;
   regs[reg].isDirty = true;
   if (!dst->GetRegister()) SpillRegister(dst, reg);
@@ -197,8 +298,7 @@ void Mips::EmitStore(Location *reference, Location *value, int offset)
   Register regref = reference->GetRegister() ? reference->GetRegister() : rt;
   if (!value->GetRegister()) FillRegister(value, reg);
   if (!reference->GetRegister()) FillRegister(reference, regref);
-  Emit("sw %s, %d(%s) \t# store with offset",
-	 regs[reg].name, offset, regs[regref].name);
+  Append(StoreWord, "sw", zero, regref, reg, offset, NULL, "store with offset");
 }
 
 
@@ -218,8 +318,68 @@ void Mips::EmitBinaryOp(OpCode code, Location *dst,
   Register reg2 = op2->GetRegister() ? op2->GetRegister() : rt;
   if (!op1->GetRegister()) FillRegister(op1, reg1);
   if (!op2->GetRegister()) FillRegister(op2, reg2);
-  Emit("%s %s, %s, %s\t", NameForTac(code), regs[reg].name,
-	 regs[reg1].name, regs[reg2].name);
+  Append(ThreeReg, NameForTac(code), reg, reg1, reg2, 0, NULL, NULL);
+  regs[reg].var = dst;
+  regs[reg].isDirty = true;
+  if (!dst->GetRegister()) SpillRegister(dst, reg);
+}
+
+
+/* Method: EmitBinaryOpImm
+ * ------------------------
+ * Used to perform a binary operation with a constant second operand,
+ * given in the instruction itself: addiu (also for subtracting), slti,
+ * andi, ori, xori, sll for multiplying by a power of 2, and sltiu or
+ * sltu against $zero for comparing with 0. The others take the
+ * pseudo-instruction of the register form with the constant in place
+ * of a register.
+ */
+bool Mips::FitsImmediate(OpCode code, int imm)
+{
+  switch (code)
+  {
+    case Add: case Mul: case Eq: case Less: case Le: case Gt: case Ge:
+    case Ne:
+      return imm >= -32768 && imm <= 32767;
+    case Sub:
+      return imm >= -32767 && imm <= 32768;
+    case And: case Or: case Xor:
+      return imm >= 0 && imm <= 65535;
+    default:
+      return false;
+  }
+}
+
+void Mips::EmitBinaryOpImm(OpCode code, Location *dst, Location *op1, int imm)
+{
+  Assert(FitsImmediate(code, imm));
+  Register reg = dst->GetRegister() ? dst->GetRegister() : rd;
+  Register reg1 = op1->GetRegister() ? op1->GetRegister() : rs;
+  if (!op1->GetRegister()) FillRegister(op1, reg1);
+  int shift = 0;
+  while (shift < 15 && (1 << shift) < imm)
+    shift++;
+  if (code == Mul && imm == (1 << shift))
+    Append(TwoRegImm, "sll", reg, reg1, zero, shift, NULL, NULL);
+  else if (code == Eq && imm == 0)
+    Append(TwoRegImm, "sltiu", reg, reg1, zero, 1, NULL, NULL);
+  else if (code == Ne && imm == 0)
+    Append(ThreeReg, "sltu", reg, zero, reg1, 0, NULL, NULL);
+  else
+  {
+    const char *name = NameForTac(code);
+    switch (code)
+    {
+      case Add: name = "addiu"; break;
+      case Sub: name = "addiu"; imm = -imm; break;
+      case Less: name = "slti"; break;
+      case And: name = "andi"; break;
+      case Or: name = "ori"; break;
+      case Xor: name = "xori"; break;
+      default: break;
+    }
+    Append(TwoRegImm, name, reg, reg1, zero, imm, NULL, NULL);
+  }
   regs[reg].var = dst;
   regs[reg].isDirty = true;
   if (!dst->GetRegister()) SpillRegister(dst, reg);
@@ -235,7 +395,7 @@ void Mips::EmitBinaryOp(OpCode code, Location *dst,
  */
 void Mips::EmitLabel(const char *label)
 { 
-  Emit("%s:", label);
+  Append(LabelDef, NULL, zero, zero, zero, 0, label, NULL);
 }
 
 
@@ -248,7 +408,7 @@ void Mips::EmitLabel(const char *label)
  */
 void Mips::EmitGoto(const char *label)
 {
-  Emit("b %s\t\t# unconditional branch", label);
+  Append(Branch, "b", zero, zero, zero, 0, label, "unconditional branch");
 }
 
 
@@ -263,24 +423,79 @@ void Mips::EmitIfZ(Location *test, const char *label)
 { 
   Register reg = test->GetRegister() ? test->GetRegister() : rs;
   if (!test->GetRegister()) FillRegister(test, reg);
-  Emit("beqz %s, %s\t# branch if %s is zero ", regs[reg].name, label,
-	 test->GetName());
+  Append(BranchIfZero, "beqz", zero, reg, zero, 0, label,
+         "branch if %s is zero", test->GetName());
+}
+
+
+/* Method: EmitIfRel
+ * -----------------
+ * Used for a conditional branch on the comparison of two variables, or
+ * of a variable and a constant, with a single compare-and-branch (beq,
+ * bne, blt, ble, bgt, bge, or beqz and bnez for a comparison with 0)
+ * rather than setting a register to the outcome and testing it.
+ */
+const char *Mips::BranchName(OpCode code)
+{
+  switch (code)
+  {
+    case Eq:   return "beq";
+    case Ne:   return "bne";
+    case Less: return "blt";
+    case Le:   return "ble";
+    case Gt:   return "bgt";
+    case Ge:   return "bge";
+    default:   Failure("No branch for operator %d", code); return NULL;
+  }
+}
+
+void Mips::EmitIfRel(OpCode code, Location *op1, Location *op2, const char *label)
+{
+  Register reg1 = op1->GetRegister() ? op1->GetRegister() : rs;
+  Register reg2 = op2->GetRegister() ? op2->GetRegister() : rt;
+  if (!op1->GetRegister()) FillRegister(op1, reg1);
+  if (!op2->GetRegister()) FillRegister(op2, reg2);
+  Append(BranchCompare, BranchName(code), zero, reg1, reg2, 0, label,
+         "branch if %s %s %s", op1->GetName(), NameForTac(code), op2->GetName());
+}
+
+void Mips::EmitIfRelImm(OpCode code, Location *op1, int imm, const char *label)
+{
+  Register reg1 = op1->GetRegister() ? op1->GetRegister() : rs;
+  if (!op1->GetRegister()) FillRegister(op1, reg1);
+  if (imm == 0 && (code == Eq || code == Ne))
+    Append(BranchIfZero, code == Eq ? "beqz" : "bnez", zero, reg1, zero, 0,
+           label, "branch if %s is %szero", op1->GetName(),
+           code == Eq ? "" : "not ");
+  else
+    Append(BranchCompareImm, BranchName(code), zero, reg1, zero, imm, label,
+           "branch if %s %s %d", op1->GetName(), NameForTac(code), imm);
 }
 
 
 /* Method: EmitParam
  * -----------------
- * Used to push a parameter on the stack in anticipation of upcoming
- * function call. Decrements the stack pointer by 4. Slaves argument into
- * register and then stores contents to location just made at end of
- * stack.
+ * Used to pass a parameter in anticipation of upcoming function call.
+ * The first NumArgRegs arguments are copied to $a0-$a3. The others are
+ * stored to the outgoing area at the bottom of the caller's frame, at
+ * the offset from $sp where the callee finds them from its $fp (which
+ * will be our $sp); the area is sized at frame setup, so $sp never
+ * moves around a call.
  */
-void Mips::EmitParam(Location *arg)
+void Mips::EmitParam(Location *arg, int index)
 {
+  if (index < NumArgRegs) {
+    Register argReg = Register(a0 + index);
+    if (!arg->GetRegister()) FillRegister(arg, argReg);
+    else if (arg->GetRegister() != argReg)
+      Append(Move, "move", argReg, arg->GetRegister(), zero, 0, NULL,
+             "copy param value to %s", regs[argReg].name);
+    return;
+  }
   Register reg = arg->GetRegister() ? arg->GetRegister() : rs;
-  Emit("subu $sp, $sp, 4\t# decrement sp to make space for param");
   if (!arg->GetRegister()) FillRegister(arg, reg);
-  Emit("sw %s, 4($sp)\t# copy param value to stack", regs[reg].name);
+  Append(StoreWord, "sw", zero, sp, reg, 4 + 4 * index, NULL,
+         "copy param value to outgoing area");
 }
 
 
@@ -295,13 +510,17 @@ void Mips::EmitParam(Location *arg)
  * the var to a register and copy function return value from $v0 into that
  * register.  
  */
-void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel)
+void Mips::EmitCallInstr(Location *result, const char *label, Register fnReg)
 {
-  Emit("%s %-15s\t# jump to function", isLabel? "jal": "jalr", fn);
+  if (label)
+    Append(CallLabel, "jal", zero, zero, zero, 0, label, "jump to function");
+  else
+    Append(CallReg, "jalr", zero, fnReg, zero, 0, NULL, "jump to function");
   if (result != NULL) {
     if (result->GetRegister()) {
-      Emit("move %s, %s\t\t# copy function return value from $v0",
-        regs[result->GetRegister()].name, regs[v0].name);
+      if (result->GetRegister() != v0)
+        Append(Move, "move", result->GetRegister(), v0, zero, 0, NULL,
+               "copy function return value from $v0");
       regs[result->GetRegister()].var = result;
       regs[result->GetRegister()].isDirty = true;
     }
@@ -313,27 +532,16 @@ void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel)
 // Two covers for the above method for specific LCall/ACall variants
 void Mips::EmitLCall(Location *dst, const char *label)
 { 
-  EmitCallInstr(dst, label, true);
+  EmitCallInstr(dst, label, zero);
 }
 
 void Mips::EmitACall(Location *dst, Location *fn)
 {
   Register reg = fn->GetRegister() ? fn->GetRegister() : rs;
   if (!fn->GetRegister()) FillRegister(fn, reg);
-  EmitCallInstr(dst, regs[reg].name, false);
-}
-
-/*
- * We remove all parameters from the stack after a completed call
- * by adjusting the stack pointer upwards.
- */
-void Mips::EmitPopParams(int bytes)
-{
-  if (bytes != 0)
-    Emit("add $sp, $sp, %d\t# pop params off stack", bytes);
+  EmitCallInstr(dst, NULL, reg);
 }
 
-
 /* Method: EmitReturn
  * ------------------
  * Used to emit code for returning from a function (either from an
@@ -344,19 +552,21 @@ void Mips::EmitPopParams(int bytes)
  * commit contents of slaved registers to memory, necessary for
  * consistency, see comments at SpillForEndFunction above). We also
  * do the last part of the callee's job in function call protocol,
- * which is to remove our locals/temps from the stack, remove
- * saved registers ($fp and $ra) and restore previous values of
- * $fp and $ra so everything is returned to the state we entered.
+ * which is to restore the callee-saved registers the function uses,
+ * remove our locals/temps from the stack, remove saved registers
+ * ($fp and $ra) and restore previous values of $fp and $ra so
+ * everything is returned to the state we entered.
  * We then emit jr to jump to the saved $ra.
  */
 void Mips::EmitReturn(Location *returnVal)
 { 
   if (returnVal != NULL) 
   {
-    if (returnVal->GetRegister()) 
-      Emit("move $v0, %s\t\t# assign return value into $v0",
-	regs[returnVal->GetRegister()].name);
-      else FillRegister(returnVal, v0);
+    if (returnVal->GetRegister()) {
+      if (returnVal->GetRegister() != v0)
+        Append(Move, "move", v0, returnVal->GetRegister(), zero, 0, NULL,
+               "assign return value into $v0");
+    } else FillRegister(returnVal, v0);
   }
   /*for (int r = 1; r < NumRegs; ++r)
   {
@@ -367,10 +577,13 @@ void Mips::EmitReturn(Location *returnVal)
       SpillRegister(regs[r].var, static_cast<Register>(r));
     }
   }*/
-  Emit("move $sp, $fp\t\t# pop callee frame off stack");
-  Emit("lw $ra, -4($fp)\t# restore saved ra");
-  Emit("lw $fp, 0($fp)\t# restore saved fp");
-  Emit("jr $ra\t\t# return from function");
+  for (int i = 0; i < calleeSaved.NumElements(); i++)
+    Append(LoadWord, "lw", calleeSaved.Nth(i), fp, zero, -8 - frameSize - 4 * i,
+           NULL, "restore callee-saved register");
+  Append(Move, "move", sp, fp, zero, 0, NULL, "pop callee frame off stack");
+  Append(LoadWord, "lw", ra, fp, zero, -4, NULL, "restore saved ra");
+  Append(LoadWord, "lw", fp, fp, zero, 0, NULL, "restore saved fp");
+  Append(JumpReg, "jr", zero, ra, zero, 0, NULL, "return from function");
 }
 
 
@@ -380,19 +593,51 @@ void Mips::EmitReturn(Location *returnVal)
  * upon entering a new function. We decrement the $sp to make space
  * and then save the current values of $fp and $ra (since we are
  * going to change them), then set up the $fp and bump the $sp down
- * to make space for all our locals/temps.
+ * to make space for all our locals/temps. The callee-saved registers
+ * the function uses are saved below the locals/temps, and below them
+ * is the outgoing area for the arguments of the calls it makes.
  */
-void Mips::EmitBeginFunction(int stackFrameSize)
+void Mips::EmitBeginFunction(int stackFrameSize, List<Register> *saved,
+                             int outgoingSize)
 {
   Assert(stackFrameSize >= 0);
-  Emit("subu $sp, $sp, 8\t# decrement sp to make space to save ra, fp");
-  Emit("sw $fp, 8($sp)\t# save fp");
-  Emit("sw $ra, 4($sp)\t# save ra");
-  Emit("addiu $fp, $sp, 8\t# set up new fp");
+  frameSize = stackFrameSize;
+  calleeSaved.Clear();
+  calleeSaved.AppendAll(*saved);
+  Append(TwoRegImm, "subu", sp, sp, zero, 8, NULL,
+         "decrement sp to make space to save ra, fp");
+  Append(StoreWord, "sw", zero, sp, fp, 8, NULL, "save fp");
+  Append(StoreWord, "sw", zero, sp, ra, 4, NULL, "save ra");
+  Append(TwoRegImm, "addiu", fp, sp, zero, 8, NULL, "set up new fp");
+
+  int size = frameSize + 4 * calleeSaved.NumElements() + outgoingSize;
+  if (size != 0)
+    Append(TwoRegImm, "subu", sp, sp, zero, size, NULL,
+           "decrement sp to make space for locals/temps");
+  for (int i = 0; i < calleeSaved.NumElements(); i++)
+    Append(StoreWord, "sw", zero, fp, calleeSaved.Nth(i), -8 - frameSize - 4 * i,
+           NULL, "save callee-saved register");
+}
+
 
-  if (stackFrameSize != 0)
-    Emit("subu $sp, $sp, %d\t# decrement sp to make space for locals/temps",
-	   stackFrameSize);
+/* Method: EmitFormal
+ * ------------------
+ * Used on entry to a function to put formal number index where the
+ * register allocator wants it. The first NumArgRegs arrive in $a0-$a3
+ * and are moved to the formal's register, or stored to its slot in the
+ * caller's outgoing area if it has none. The others are already in
+ * their slots and are loaded if the formal has a register.
+ */
+void Mips::EmitFormal(Location *formal, int index)
+{
+  Register reg = formal->GetRegister();
+  if (index < NumArgRegs) {
+    Register argReg = Register(a0 + index);
+    if (!reg) SpillRegister(formal, argReg);
+    else if (reg != argReg)
+      Append(Move, "move", reg, argReg, zero, 0, NULL, "copy param value from %s",
+             regs[argReg].name);
+  } else if (reg) FillRegister(formal, reg);
 }
 
 
@@ -406,6 +651,7 @@ void Mips::EmitEndFunction()
 { 
   Emit("# (below handles reaching end of fn body with no explicit return)");
   EmitReturn(NULL);
+  Flush();
 }
 
 
@@ -424,6 +670,7 @@ void Mips::EmitVTable(const char *label, List<const char*> *methodLabels)
   for (int i = 0; i < methodLabels->NumElements(); i++)
     Emit(".word %s\n", methodLabels->Nth(i));
   Emit(".text");
+  Flush();
 }
 
 
@@ -439,6 +686,270 @@ void Mips::EmitPreamble()
   Emit(".text");
   Emit(".align 2");
   Emit(".globl main");
+  Flush();
+}
+
+
+/* Peephole optimization
+ * ---------------------
+ * Before a function is printed its instructions are cleaned up:
+ * branches to branches are sent to the final target, branches to the
+ * next instruction and moves of a register to itself are dropped, a
+ * lw right after a sw to the same address becomes a move (or nothing),
+ * a li whose only use is the second operand of addu, subu, slt, and or
+ * becomes the immediate operand of that instruction, and a li of 0
+ * whose only use is a sw, move or register operand gives way to $zero.
+ *
+ * Folding a li needs to know its register is dead after the use, so
+ * the registers live after each instruction are found over the
+ * function's flow graph, with one bit per register.
+ */
+
+#define RegBit(r) (uint32_t(1) << (r))
+static const uint32_t ArgRegs = RegBit(Mips::a0) | RegBit(Mips::a1) |
+                                RegBit(Mips::a2) | RegBit(Mips::a3);
+static const uint32_t CalleeSavedRegs = 0xffu << Mips::s0;
+// the registers that keep their values across a call
+static const uint32_t PreservedRegs = CalleeSavedRegs | RegBit(Mips::gp) |
+                                      RegBit(Mips::sp) | RegBit(Mips::fp);
+
+uint32_t Mips::Uses(const MachineInstr &instr)
+{
+  switch (instr.kind)
+  {
+    case LoadWord: case Move: case TwoRegImm: case BranchIfZero:
+    case BranchCompareImm:
+      return RegBit(instr.rs);
+    case StoreWord: case ThreeReg: case BranchCompare:
+      return RegBit(instr.rs) | RegBit(instr.rt);
+    case CallLabel:
+      return ArgRegs | RegBit(sp);
+    case CallReg:
+      return ArgRegs | RegBit(sp) | RegBit(instr.rs);
+    case JumpReg: // a return: the result and what the caller keeps
+      return RegBit(instr.rs) | RegBit(v0) | PreservedRegs;
+    default:
+      return 0;
+  }
+}
+
+uint32_t Mips::Defs(const MachineInstr &instr)
+{
+  switch (instr.kind)
+  {
+    case LoadImm: case LoadAddr: case LoadWord: case Move: case ThreeReg:
+    case TwoRegImm:
+      return RegBit(instr.rd);
+    case CallLabel: case CallReg:
+      return ~PreservedRegs;
+    default:
+      return 0;
+  }
+}
+
+/* Method: NextInstr
+ * -----------------
+ * The index of the first instruction after i, skipping comments and
+ * directives, and labels too if asked; code.size() if there is none
+ */
+int Mips::NextInstr(int i, bool skipLabels)
+{
+  int n = code.size();
+  for (i++; i < n; i++)
+    if (code[i].kind != Text && code[i].kind != Deleted &&
+        (code[i].kind != LabelDef || !skipLabels))
+      break;
+  return i;
+}
+
+/* Method: LoadImmFor
+ * ------------------
+ * The li of r whose value instruction i uses, if nothing in between
+ * reads or writes r or leaves the straight line, and r is dead after
+ * i; -1 if there is none
+ */
+int Mips::LoadImmFor(int i, Register r, std::vector<uint32_t> &liveOut)
+{
+  static const int MaxDistance = 8;
+  if (r == zero || (liveOut[i] & RegBit(r) && !(Defs(code[i]) & RegBit(r))))
+    return -1;
+  int j = i - 1;
+  for (int seen = 0; j >= 0 && seen < MaxDistance; j--)
+  {
+    InstrKind kind = code[j].kind;
+    if (kind == Text || kind == Deleted)
+      continue;
+    if (kind == LoadImm && code[j].rd == r)
+      return j;
+    if (kind == LabelDef || kind == Branch || IsConditionalBranch(kind) ||
+        kind == CallLabel || kind == CallReg || kind == JumpReg ||
+        ((Uses(code[j]) | Defs(code[j])) & RegBit(r)))
+      return -1;
+    seen++;
+  }
+  return -1;
+}
+
+/* Method: FoldImmediate
+ * ---------------------
+ * Folds a li into instruction i, as its second operand or, if useRs,
+ * its first (for the commutative ones). Returns whether it did.
+ */
+bool Mips::FoldImmediate(int i, bool useRs, std::vector<uint32_t> &liveOut)
+{
+  MachineInstr &op = code[i];
+  Register r = useRs ? op.rs : op.rt, other = useRs ? op.rt : op.rs;
+  int j = r == other ? -1 : LoadImmFor(i, r, liveOut);
+  if (j < 0)
+    return false;
+
+  int c = code[j].imm;
+  const char *name = NULL;
+  if (!strcmp(op.name, "addu") && c >= -32768 && c <= 32767)
+    name = "addiu";
+  else if (!strcmp(op.name, "subu") && !useRs && c >= -32767 && c <= 32768)
+  {
+    name = "addiu";
+    c = -c;
+  }
+  else if (!strcmp(op.name, "slt") && !useRs && c >= -32768 && c <= 32767)
+    name = "slti";
+  else if (!strcmp(op.name, "and") && c >= 0 && c <= 65535)
+    name = "andi";
+  else if (!strcmp(op.name, "or") && c >= 0 && c <= 65535)
+    name = "ori";
+  if (!name)
+    return false;
+  op.kind = TwoRegImm;
+  op.name = name;
+  op.rs = other;
+  op.rt = zero;
+  op.imm = c;
+  code[j].kind = Deleted;
+  return true;
+}
+
+void Mips::Peephole()
+{
+  int n = code.size(), removed = 0, folded = 0;
+  std::unordered_map<std::string, int> labelAt;
+  for (int i = 0; i < n; i++)
+    if (code[i].kind == LabelDef)
+      labelAt[code[i].label] = i;
+
+  for (int i = 0; i < n; i++)
+  {
+    MachineInstr &instr = code[i];
+    if (instr.kind != Branch && !IsConditionalBranch(instr.kind))
+      continue;
+
+    // a branch to a b goes where the b does (a few hops at most, as
+    // the bs may form a loop)
+    for (int hops = 0; hops < 8; hops++)
+    {
+      auto found = labelAt.find(instr.label);
+      if (found == labelAt.end())
+        break;
+      int j = NextInstr(found->second, true);
+      if (j == n || code[j].kind != Branch || code[j].label == instr.label)
+        break;
+      instr.label = code[j].label;
+    }
+
+    // and a branch to the next instruction can go
+    for (int j = NextInstr(i, false); j < n && code[j].kind == LabelDef;
+         j = NextInstr(j, false))
+      if (code[j].label == instr.label)
+      {
+        instr.kind = Deleted;
+        removed++;
+        break;
+      }
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    if (code[i].kind == Move && code[i].rd == code[i].rs)
+    {
+      code[i].kind = Deleted;
+      removed++;
+    }
+    int j = NextInstr(i, false);
+    if (code[i].kind == StoreWord && j < n && code[j].kind == LoadWord &&
+        code[j].rs == code[i].rs && code[j].imm == code[i].imm)
+    {
+      if (code[j].rd == code[i].rt)
+      {
+        code[j].kind = Deleted;
+        removed++;
+      }
+      else
+      {
+        code[j].kind = Move;
+        code[j].rs = code[i].rt;
+        code[j].comment = "copy the value just stored";
+      }
+    }
+  }
+
+  // registers live after each instruction, by iterating backward over
+  // the function until nothing changes
+  std::vector<uint32_t> liveIn(n, 0), liveOut(n, 0);
+  for (bool changed = true; changed; )
+  {
+    changed = false;
+    for (int i = n - 1; i >= 0; i--)
+    {
+      MachineInstr &instr = code[i];
+      uint32_t out = 0;
+      if (instr.kind != Branch && instr.kind != JumpReg && i + 1 < n)
+        out = liveIn[i + 1];
+      if (instr.kind == Branch || IsConditionalBranch(instr.kind))
+      {
+        auto found = labelAt.find(instr.label);
+        out |= found == labelAt.end() ? ~uint32_t(0) : liveIn[found->second];
+      }
+      uint32_t in = Uses(instr) | (out & ~Defs(instr));
+      changed |= in != liveIn[i];
+      liveIn[i] = in;
+      liveOut[i] = out;
+    }
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    MachineInstr &instr = code[i];
+    if (instr.kind != ThreeReg)
+      continue;
+    bool commutes = !strcmp(instr.name, "addu") || !strcmp(instr.name, "and") ||
+                    !strcmp(instr.name, "or");
+    if (FoldImmediate(i, false, liveOut) ||
+        (commutes && FoldImmediate(i, true, liveOut)))
+      folded++;
+  }
+
+  // a 0 only stored, copied or operated on is read from $zero instead
+  for (int i = 0; i < n; i++)
+  {
+    MachineInstr &instr = code[i];
+    Register *operand = NULL;
+    if (instr.kind == StoreWord && instr.rt != instr.rs)
+      operand = &instr.rt;
+    else if (instr.kind == Move || (instr.kind == ThreeReg && instr.rt == zero))
+      operand = &instr.rs;
+    else if (instr.kind == ThreeReg && instr.rs != instr.rt)
+      operand = &instr.rt;
+    if (!operand)
+      continue;
+    int j = LoadImmFor(i, *operand, liveOut);
+    if (j < 0 || code[j].imm != 0)
+      continue;
+    *operand = zero;
+    code[j].kind = Deleted;
+    folded++;
+  }
+  PrintDebug("peephole", "%d instructions removed, %d immediates folded",
+             removed, folded);
 }
 
 
@@ -460,7 +971,7 @@ void Mips::ClearRegister()
 {
   regs[zero] = (RegContents){false, NULL, "$zero", false};
   regs[at] = (RegContents){false, NULL, "$at", false};
-  regs[v0] = (RegContents){false, NULL, "$v0", false};
+  regs[v0] = (RegContents){false, NULL, "$v0", true};
   regs[v1] = (RegContents){false, NULL, "$v1", false};
   regs[a0] = (RegContents){false, NULL, "$a0", false};
   regs[a1] = (RegContents){false, NULL, "$a1", false};
@@ -481,7 +992,7 @@ void Mips::ClearRegister()
   regs[t6] = (RegContents){false, NULL, "$t6", true};
   regs[t7] = (RegContents){false, NULL, "$t7", true};
   regs[t8] = (RegContents){false, NULL, "$t8", true};
-  regs[t9] = (RegContents){false, NULL, "$t9", true};
+  regs[t9] = (RegContents){false, NULL, "$t9", false};
   regs[s0] = (RegContents){false, NULL, "$s0", true};
   regs[s1] = (RegContents){false, NULL, "$s1", true};
   regs[s2] = (RegContents){false, NULL, "$s2", true};
@@ -498,8 +1009,8 @@ void Mips::ClearRegister()
  * the initial starting state.
  */
 Mips::Mips() {
-  mipsName[Add] = "add";
-  mipsName[Sub] = "sub";
+  mipsName[Add] = "addu";
+  mipsName[Sub] = "subu";
   mipsName[Mul] = "mul";
   mipsName[Div] = "div";
   mipsName[Mod] = "rem";
@@ -507,8 +1018,14 @@ Mips::Mips() {
   mipsName[Less] = "slt";
   mipsName[And] = "and";
   mipsName[Or] = "or";
+  mipsName[Le] = "sle";
+  mipsName[Ge] = "sge";
+  mipsName[Ne] = "sne";
+  mipsName[Xor] = "xor";
+  mipsName[Gt] = "sgt";
   ClearRegister();
-  rs = v0; rt = v1; rd = v0;
+  rs = v1; rt = t9; rd = v1; // $v0 is allocated, for call results
+  frameSize = 0;
 }
 const char *Mips::mipsName[NumOps];
 
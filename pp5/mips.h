@@ -18,6 +18,9 @@
 #ifndef _H_mips
 #define _H_mips
 
+#include <stdint.h>
+#include <string>
+#include <vector>
 #include "list.h"
 
 class Location;
@@ -25,7 +28,8 @@ class Location;
 
 class Mips {
   public:
-    typedef enum {Add, Sub, Mul, Div, Mod, Eq, Less, And, Or, NumOps} OpCode;
+    typedef enum {Add, Sub, Mul, Div, Mod, Eq, Less, And, Or,
+                  Le, Ge, Ne, Xor, Gt, NumOps} OpCode;
 
     typedef enum {zero, at, v0, v1, a0, a1, a2, a3,
 			t0, t1, t2, t3, t4, t5, t6, t7,
@@ -41,19 +45,65 @@ class Mips {
     	bool isGeneralPurpose;
     } regs[NumRegs];
 
+         // The kinds of machine instruction emitted. The instructions
+         // of a function are kept until its end, so that the peephole
+         // pass can rewrite them before they are printed.
+    typedef enum { LoadImm, LoadAddr, LoadWord, StoreWord, Move, ThreeReg,
+                   TwoRegImm, Branch, BranchIfZero, BranchCompare,
+                   BranchCompareImm, CallLabel, CallReg, JumpReg, LabelDef,
+                   Nop, Text, Deleted } InstrKind;
+
+    struct MachineInstr {
+        InstrKind kind;
+        const char *name;     // the mnemonic, for operations and branches
+        Register rd, rs, rt;  // rd is written, rs and rt are read
+        int imm;              // constant, offset or stack adjustment
+        std::string label;    // target or label defined; the line for Text
+        std::string comment;
+    };
+
   private:
     Register rs, rt, rd;
-
-    void EmitCallInstr(Location *dst, const char *fn, bool isL);
+    int frameSize;               // of the function being emitted
+    List<Register> calleeSaved;  // the $s registers it saves on entry
+    std::vector<MachineInstr> code; // emitted since the last Flush
+
+    void EmitCallInstr(Location *dst, const char *label, Register fnReg);
+    void Append(InstrKind kind, const char *name, Register rd, Register rs,
+                Register rt, int imm, const char *label,
+                const char *comment, ...);
+    static void PrintLine(const char *line);
+
+         // The peephole pass and the register liveness it needs
+    void Peephole();
+    int NextInstr(int i, bool skipLabels);
+    int LoadImmFor(int i, Register r, std::vector<uint32_t> &liveOut);
+    bool FoldImmediate(int i, bool useRs, std::vector<uint32_t> &liveOut);
     
     static const char *mipsName[NumOps];
     static const char *NameForTac(OpCode code);
+    static const char *BranchName(OpCode code);
 
   public:
     
     Mips();
 
-    static void Emit(const char *fmt, ...);
+         // The registers an instruction reads and writes, one bit per
+         // register; a call writes those not kept across calls
+    static uint32_t Uses(const MachineInstr &instr);
+    static uint32_t Defs(const MachineInstr &instr);
+    static bool IsConditionalBranch(InstrKind kind)
+        { return kind == BranchIfZero || kind == BranchCompare ||
+                 kind == BranchCompareImm; }
+
+         // $s0-$s7 keep their values across calls: a function that
+         // uses one saves it on entry and restores it before returning
+    static bool IsCalleeSaved(Register r) { return r >= s0 && r <= s7; }
+         // The first arguments of a call are passed in $a0-$a3
+    static const int NumArgRegs = 4;
+
+    void Emit(const char *fmt, ...);
+    void Flush();
     
     void EmitLoadConstant(Location *dst, int val);
     void EmitLoadStringConstant(Location *dst, const char *str);
@@ -65,19 +115,26 @@ class Mips {
 
     void EmitBinaryOp(OpCode code, Location *dst, 
 			    Location *op1, Location *op2);
+         // The same with a constant second operand, which must fit the
+         // immediate field of the instruction chosen
+    static bool FitsImmediate(OpCode code, int imm);
+    void EmitBinaryOpImm(OpCode code, Location *dst, Location *op1, int imm);
 
     void EmitLabel(const char *label);
     void EmitGoto(const char *label);
     void EmitIfZ(Location *test, const char*label);
+    void EmitIfRel(OpCode code, Location *op1, Location *op2, const char *label);
+    void EmitIfRelImm(OpCode code, Location *op1, int imm, const char *label);
     void EmitReturn(Location *returnVal);
 
-    void EmitBeginFunction(int frameSize);
+    void EmitBeginFunction(int frameSize, List<Register> *calleeSaved,
+                           int outgoingSize);
+    void EmitFormal(Location *formal, int index);
     void EmitEndFunction();
 
-    void EmitParam(Location *arg);
+    void EmitParam(Location *arg, int index);
     void EmitLCall(Location *result, const char* label);
     void EmitACall(Location *result, Location *fnAddr);
-    void EmitPopParams(int bytes);
 
     void EmitVTable(const char *label, List<const char*> *methodLabels);
 
@@ -0,0 +1,86 @@
+/* File: modref.cc
+ * ---------------
+ * Implementation of the ModRef analysis.
+ */
+
+#include "modref.h"
+#include <string.h>
+
+ModRef::ModRef(List<Instruction*> *code, int numGlobals)
+  : methodsRef(numGlobals), methodsMod(numGlobals), none(numGlobals)
+{
+  // what each function names itself
+  Summary *current = NULL;
+  for (int i = 0; i < code->NumElements(); i++)
+  {
+    auto tac = code->Nth(i);
+    if (TacCast<BeginFunc>(tac))
+    {
+      auto labelTac = TacCast<Label>(code->Nth(i - 1)); // function label
+      current = &functions[labelTac->GetLabel()];
+      current->ref.Resize(numGlobals);
+      current->mod.Resize(numGlobals);
+      current->callsMethods = false;
+    }
+    if (!current)
+      continue;
+    for (auto var : tac->GetGlobalsRead())
+      current->ref.Set(var->GetId());
+    for (auto var : tac->GetGlobalsWritten())
+      current->mod.Set(var->GetId());
+    if (auto callTac = TacCast<LCall>(tac))
+      current->callees.Append(callTac->GetLabel());
+    else if (tac->GetOpcode() == TacACall)
+      current->callsMethods = true;
+    else if (tac->GetOpcode() == TacEndFunc)
+      current = NULL;
+  }
+
+  // and what it reaches through its calls
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (auto &f : functions)
+      if (strchr(f.first.c_str(), '.')) // a method
+      {
+        methodsRef.UnionWith(f.second.ref);
+        methodsMod.UnionWith(f.second.mod);
+      }
+    for (auto &f : functions)
+    {
+      Summary &caller = f.second;
+      for (int i = 0; i < caller.callees.NumElements(); i++)
+      {
+        auto callee = functions.find(caller.callees.Nth(i));
+        if (callee == functions.end())
+          continue; // a built-in
+        changed |= caller.ref.UnionWith(callee->second.ref);
+        changed |= caller.mod.UnionWith(callee->second.mod);
+      }
+      if (caller.callsMethods)
+      {
+        changed |= caller.ref.UnionWith(methodsRef);
+        changed |= caller.mod.UnionWith(methodsMod);
+      }
+    }
+  }
+}
+
+const BitVector &ModRef::Ref(FnCall *call)
+{
+  auto lcall = TacCast<LCall>(call);
+  if (!lcall)
+    return methodsRef;
+  auto callee = functions.find(lcall->GetLabel());
+  return callee == functions.end() ? none : callee->second.ref;
+}
+
+const BitVector &ModRef::Mod(FnCall *call)
+{
+  auto lcall = TacCast<LCall>(call);
+  if (!lcall)
+    return methodsMod;
+  auto callee = functions.find(lcall->GetLabel());
+  return callee == functions.end() ? none : callee->second.mod;
+}
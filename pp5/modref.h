@@ -0,0 +1,44 @@
+/* File: modref.h
+ * --------------
+ * ModRef summarizes, for every function of the program, the global
+ * variables it may read (ref) and may write (mod), either itself or
+ * through the functions it calls. The summaries are found over the
+ * call graph: each function starts with the globals its own code names
+ * and takes in those of its callees until nothing changes, so
+ * recursion is handled like any other cycle.
+ *
+ * An LCall names its callee. An ACall may reach any method, so it is
+ * taken to read and write whatever any method does; the built-in
+ * functions touch no globals. The globals are numbered by their ids,
+ * which are the same in every function's LocationTable.
+ */
+
+#ifndef _H_modref
+#define _H_modref
+
+#include <map>
+#include <string>
+#include "list.h"
+#include "tac.h"
+#include "bitvector.h"
+
+class ModRef {
+    struct Summary {
+      BitVector ref, mod;
+      List<const char*> callees;  // the labels it calls
+      bool callsMethods;          // has an ACall
+    };
+
+    std::map<std::string, Summary> functions; // by label
+    BitVector methodsRef, methodsMod;         // of every method together
+    BitVector none;                           // for the built-ins
+
+  public:
+    ModRef(List<Instruction*> *code, int numGlobals);
+
+         // The globals the function called may read or write
+    const BitVector &Ref(FnCall *call);
+    const BitVector &Mod(FnCall *call);
+};
+
+#endif
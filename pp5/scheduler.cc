@@ -0,0 +1,354 @@
+/* File: scheduler.cc
+ * ------------------
+ * Implementation of the Scheduler class.
+ */
+
+#include "scheduler.h"
+#include <algorithm>
+#include <string.h>
+#include "utility.h"
+
+#define RegBit(r) (uint32_t(1) << (r))
+
+Scheduler::Scheduler(std::vector<MachineInstr> *c, bool d)
+  : code(c), delayed(d), stallsBefore(0), stallsAfter(0), slotsFilled(0),
+    nops(0)
+{
+  latencyAlu = GetLatency("alu", 1);
+  latencyLoad = GetLatency("load", 2);
+  latencyMul = GetLatency("mul", 12);
+  latencyDiv = GetLatency("div", 35);
+}
+
+// Whether control leaves the straight line after instr
+static bool IsBranch(const Mips::MachineInstr &instr)
+{
+  return instr.kind == Mips::Branch || Mips::IsConditionalBranch(instr.kind) ||
+         instr.kind == Mips::CallLabel || instr.kind == Mips::CallReg ||
+         instr.kind == Mips::JumpReg;
+}
+
+// The registers a branch, jump or call itself reads: unlike Uses, not
+// those its target reads later
+static uint32_t BranchOperands(const Mips::MachineInstr &instr)
+{
+  return (RegBit(instr.rs) | RegBit(instr.rt)) & ~RegBit(Mips::zero);
+}
+
+// Whether the assembler makes instr a single machine instruction, so
+// that all of it fits in a delay slot: not so for la, a li or an
+// immediate too wide for 16 bits, nor for mul, div, rem and the set
+// pseudo-instructions (seq, sle, sgt, ...)
+static bool IsSingleInstr(const Mips::MachineInstr &instr)
+{
+  static const char *threeReg[] = { "addu", "subu", "and", "or", "xor",
+                                    "slt", "sltu" };
+  static const char *signedImm[] = { "addiu", "slti", "sltiu" };
+  static const char *unsignedImm[] = { "andi", "ori", "xori" };
+  switch (instr.kind)
+  {
+    case Mips::Move:
+      return true;
+    case Mips::LoadImm:
+      return instr.imm >= -32768 && instr.imm <= 65535;
+    case Mips::StoreWord:
+      return instr.imm >= -32768 && instr.imm <= 32767;
+    case Mips::ThreeReg:
+      for (size_t i = 0; i < sizeof(threeReg) / sizeof(*threeReg); i++)
+        if (!strcmp(instr.name, threeReg[i]))
+          return true;
+      return false;
+    case Mips::TwoRegImm:
+      if (!strcmp(instr.name, "sll"))
+        return true;
+      for (size_t i = 0; i < sizeof(signedImm) / sizeof(*signedImm); i++)
+        if (!strcmp(instr.name, signedImm[i]))
+          return instr.imm >= -32768 && instr.imm <= 32767;
+      for (size_t i = 0; i < sizeof(unsignedImm) / sizeof(*unsignedImm); i++)
+        if (!strcmp(instr.name, unsignedImm[i]))
+          return instr.imm >= 0 && instr.imm <= 65535;
+      return false;
+    default:
+      return false;
+  }
+}
+
+int Scheduler::LatencyOf(const MachineInstr &instr)
+{
+  if (instr.kind == Mips::LoadWord)
+    return latencyLoad;
+  if (instr.kind == Mips::ThreeReg || instr.kind == Mips::TwoRegImm)
+  {
+    if (!strcmp(instr.name, "mul"))
+      return latencyMul;
+    if (!strcmp(instr.name, "div") || !strcmp(instr.name, "rem"))
+      return latencyDiv;
+  }
+  return latencyAlu;
+}
+
+void Scheduler::AddDependence(std::vector<Node> &block, int from, int to,
+                              int latency)
+{
+  block[from].succs.push_back({to, latency});
+  block[to].preds.push_back({from, latency});
+}
+
+// Memory a load or store may touch: the globals (off $gp), the frame
+// (off $fp or $sp) or the heap (off any other register). Decaf has no
+// pointers into the frame or the globals, so these never overlap.
+static int MemoryArea(Mips::Register base)
+{
+  if (base == Mips::gp)
+    return 0;
+  return base == Mips::fp || base == Mips::sp ? 1 : 2;
+}
+
+void Scheduler::Run()
+{
+  scheduled.clear();
+  std::vector<Node> block;
+  int n = code->size(), textStart = 0;
+  for (int i = 0; i < n; i++)
+  {
+    const MachineInstr &instr = (*code)[i];
+    if (instr.kind == Mips::Text || instr.kind == Mips::Deleted)
+      continue;
+    if (instr.kind == Mips::LabelDef)
+    {
+      ScheduleBlock(block, textStart, i);
+      block.clear();
+      Append(instr);
+      textStart = i + 1;
+      continue;
+    }
+    Node node;
+    node.index = i;
+    node.firstText = textStart;
+    node.latency = LatencyOf(instr);
+    node.height = 0;
+    block.push_back(node);
+    textStart = i + 1;
+    if (IsBranch(instr))
+    {
+      ScheduleBlock(block, i + 1, i + 1);
+      block.clear();
+    }
+  }
+  ScheduleBlock(block, textStart, n);
+  if (delayed)
+    SeparateLoads();
+  code->swap(scheduled);
+  PrintDebug("schedule", "%d of %d stall cycles saved, %d delay slots filled, "
+             "%d nops", stallsBefore - stallsAfter, stallsBefore, slotsFilled,
+             nops);
+}
+
+// Schedules the instructions of block, then appends the comments
+// after them, from textStart up to end
+void Scheduler::ScheduleBlock(std::vector<Node> &block, int textStart, int end)
+{
+  int n = block.size();
+
+  // what each instruction waits for: the last write of each register it
+  // reads or writes, the reads since that write of each one it writes,
+  // and the loads and stores it may overlap
+  int lastDef[Mips::NumRegs], numDefs[Mips::NumRegs] = {0};
+  std::vector<int> usesSince[Mips::NumRegs];
+  std::fill(lastDef, lastDef + Mips::NumRegs, -1);
+  struct Access { int node; bool store; Mips::Register base; int version; int offset; };
+  std::vector<Access> accesses;
+  for (int k = 0; k < n; k++)
+  {
+    const MachineInstr &instr = (*code)[block[k].index];
+    if (instr.kind == Mips::LoadWord || instr.kind == Mips::StoreWord)
+    {
+      Access access = {k, instr.kind == Mips::StoreWord, instr.rs,
+                       numDefs[instr.rs], instr.imm};
+      for (auto &other : accesses)
+      {
+        if (!other.store && !access.store)
+          continue;
+        if (MemoryArea(other.base) != MemoryArea(access.base) ||
+            (other.base == access.base && other.version == access.version &&
+             other.offset != access.offset))
+          continue; // different words
+        AddDependence(block, other.node, k, other.store && !access.store ? 1 : 0);
+      }
+      accesses.push_back(access);
+    }
+
+    uint32_t uses = Mips::Uses(instr), defs = Mips::Defs(instr);
+    for (int r = 1; r < Mips::NumRegs; r++)
+      if (uses & RegBit(r))
+      {
+        if (lastDef[r] >= 0)
+          AddDependence(block, lastDef[r], k, block[lastDef[r]].latency);
+        usesSince[r].push_back(k);
+      }
+    for (int r = 1; r < Mips::NumRegs; r++)
+      if (defs & RegBit(r))
+      {
+        if (lastDef[r] >= 0)
+          AddDependence(block, lastDef[r], k, 0);
+        for (auto u : usesSince[r])
+          if (u != k)
+            AddDependence(block, u, k, 0);
+        usesSince[r].clear();
+        lastDef[r] = k;
+        numDefs[r]++;
+      }
+
+    // a branch stays last
+    if (IsBranch(instr))
+      for (int j = 0; j < k; j++)
+        AddDependence(block, j, k, 0);
+  }
+
+  // the longest path from each instruction to the end of the block
+  for (int k = n - 1; k >= 0; k--)
+  {
+    block[k].height = 1;
+    for (auto &s : block[k].succs)
+      block[k].height = std::max(block[k].height, s.latency + block[s.node].height);
+  }
+
+  // Place one instruction per cycle: of those whose predecessors are
+  // placed, one whose operands are ready, the one with the longest path
+  // first; if none is ready, the one ready soonest
+  std::vector<int> waiting(n), earliest(n, 0), ready, order;
+  for (int k = 0; k < n; k++)
+  {
+    waiting[k] = block[k].preds.size();
+    if (!waiting[k])
+      ready.push_back(k);
+  }
+  for (int cycle = 0; !ready.empty(); )
+  {
+    size_t best = 0;
+    for (size_t r = 1; r < ready.size(); r++)
+    {
+      int a = ready[r], b = ready[best];
+      bool aReady = earliest[a] <= cycle, bReady = earliest[b] <= cycle;
+      if (aReady != bReady ? aReady :
+          !aReady && earliest[a] != earliest[b] ? earliest[a] < earliest[b] :
+          block[a].height != block[b].height ? block[a].height > block[b].height :
+          a < b)
+        best = r;
+    }
+    int k = ready[best];
+    ready.erase(ready.begin() + best);
+    int issue = std::max(cycle, earliest[k]);
+    cycle = issue + 1;
+    order.push_back(k);
+    for (auto &s : block[k].succs)
+    {
+      earliest[s.node] = std::max(earliest[s.node], issue + s.latency);
+      if (--waiting[s.node] == 0)
+        ready.push_back(s.node);
+    }
+  }
+  Assert((int) order.size() == n);
+
+  // the order given is kept unless the new one stalls less
+  std::vector<int> given(n);
+  for (int k = 0; k < n; k++)
+    given[k] = k;
+  int before = Stalls(block, given), after = Stalls(block, order);
+  if (after > before)
+  {
+    order = given;
+    after = before;
+  }
+  stallsBefore += before;
+  stallsAfter += after;
+
+  // The delay slot of a branch takes the instruction placed before it,
+  // if the branch does not read what it writes and the assembler makes
+  // it a single machine instruction. A load is never moved there, as
+  // the target might use its result right away, nor anything touching
+  // $ra for a call.
+  int slot = -1;
+  if (delayed && n >= 2 && IsBranch((*code)[block[order[n - 1]].index]))
+  {
+    const MachineInstr &branch = (*code)[block[order[n - 1]].index];
+    const MachineInstr &instr = (*code)[block[order[n - 2]].index];
+    bool isCall = branch.kind == Mips::CallLabel || branch.kind == Mips::CallReg;
+    if (IsSingleInstr(instr) &&
+        !(Mips::Defs(instr) & BranchOperands(branch)) &&
+        !(isCall && ((Mips::Uses(instr) | Mips::Defs(instr)) & RegBit(Mips::ra))))
+      slot = order[n - 2];
+  }
+
+  for (int k = 0; k < n; k++)
+    if (order[k] != slot)
+      AppendNode(block[order[k]]);
+  if (slot >= 0)
+  {
+    AppendNode(block[slot]);
+    slotsFilled++;
+  }
+  else if (delayed && n >= 1 && IsBranch((*code)[block[order[n - 1]].index]))
+    AppendNop();
+
+  for (int i = textStart; i < end; i++)
+    if ((*code)[i].kind == Mips::Text)
+      Append((*code)[i]);
+}
+
+// The cycles lost waiting for operands when the block is issued in
+// the order given
+int Scheduler::Stalls(std::vector<Node> &block, const std::vector<int> &order)
+{
+  std::vector<int> issue(block.size());
+  int prev = -1, stalls = 0;
+  for (auto k : order)
+  {
+    int t = prev + 1;
+    for (auto &p : block[k].preds)
+      t = std::max(t, issue[p.node] + p.latency);
+    stalls += t - prev - 1;
+    issue[k] = t;
+    prev = t;
+  }
+  return stalls;
+}
+
+void Scheduler::AppendNode(const Node &node)
+{
+  for (int i = node.firstText; i < node.index; i++)
+    if ((*code)[i].kind == Mips::Text)
+      Append((*code)[i]);
+  Append((*code)[node.index]);
+}
+
+void Scheduler::AppendNop()
+{
+  MachineInstr nop = {Mips::Nop, "nop", Mips::zero, Mips::zero, Mips::zero,
+                      0, "", ""};
+  Append(nop);
+  nops++;
+}
+
+// With delayed loads the instruction after a load sees the register
+// as it was before, so one that reads it waits behind a nop
+void Scheduler::SeparateLoads()
+{
+  std::vector<MachineInstr> loads;
+  loads.swap(scheduled);
+  int n = loads.size();
+  for (int i = 0; i < n; i++)
+  {
+    Append(loads[i]);
+    if (loads[i].kind != Mips::LoadWord)
+      continue;
+    int j = i + 1;
+    while (j < n && (loads[j].kind == Mips::Text || loads[j].kind == Mips::LabelDef))
+      j++;
+    if (j == n)
+      continue;
+    uint32_t uses = IsBranch(loads[j]) ? BranchOperands(loads[j]) : Mips::Uses(loads[j]);
+    if (uses & RegBit(loads[i].rd))
+      AppendNop();
+  }
+}
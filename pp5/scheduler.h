@@ -0,0 +1,67 @@
+/* File: scheduler.h
+ * -----------------
+ * List scheduling of the machine instructions of a function, one basic
+ * block at a time, for an in-order R2000/R3000 pipeline that issues one
+ * instruction per cycle and stalls when an instruction needs a result
+ * that is not ready yet.
+ *
+ * The instructions of a block and what they depend on (a register
+ * written then read, or read then written, or written twice, and a
+ * store and a load or another store that may touch the same word) form
+ * a graph. Each dependence carries the latency of the instruction it
+ * waits for: the cycles until its result may be used, taken from a
+ * table by the unit that runs it (alu, load, mul, div), which -l can
+ * change. The scheduler places the instructions one cycle at a time,
+ * picking among those whose operands are ready the one with the longest
+ * path to the end of the block, and stalls only when none is ready. A
+ * branch, jump or call stays last in its block.
+ *
+ * With delayed branches, the instruction scheduled right before the
+ * branch moves into its delay slot when the branch does not need it,
+ * and a nop fills the slot otherwise; a nop also goes after a load
+ * whose result the next instruction uses.
+ */
+
+#ifndef _H_scheduler
+#define _H_scheduler
+
+#include <vector>
+#include "mips.h"
+
+class Scheduler {
+    typedef Mips::MachineInstr MachineInstr;
+
+    struct Dependence { int node; int latency; };
+
+         // An instruction of the block, with the comments before it
+    struct Node {
+        int index;            // in code
+        int firstText;        // of the comments, in code
+        int latency;          // of its result
+        int height;           // the longest path from it to the end
+        std::vector<Dependence> preds, succs;
+    };
+
+    std::vector<MachineInstr> *code;
+    bool delayed;
+    int latencyAlu, latencyLoad, latencyMul, latencyDiv;
+    std::vector<MachineInstr> scheduled;
+    int stallsBefore, stallsAfter, slotsFilled, nops;
+
+    int LatencyOf(const MachineInstr &instr);
+    void AddDependence(std::vector<Node> &block, int from, int to, int latency);
+    void ScheduleBlock(std::vector<Node> &block, int textStart, int end);
+    int Stalls(std::vector<Node> &block, const std::vector<int> &order);
+    void Append(const MachineInstr &instr) { scheduled.push_back(instr); }
+    void AppendNode(const Node &node);
+    void AppendNop();
+    void SeparateLoads();
+
+  public:
+    Scheduler(std::vector<MachineInstr> *code, bool delayed);
+
+         // Reorders the instructions in code
+    void Run();
+};
+
+#endif
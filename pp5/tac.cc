@@ -6,15 +6,66 @@
 #include "tac.h"
 #include "mips.h"
 #include <string.h>
+#include <limits.h>
 #include <deque>
 
-Location::Location(Segment s, int o, const char *name) :
-  variableName(strdup(name)), segment(s), offset(o), reg(Mips::zero) {}
+Location::Location(Segment s, int o, const char *name, int i) :
+  variableName(strdup(name)), segment(s), offset(o), reg(Mips::zero),
+  id(i) {}
 
-Instruction::Instruction()
+
+LocationTable::LocationTable(LocationTable *g) : globals(g), numGlobals(0)
+{
+  for (int r = 0; r < Mips::NumRegs; r++)
+    registers[r] = NULL;
+  if (globals)
+  {
+    locations.AppendAll(globals->locations);
+    numGlobals = locations.NumElements();
+  }
+}
+
+Location *LocationTable::Intern(Segment seg, int offset, const char *name)
+{
+  if (globals && seg == gpRelative)
+  {
+    Location *global = globals->Intern(seg, offset, name);
+    Assert(global->GetId() < numGlobals);
+    return global;
+  }
+  auto key = std::make_pair(offset, std::string(name));
+  auto found = byOffsetAndName.find(key);
+  if (found != byOffsetAndName.end())
+    return found->second;
+  Location *loc = new Location(seg, offset, name, locations.NumElements());
+  locations.Append(loc);
+  byOffsetAndName[key] = loc;
+  return loc;
+}
+
+Location *LocationTable::Register(Mips::Register r)
+{
+  if (!registers[r])
+  {
+    char name[8];
+    sprintf(name, "$%d", r);
+    Location *loc = new Location(fpRelative, 0, name,
+                                 locations.NumElements());
+    loc->SetRegister(r);
+    locations.Append(loc);
+    registers[r] = loc;
+  }
+  return registers[r];
+}
+
+// to if var is from, var otherwise; for the Rename methods below
+static Location *Renamed(Location *var, Location *from, Location *to)
+{
+  return var == from ? to : var;
+}
+
+Instruction::Instruction(TacOpcode op) : opcode(op)
 {
-  liveVarsIn = new LiveVars;
-  liveVarsOut = new LiveVars;
 }
 
 void Instruction::Print() {
@@ -28,138 +79,134 @@ void Instruction::Emit(Mips *mips) {
   EmitSpecific(mips);
 }
 
-LiveVars* Instruction::FilterGlobalVars(LiveVars* liveVars)
-{
-  LiveVars* result = new LiveVars;
-  for (auto var : *liveVars)
-  {
-    if (var->GetSegment() == fpRelative)
-    {
-      result->insert(var);
-    }
-  }
-  return result;
-}
-
-
-
 LoadConstant::LoadConstant(Location *d, int v)
-  : dst(d), val(v) {
+  : Instruction(Kind), dst(d), val(v) {
   Assert(dst != NULL);
   sprintf(printed, "%s = %d", dst->GetName(), val);
+  Writes(dst);
 }
 void LoadConstant::EmitSpecific(Mips *mips) {
   mips->EmitLoadConstant(dst, val);
 }
 
-LiveVars* LoadConstant::GetKillVars()
-{
-  return FilterGlobalVars(new LiveVars {dst});
+Instruction *LoadConstant::Rename(Location *from, Location *to) {
+  return dst == from ? new LoadConstant(to, val) : this;
+}
+Instruction *LoadConstant::RenameDst(Location *to) {
+  return new LoadConstant(to, val);
 }
-
-
 
 LoadStringConstant::LoadStringConstant(Location *d, const char *s)
-  : dst(d) {
+  : Instruction(Kind), dst(d) {
   Assert(dst != NULL && s != NULL);
   const char *quote = (*s == '"') ? "" : "\"";
   str = new char[strlen(s) + 2*strlen(quote) + 1];
   sprintf(str, "%s%s%s", quote, s, quote);
   quote = (strlen(str) > 50) ? "...\"" : "";
   sprintf(printed, "%s = %.50s%s", dst->GetName(), str, quote);
+  Writes(dst);
 }
 void LoadStringConstant::EmitSpecific(Mips *mips) {
   mips->EmitLoadStringConstant(dst, str);
 }
 
-LiveVars* LoadStringConstant::GetKillVars()
-{
-  return FilterGlobalVars(new LiveVars {dst});
+Instruction *LoadStringConstant::Rename(Location *from, Location *to) {
+  return dst == from ? new LoadStringConstant(to, str) : this;
+}
+Instruction *LoadStringConstant::RenameDst(Location *to) {
+  return new LoadStringConstant(to, str);
 }
-
-
 
 LoadLabel::LoadLabel(Location *d, const char *l)
-  : dst(d), label(strdup(l)) {
+  : Instruction(Kind), dst(d), label(strdup(l)) {
   Assert(dst != NULL && label != NULL);
   sprintf(printed, "%s = %s", dst->GetName(), label);
+  Writes(dst);
 }
 void LoadLabel::EmitSpecific(Mips *mips) {
   mips->EmitLoadLabel(dst, label);
 }
 
-LiveVars* LoadLabel::GetKillVars()
-{
-  return FilterGlobalVars(new LiveVars {dst});
+Instruction *LoadLabel::Rename(Location *from, Location *to) {
+  return dst == from ? new LoadLabel(to, label) : this;
+}
+Instruction *LoadLabel::RenameDst(Location *to) {
+  return new LoadLabel(to, label);
 }
-
-
 
 Assign::Assign(Location *d, Location *s)
-  : dst(d), src(s) {
+  : Instruction(Kind), dst(d), src(s) {
   Assert(dst != NULL && src != NULL);
   sprintf(printed, "%s = %s", dst->GetName(), src->GetName());
+  Reads(src);
+  Writes(dst);
 }
 void Assign::EmitSpecific(Mips *mips) {
   mips->EmitCopy(dst, src);
 }
 
-LiveVars* Assign::GetKillVars()
-{
-  return FilterGlobalVars(new LiveVars {dst});
+Instruction *Assign::Rename(Location *from, Location *to) {
+  if (dst != from && src != from) return this;
+  return new Assign(Renamed(dst, from, to), Renamed(src, from, to));
 }
-
-LiveVars* Assign::GetGenVars()
-{
-  return FilterGlobalVars(new LiveVars {src});
+Instruction *Assign::RenameDst(Location *to) {
+  return new Assign(to, src);
 }
 
+bool MayAlias(MemoryClass load, int loadOffset,
+              MemoryClass store, int storeOffset) {
+  if (load == AnyMemory || store == AnyMemory)
+    return true;
+  if (load != store)
+    return false;
+  return load != FieldMemory || loadOffset == storeOffset;
+}
 
-
-
-Load::Load(Location *d, Location *s, int off)
-  : dst(d), src(s), offset(off) {
+Load::Load(Location *d, Location *s, int off, bool inv, MemoryClass mem)
+  : Instruction(Kind), dst(d), src(s), offset(off), invariant(inv), memory(mem) {
   Assert(dst != NULL && src != NULL);
   if (offset) 
     sprintf(printed, "%s = *(%s + %d)", dst->GetName(), src->GetName(), offset);
   else
     sprintf(printed, "%s = *(%s)", dst->GetName(), src->GetName());
+  Reads(src);
+  Writes(dst);
 }
 void Load::EmitSpecific(Mips *mips) {
   mips->EmitLoad(dst, src, offset);
 }
 
-LiveVars* Load::GetGenVars()
-{
-  return FilterGlobalVars(new LiveVars {src});
+Instruction *Load::Rename(Location *from, Location *to) {
+  if (dst != from && src != from) return this;
+  return new Load(Renamed(dst, from, to), Renamed(src, from, to), offset,
+                  invariant, memory);
 }
-
-LiveVars* Load::GetKillVars()
-{
-  return FilterGlobalVars(new LiveVars {dst});
+Instruction *Load::RenameDst(Location *to) {
+  return new Load(to, src, offset, invariant, memory);
 }
 
-
-
-Store::Store(Location *d, Location *s, int off)
-  : dst(d), src(s), offset(off) {
+Store::Store(Location *d, Location *s, int off, MemoryClass mem)
+  : Instruction(Kind), dst(d), src(s), offset(off), memory(mem) {
   Assert(dst != NULL && src != NULL);
   if (offset)
     sprintf(printed, "*(%s + %d) = %s", dst->GetName(), offset, src->GetName());
   else
     sprintf(printed, "*(%s) = %s", dst->GetName(), src->GetName());
+  Reads(dst, src);
 }
 void Store::EmitSpecific(Mips *mips) {
   mips->EmitStore(dst, src, offset);
 }
 
-LiveVars* Store::GetGenVars()
-{
-  return FilterGlobalVars(new LiveVars {dst, src});
+Instruction *Store::Rename(Location *from, Location *to) {
+  if (dst != from && src != from) return this;
+  return new Store(Renamed(dst, from, to), Renamed(src, from, to), offset,
+                   memory);
 }
 
  
-const char * const BinaryOp::opName[Mips::NumOps]  = {"+", "-", "*", "/", "%", "==", "<", "&&", "||"};;
+const char * const BinaryOp::opName[Mips::NumOps]  = {"+", "-", "*", "/", "%", "==", "<", "&&", "||",
+                                                      "<=", ">=", "!=", "^", ">"};
 
 Mips::OpCode BinaryOp::OpCodeForName(const char *name) {
   for (int i = 0; i < Mips::NumOps; i++) 
@@ -169,29 +216,64 @@ Mips::OpCode BinaryOp::OpCodeForName(const char *name) {
   return Mips::Add; // can't get here, but compiler doesn't know that
 }
 
+bool BinaryOp::Evaluate(Mips::OpCode code, int a, int b, int *result) {
+  unsigned ua = a, ub = b; // wrapping around, as addu, subu and mul do
+  switch (code) {
+    case Mips::Add:  *result = ua + ub; return true;
+    case Mips::Sub:  *result = ua - ub; return true;
+    case Mips::Mul:  *result = ua * ub; return true;
+    case Mips::Div:
+    case Mips::Mod:
+      if (b == 0 || (a == INT_MIN && b == -1)) return false;
+      *result = code == Mips::Div ? a / b : a % b;
+      return true;
+    case Mips::Eq:   *result = a == b; return true;
+    case Mips::Ne:   *result = a != b; return true;
+    case Mips::Less: *result = a < b; return true;
+    case Mips::Le:   *result = a <= b; return true;
+    case Mips::Gt:   *result = a > b; return true;
+    case Mips::Ge:   *result = a >= b; return true;
+    case Mips::And:  *result = a & b; return true;
+    case Mips::Or:   *result = a | b; return true;
+    case Mips::Xor:  *result = a ^ b; return true;
+    default:         return false;
+  }
+}
+
 BinaryOp::BinaryOp(Mips::OpCode c, Location *d, Location *o1, Location *o2)
-  : code(c), dst(d), op1(o1), op2(o2) {
+  : Instruction(Kind), code(c), dst(d), op1(o1), op2(o2), imm(0) {
   Assert(dst != NULL && op1 != NULL && op2 != NULL);
   Assert(code >= 0 && code < Mips::NumOps);
   sprintf(printed, "%s = %s %s %s", dst->GetName(), op1->GetName(), opName[code], op2->GetName());
+  Reads(op1, op2);
+  Writes(dst);
+}
+BinaryOp::BinaryOp(Mips::OpCode c, Location *d, Location *o1, int i)
+  : Instruction(Kind), code(c), dst(d), op1(o1), op2(NULL), imm(i) {
+  Assert(dst != NULL && op1 != NULL);
+  Assert(Mips::FitsImmediate(code, imm));
+  sprintf(printed, "%s = %s %s %d", dst->GetName(), op1->GetName(), opName[code], imm);
+  Reads(op1);
+  Writes(dst);
 }
 void BinaryOp::EmitSpecific(Mips *mips) {	  
-  mips->EmitBinaryOp(code, dst, op1, op2);
+  if (op2) mips->EmitBinaryOp(code, dst, op1, op2);
+  else mips->EmitBinaryOpImm(code, dst, op1, imm);
 }
 
-LiveVars* BinaryOp::GetGenVars()
-{
-  return FilterGlobalVars(new LiveVars {op1, op2});
+Instruction *BinaryOp::Rename(Location *from, Location *to) {
+  if (dst != from && op1 != from && op2 != from) return this;
+  if (!op2)
+    return new BinaryOp(code, Renamed(dst, from, to), Renamed(op1, from, to), imm);
+  return new BinaryOp(code, Renamed(dst, from, to), Renamed(op1, from, to),
+                      Renamed(op2, from, to));
 }
-
-LiveVars* BinaryOp::GetKillVars()
-{
-  return FilterGlobalVars(new LiveVars {dst});
+Instruction *BinaryOp::RenameDst(Location *to) {
+  if (!op2) return new BinaryOp(code, to, op1, imm);
+  return new BinaryOp(code, to, op1, op2);
 }
 
-
-
-Label::Label(const char *l) : label(strdup(l)) {
+Label::Label(const char *l) : Instruction(Kind), label(strdup(l)) {
   Assert(label != NULL);
   *printed = '\0';
 }
@@ -204,7 +286,7 @@ void Label::EmitSpecific(Mips *mips) {
 
 
  
-Goto::Goto(const char *l) : label(strdup(l)) {
+Goto::Goto(const char *l) : Instruction(Kind), label(strdup(l)) {
   Assert(label != NULL);
   sprintf(printed, "Goto %s", label);
 }
@@ -214,54 +296,65 @@ void Goto::EmitSpecific(Mips *mips) {
 
 
 IfZ::IfZ(Location *te, const char *l)
-   : test(te), label(strdup(l)) {
+   : Instruction(Kind), test(te), label(strdup(l)) {
   Assert(test != NULL && label != NULL);
   sprintf(printed, "IfZ %s Goto %s", test->GetName(), label);
+  Reads(test);
 }
 void IfZ::EmitSpecific(Mips *mips) {	  
   mips->EmitIfZ(test, label);
 }
 
-LiveVars* IfZ::GetGenVars()
-{
-  return FilterGlobalVars(new LiveVars {test});
+Instruction *IfZ::Rename(Location *from, Location *to) {
+  return test == from ? new IfZ(to, label) : this;
 }
 
+IfRel::IfRel(Mips::OpCode c, Location *o1, Location *o2, const char *l)
+  : Instruction(Kind), code(c), op1(o1), op2(o2), imm(0), label(strdup(l)) {
+  Assert(op1 != NULL && op2 != NULL && label != NULL);
+  sprintf(printed, "IfRel %s %s %s Goto %s", op1->GetName(),
+          BinaryOp::opName[code], op2->GetName(), label);
+  Reads(op1, op2);
+}
+IfRel::IfRel(Mips::OpCode c, Location *o1, int i, const char *l)
+  : Instruction(Kind), code(c), op1(o1), op2(NULL), imm(i), label(strdup(l)) {
+  Assert(op1 != NULL && label != NULL);
+  sprintf(printed, "IfRel %s %s %d Goto %s", op1->GetName(),
+          BinaryOp::opName[code], imm, label);
+  Reads(op1);
+}
+void IfRel::EmitSpecific(Mips *mips) {
+  if (op2) mips->EmitIfRel(code, op1, op2, label);
+  else mips->EmitIfRelImm(code, op1, imm, label);
+}
 
+Instruction *IfRel::Rename(Location *from, Location *to) {
+  if (op1 != from && op2 != from) return this;
+  if (!op2) return new IfRel(code, Renamed(op1, from, to), imm, label);
+  return new IfRel(code, Renamed(op1, from, to), Renamed(op2, from, to), label);
+}
 
-BeginFunc::BeginFunc(List<Location*> *f) {
+BeginFunc::BeginFunc(List<Location*> *f) : Instruction(Kind) {
   sprintf(printed,"BeginFunc (unassigned)");
   frameSize = -555; // used as sentinel to recognized unassigned value
   formals = f;
+  locations = NULL;
+  interferenceGraph = NULL;
+  maxArgs = 0;
 }
 void BeginFunc::SetFrameSize(int numBytesForAllLocalsAndTemps) {
   frameSize = numBytesForAllLocalsAndTemps; 
   sprintf(printed,"BeginFunc %d", frameSize);
 }
 void BeginFunc::EmitSpecific(Mips *mips) {
-  mips->EmitBeginFunction(frameSize);
-  /* pp5: need to load all parameters to the allocated registers.
+  mips->EmitBeginFunction(frameSize, &calleeSaved, maxArgs * 4);
+  /* pp5: need to move all parameters to the allocated registers.
    */
   for (int i = 0; i < formals->NumElements(); i++)
-  {
-    auto loc = formals->Nth(i);
-    if (loc->GetRegister())
-      mips->FillRegister(loc, loc->GetRegister());
-  }
+    mips->EmitFormal(formals->Nth(i), i);
 }
 
-// LiveVars* BeginFunc::GetGenVars()
-// {
-//   LiveVars *liveVars = new LiveVars;
-//   for (int i = 0; i < formals->NumElements(); i++)
-//   {
-//     liveVars->insert(formals->Nth(i));
-//   }
-//   return FilterGlobalVars(liveVars);
-// }
-
-
-EndFunc::EndFunc() : Instruction() {
+EndFunc::EndFunc() : Instruction(Kind) {
   sprintf(printed, "EndFunc");
 }
 void EndFunc::EmitSpecific(Mips *mips) {
@@ -271,62 +364,62 @@ void EndFunc::EmitSpecific(Mips *mips) {
 
 
  
-Return::Return(Location *v) : val(v) {
+Return::Return(Location *v) : Instruction(Kind), val(v) {
   sprintf(printed, "Return %s", val? val->GetName() : "");
+  Reads(val);
 }
 void Return::EmitSpecific(Mips *mips) {	  
   mips->EmitReturn(val);
 }
 
-LiveVars* Return::GetGenVars()
-{
-  if (val)
-    return FilterGlobalVars(new LiveVars {val});
-  else
-    return new LiveVars;
+Instruction *Return::Rename(Location *from, Location *to) {
+  return (val && val == from) ? new Return(to) : this;
 }
 
-
-PushParam::PushParam(Location *p)
-  :  param(p) {
+PushParam::PushParam(Location *p, int i)
+  :  Instruction(Kind), param(p), index(i) {
   Assert(param != NULL);
   sprintf(printed, "PushParam %s", param->GetName());
+  Reads(param);
 }
 void PushParam::EmitSpecific(Mips *mips) {
-  mips->EmitParam(param);
+  mips->EmitParam(param, index);
 } 
 
-LiveVars* PushParam::GetGenVars()
-{
-  return FilterGlobalVars(new LiveVars {param});
-}
-
-
-
 PopParams::PopParams(int nb)
-  :  numBytes(nb) {
+  :  Instruction(Kind), numBytes(nb) {
   sprintf(printed, "PopParams %d", numBytes);
 }
+
+Instruction *PushParam::Rename(Location *from, Location *to) {
+  return param == from ? new PushParam(to, index) : this;
+}
 void PopParams::EmitSpecific(Mips *mips) {
-  mips->EmitPopParams(numBytes);
+  // nothing to do: the arguments are in registers or in the caller's
+  // outgoing area, and $sp stays where it is
 } 
 
 
+FnCall::FnCall(TacOpcode op, int n) : Instruction(op), numArgs(n) {
+  liveVarsAcross = NULL; // filled in when the interference graph is built
+}
+
 void FnCall::EmitSpecific(Mips *mips) {
   /* pp5: need to save registers before a function call
-   * and restore them back after the call.
+   * and restore them back after the call. Only the caller-saved
+   * ones: the callee keeps the $s registers as they were.
    */
-  for (auto var : *liveVarsIn)
+  for (auto var : *liveVarsAcross)
   {
-    if (var->GetRegister())
+    if (var->GetRegister() && !Mips::IsCalleeSaved(var->GetRegister()))
     {
       mips->SpillRegister(var, var->GetRegister());
     }
   }
   EmitCall(mips);
-  for (auto var : *liveVarsIn)
+  for (auto var : *liveVarsAcross)
   {
-    if (var->GetRegister())
+    if (var->GetRegister() && !Mips::IsCalleeSaved(var->GetRegister()))
     {
       mips->FillRegister(var, var->GetRegister());
     }
@@ -334,49 +427,49 @@ void FnCall::EmitSpecific(Mips *mips) {
 }
 
 
-LCall::LCall(const char *l, Location *d)
-  :  label(strdup(l)), dst(d) {
+LCall::LCall(const char *l, Location *d, int n)
+  :  FnCall(Kind, n), label(strdup(l)), dst(d) {
   sprintf(printed, "%s%sLCall %s", dst? dst->GetName(): "", dst?" = ":"", label);
+  Writes(dst);
 }
 void LCall::EmitCall(Mips *mips) {
   mips->EmitLCall(dst, label);
 }
 
-LiveVars* LCall::GetKillVars()
-{
-  if (dst)
-    return FilterGlobalVars(new LiveVars {dst});
-  else
-    return new LiveVars;
+Instruction *LCall::Rename(Location *from, Location *to) {
+  return (dst && dst == from) ? new LCall(label, to, numArgs) : this;
+}
+Instruction *LCall::RenameDst(Location *to) {
+  return dst ? new LCall(label, to, numArgs) : this;
 }
 
-
-ACall::ACall(Location *ma, Location *d)
-  : dst(d), methodAddr(ma) {
+ACall::ACall(Location *ma, Location *d, int n)
+  : FnCall(Kind, n), dst(d), methodAddr(ma) {
   Assert(methodAddr != NULL);
   sprintf(printed, "%s%sACall %s", dst? dst->GetName(): "", dst?" = ":"",
 	    methodAddr->GetName());
+  Reads(methodAddr);
+  Writes(dst);
 }
 void ACall::EmitCall(Mips *mips) {
   mips->EmitACall(dst, methodAddr);
 } 
 
-LiveVars* ACall::GetKillVars()
-{
-  if (dst)
-    return FilterGlobalVars(new LiveVars {dst});
-  else
-    return new LiveVars;
-}
-
-
-
 VTable::VTable(const char *l, List<const char *> *m)
-  : methodLabels(m), label(strdup(l)) {
+  : Instruction(Kind), methodLabels(m), label(strdup(l)) {
   Assert(methodLabels != NULL && label != NULL);
   sprintf(printed, "VTable for class %s", l);
 }
 
+Instruction *ACall::Rename(Location *from, Location *to) {
+  if (dst != from && methodAddr != from) return this;
+  return new ACall(Renamed(methodAddr, from, to), Renamed(dst, from, to),
+                   numArgs);
+}
+Instruction *ACall::RenameDst(Location *to) {
+  return dst ? new ACall(methodAddr, to, numArgs) : this;
+}
+
 void VTable::Print() {
   printf("VTable %s =\n", label);
   for (int i = 0; i < methodLabels->NumElements(); i++) 
@@ -387,4 +480,34 @@ void VTable::EmitSpecific(Mips *mips) {
   mips->EmitVTable(label, methodLabels);
 }
 
+Phi::Phi(Location *d, int n) : Instruction(Kind), dst(d), numArgs(n) {
+  Assert(dst != NULL);
+  args = (Location **) compilationArena.Allocate(numArgs * sizeof(Location*));
+  for (int i = 0; i < numArgs; i++)
+    args[i] = dst;
+  *printed = '\0';
+  Writes(dst);
+}
+void Phi::Print() {
+  printf("\t%s = Phi(", dst->GetName());
+  for (int i = 0; i < numArgs; i++)
+    printf("%s%s", i ? ", " : "", args[i]->GetName());
+  printf(") ;\n");
+}
+void Phi::EmitSpecific(Mips *mips) {
+  Failure("Phi %s left in the code emitted", dst->GetName());
+}
+
+Instruction *Phi::Rename(Location *from, Location *to) {
+  Phi *renamed = new Phi(Renamed(dst, from, to), numArgs);
+  for (int i = 0; i < numArgs; i++)
+    renamed->args[i] = Renamed(args[i], from, to);
+  return renamed;
+}
 
+Instruction *Phi::RenameDst(Location *to) {
+  Phi *renamed = new Phi(to, numArgs);
+  for (int i = 0; i < numArgs; i++)
+    renamed->args[i] = args[i];
+  return renamed;
+}
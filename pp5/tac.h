@@ -25,9 +25,13 @@
 
 #include "list.h" // for VTable
 #include "mips.h"
+#include "bitvector.h"
+#include "arena.h"
 #include <set>
 #include <cstring>
 #include <map>
+#include <string>
+#include <utility>
 
 
     // A Location object is used to identify the operands to the
@@ -52,55 +56,199 @@ class Location
     // A "zero" indicates that no register has been allocated.
     Mips::Register reg;
 
+    // The number given to this location by the LocationTable that
+    // created it, -1 if it was not created by one (class fields).
+    int id;
 	  
   public:
-    Location(Segment seg, int offset, const char *name);
+    Location(Segment seg, int offset, const char *name, int id = -1);
+
+    // Locations last the whole compilation, so they live in its arena
+    static void *operator new(size_t size) { return compilationArena.Allocate(size); }
+    static void operator delete(void *) {}
 
     const char *GetName()           { return variableName; }
     Segment GetSegment()            { return segment; }
     int GetOffset()                 { return offset; }
+    void SetOffset(int o)           { offset = o; } // when packing the frame
+    int GetId()                     { return id; }
     void SetRegister(Mips::Register r)    { reg = r; }
     Mips::Register GetRegister()          { return reg; }
 
 };
 
 struct CompareLocationPtr {
-  bool operator() (Location* lhs, Location* rhs)
+  bool operator() (Location* lhs, Location* rhs) const
   {
-    if (strcmp(lhs->GetName(), rhs->GetName()) != 0) {
-      return strcmp(lhs->GetName(), rhs->GetName()) < 0;
-    } else if (lhs->GetSegment() != rhs->GetSegment()) {
-      return lhs->GetSegment() < rhs->GetSegment();
-    } else {
-      return lhs->GetOffset() < rhs->GetOffset();
-    }
+    return lhs->GetId() < rhs->GetId();
+  }
+};
+
+struct HashLocationPtr {
+  size_t operator() (Location* loc) const
+  {
+    return loc->GetId();
   }
 };
 
-using LiveVars = std::set<Location*, CompareLocationPtr>;
-using InterferenceGraph = std::map<Location*, std::set<Location*, CompareLocationPtr>, CompareLocationPtr>;
 
+  // Locations are interned. Each function has a LocationTable that
+  // creates all of its Locations and numbers them 0, 1, 2, ...; asking
+  // for the same (segment, offset, name) twice gives back the same
+  // Location. The global variables live in a table of their own whose
+  // entries every function table starts with, so a function's table
+  // numbers every Location its code can name. Equality, ordering and
+  // hashing of Locations are therefore integer operations, and the
+  // analyses keep flat arrays and BitVectors indexed by GetId().
+class LocationTable {
+    LocationTable *globals;    // NULL for the table of globals itself
+    int numGlobals;            // entries copied from globals
+    List<Location*> locations; // indexed by id
+    std::map<std::pair<int, std::string>, Location*> byOffsetAndName;
+    Location *registers[Mips::NumRegs];
+
+  public:
+    LocationTable(LocationTable *globals = NULL);
+
+         // Returns the Location for the given variable, creating it
+         // the first time. All globals must be interned before the
+         // first function table is created.
+    Location *Intern(Segment seg, int offset, const char *name);
+
+         // Returns the Location standing for the machine register r in
+         // register allocation, creating it the first time. It already
+         // has r for its register and is never an instruction operand.
+    Location *Register(Mips::Register r);
+    bool IsRegister(Location *loc)
+        { return registers[loc->GetRegister()] == loc; }
+
+    int NumElements()     { return locations.NumElements(); }
+    Location *Nth(int id) { return locations.Nth(id); }
+};
+
+
+  // The variables an instruction reads (or writes): no TAC instruction
+  // names more than three, so they are kept inline and asking for them
+  // allocates nothing. Globals are dropped and duplicates merged as the
+  // list is built, since only fpRelative variables take part in
+  // liveness and register allocation; a list of the globals instead is
+  // made by giving gpRelative for the segment.
+class VarList {
+  public:
+    static const int MaxVars = 3;
+
+  private:
+    Location *vars[MaxVars];
+    int numVars;
+    Segment segment;  // of the variables kept
+
+  public:
+    VarList(Location *a = NULL, Location *b = NULL, Location *c = NULL,
+            Segment seg = fpRelative)
+      : numVars(0), segment(seg) { Add(a); Add(b); Add(c); }
+
+    void Add(Location *loc)
+        { if (!loc || loc->GetSegment() != segment) return;
+          for (int i = 0; i < numVars; i++)
+            if (vars[i] == loc) return;
+          Assert(numVars < MaxVars);
+          vars[numVars++] = loc; }
+
+    int NumElements() const    { return numVars; }
+    Location *Nth(int i) const { Assert(i >= 0 && i < numVars); return vars[i]; }
+    bool Contains(Location *loc) const
+        { for (int i = 0; i < numVars; i++)
+            if (vars[i] == loc) return true;
+          return false; }
+    Location *const *begin() const { return vars; }
+    Location *const *end() const   { return vars + numVars; }
+};
+
+
+
+  // A set of live variables of one function. It is a BitVector over
+  // the ids of the function's LocationTable, so that the liveness
+  // fixpoint works a word at a time; iterating over it yields the
+  // Locations themselves.
+class LiveVars {
+    LocationTable *locations; // the function's locations
+    BitVector bits;
+
+  public:
+    LiveVars(LocationTable *locs)
+      : locations(locs), bits(locs->NumElements()) {}
+
+    void Insert(Location *loc)   { bits.Set(loc->GetId()); }
+    void Erase(Location *loc)    { bits.Reset(loc->GetId()); }
+    bool Contains(Location *loc) { return bits.Test(loc->GetId()); }
+    int NumElements() const      { return bits.Count(); }
+    BitVector &GetBits()         { return bits; }
+
+    class Iterator {
+        const LiveVars *set;
+        int i;
+      public:
+        Iterator(const LiveVars *s, int n) : set(s), i(n) {}
+        Location *operator*() const { return set->locations->Nth(i); }
+        Iterator &operator++() { i = set->bits.NextSetBit(i + 1); return *this; }
+        bool operator!=(const Iterator &other) const { return i != other.i; }
+    };
+    Iterator begin() const { return Iterator(this, bits.NextSetBit(0)); }
+    Iterator end() const   { return Iterator(this, -1); }
+};
+
+
+  // Every instruction is tagged with the opcode of its class, so passes
+  // can tell instructions apart with a switch or TacCast (below) rather
+  // than a dynamic_cast per test. LCall and ACall are both FnCalls.
+typedef enum { TacLoadConstant, TacLoadStringConstant, TacLoadLabel,
+               TacAssign, TacLoad, TacStore, TacBinaryOp, TacLabel,
+               TacGoto, TacIfZ, TacIfRel, TacBeginFunc, TacEndFunc, TacReturn,
+               TacPushParam, TacPopParams, TacLCall, TacACall, TacVTable,
+               TacPhi, NumTacOpcodes } TacOpcode;
 
   // base class from which all Tac instructions derived
   // has the interface for the 2 polymorphic messages: Print & Emit
   
 class Instruction {
     protected:
+        TacOpcode opcode;
         char printed[128];
 	  
     public:
-  Instruction();
+  Instruction(TacOpcode op);
+  TacOpcode GetOpcode() { return opcode; }
+  bool IsCall() { return opcode == TacLCall || opcode == TacACall; }
+  bool IsBlockEnd()  // control does not just fall through to the next
+      { return opcode == TacIfZ || opcode == TacIfRel || opcode == TacGoto
+            || opcode == TacReturn || opcode == TacEndFunc; }
+  // as are the instructions
+  static void *operator new(size_t size) { return compilationArena.Allocate(size); }
+  static void operator delete(void *) {}
 	virtual void Print();
 	virtual void EmitSpecific(Mips *mips) = 0;
 	virtual void Emit(Mips *mips);
-  virtual LiveVars* GetGenVars() { return new LiveVars; }
-  virtual LiveVars* GetKillVars() { return new LiveVars; }
-  LiveVars* FilterGlobalVars(LiveVars* liveVars);
-
-  List<Instruction*> previous; // previous instructions
-  List<Instruction*> next; // next instructions
-  LiveVars* liveVarsIn; // live variables at the beginning of the instruction
-  LiveVars* liveVarsOut; // live variables at the end of the instruction
+  const VarList &GetGenVars() { return genVars; }   // variables read
+  const VarList &GetKillVars() { return killVars; } // variables written
+  const VarList &GetGlobalsRead()    { return globalsRead; }
+  const VarList &GetGlobalsWritten() { return globalsWritten; }
+  // Returns the instruction with every use of from replaced by to: a
+  // new instruction if from occurs in it, this one otherwise
+  virtual Instruction *Rename(Location *from, Location *to) { return this; }
+  // Returns the instruction writing to instead: a new one, or this one
+  // if it writes nothing
+  virtual Instruction *RenameDst(Location *to) { return this; }
+
+    protected:
+  VarList genVars, killVars; // set by each constructor
+  VarList globalsRead, globalsWritten; // likewise, for the globals
+
+  // For the constructors: the operands read and the one written
+  void Reads(Location *a, Location *b = NULL)
+      { genVars = VarList(a, b); globalsRead = VarList(a, b, NULL, gpRelative); }
+  void Writes(Location *dst)
+      { killVars = VarList(dst); globalsWritten = VarList(dst, NULL, NULL, gpRelative); }
+
 };
 
   
@@ -118,6 +266,7 @@ class Instruction {
   class Label;
   class Goto;
   class IfZ;
+  class IfRel;
   class BeginFunc;
   class EndFunc;
   class Return;
@@ -126,6 +275,10 @@ class Instruction {
   class LCall;
   class ACall;
   class VTable;
+  class Phi;
+
+  class BasicBlock;
+  class InterferenceGraph;
 
 
 
@@ -134,55 +287,99 @@ class LoadConstant: public Instruction {
     Location *dst;
     int val;
   public:
+    static const TacOpcode Kind = TacLoadConstant;
     LoadConstant(Location *dst, int val);
     void EmitSpecific(Mips *mips);
-    LiveVars* GetKillVars() override;
+    Location *GetDst() { return dst; }
+    int GetValue() { return val; }
+    Instruction *Rename(Location *from, Location *to) override;
+    Instruction *RenameDst(Location *to) override;
 };
 
 class LoadStringConstant: public Instruction {
     Location *dst;
     char *str;
   public:
+    static const TacOpcode Kind = TacLoadStringConstant;
     LoadStringConstant(Location *dst, const char *s);
     void EmitSpecific(Mips *mips);
-    LiveVars* GetKillVars() override;
+    Instruction *Rename(Location *from, Location *to) override;
+    Instruction *RenameDst(Location *to) override;
 };
     
 class LoadLabel: public Instruction {
     Location *dst;
     const char *label;
   public:
+    static const TacOpcode Kind = TacLoadLabel;
     LoadLabel(Location *dst, const char *label);
     void EmitSpecific(Mips *mips);
-    LiveVars* GetKillVars() override;
+    Location *GetDst() { return dst; }
+    const char *GetLabel() { return label; }
+    Instruction *Rename(Location *from, Location *to) override;
+    Instruction *RenameDst(Location *to) override;
 };
 
 class Assign: public Instruction {
     Location *dst, *src;
   public:
+    static const TacOpcode Kind = TacAssign;
     Assign(Location *dst, Location *src);
     void EmitSpecific(Mips *mips);
-    LiveVars* GetGenVars() override;
-    LiveVars* GetKillVars() override;
+    Location *GetDst() { return dst; }
+    Location *GetSrc() { return src; }
+    Instruction *Rename(Location *from, Location *to) override;
+    Instruction *RenameDst(Location *to) override;
 };
 
+  // Which words a load or store may touch. Decaf's types keep apart the
+  // fields of objects (which only the same offset may share), the
+  // elements of arrays of different element types, and the words an
+  // allocation starts with: its vtable or its length, written once
+  // before anything can read them. AnyMemory may be any word at all.
+typedef enum { AnyMemory, HeaderMemory, FieldMemory, IntElement,
+               BoolElement, StringElement, ObjectElement, ArrayElement
+             } MemoryClass;
+
+  // Whether a load of the one and a store of the other may touch the
+  // same word
+bool MayAlias(MemoryClass load, int loadOffset,
+              MemoryClass store, int storeOffset);
+
+  // An invariant load reads a word nothing writes once its address is
+  // known: an array's length, an object's vtable or a method's address
 class Load: public Instruction {
     Location *dst, *src;
     int offset;
+    bool invariant;
+    MemoryClass memory;
   public:
-    Load(Location *dst, Location *src, int offset = 0);
+    static const TacOpcode Kind = TacLoad;
+    Load(Location *dst, Location *src, int offset = 0, bool invariant = false,
+         MemoryClass memory = AnyMemory);
     void EmitSpecific(Mips *mips);
-    LiveVars* GetKillVars() override;
-    LiveVars* GetGenVars() override;
+    Location *GetDst() { return dst; }
+    Location *GetSrc() { return src; }
+    int GetOffset() { return offset; }
+    bool IsInvariant() { return invariant; }
+    MemoryClass GetMemory() { return memory; }
+    Instruction *Rename(Location *from, Location *to) override;
+    Instruction *RenameDst(Location *to) override;
 };
 
 class Store: public Instruction {
     Location *dst, *src;
     int offset;
+    MemoryClass memory;
   public:
-    Store(Location *d, Location *s, int offset = 0);
+    static const TacOpcode Kind = TacStore;
+    Store(Location *d, Location *s, int offset = 0, MemoryClass memory = AnyMemory);
     void EmitSpecific(Mips *mips);
-    LiveVars* GetGenVars() override;
+    Location *GetDst() { return dst; }
+    Location *GetSrc() { return src; }
+    int GetOffset() { return offset; }
+    MemoryClass GetMemory() { return memory; }
+    Instruction *Rename(Location *from, Location *to) override;
 };
 
 class BinaryOp: public Instruction {
@@ -190,20 +387,34 @@ class BinaryOp: public Instruction {
   public:
     static const char * const opName[Mips::NumOps];
     static Mips::OpCode OpCodeForName(const char *name);
+         // Computes a op b into result as the emitted code would, unless
+         // it would not give one (dividing by zero, or INT_MIN by -1);
+         // additions, subtractions and products wrap around
+    static bool Evaluate(Mips::OpCode code, int a, int b, int *result);
+    static const TacOpcode Kind = TacBinaryOp;
     
   protected:
     Mips::OpCode code;
-    Location *dst, *op1, *op2;
+    Location *dst, *op1, *op2;  // op2 is NULL in the immediate form
+    int imm;
   public:
     BinaryOp(Mips::OpCode c, Location *dst, Location *op1, Location *op2);
+         // The immediate form, with a constant as second operand
+    BinaryOp(Mips::OpCode c, Location *dst, Location *op1, int imm);
     void EmitSpecific(Mips *mips);
-    LiveVars* GetGenVars() override;
-    LiveVars* GetKillVars() override;
+    Mips::OpCode GetCode() { return code; }
+    Location *GetDst() { return dst; }
+    Location *GetOp1() { return op1; }
+    Location *GetOp2() { return op2; }
+    int GetImmediate() { return imm; }
+    Instruction *Rename(Location *from, Location *to) override;
+    Instruction *RenameDst(Location *to) override;
 };
 
 class Label: public Instruction {
     const char *label;
   public:
+    static const TacOpcode Kind = TacLabel;
     Label(const char *label);
     void Print();
     void EmitSpecific(Mips *mips);
@@ -213,6 +424,7 @@ class Label: public Instruction {
 class Goto: public Instruction {
     const char *label;
   public:
+    static const TacOpcode Kind = TacGoto;
     Goto(const char *label);
     void EmitSpecific(Mips *mips);
     const char *GetLabel() { return label; }
@@ -222,27 +434,58 @@ class IfZ: public Instruction {
     Location *test;
     const char *label;
   public:
+    static const TacOpcode Kind = TacIfZ;
     IfZ(Location *test, const char *label);
     void EmitSpecific(Mips *mips);
+    Instruction *Rename(Location *from, Location *to) override;
+    Location *GetTest() { return test; }
+    const char *GetLabel() { return label; }
+};
+
+  // Branches if op1 compares to op2 (or the constant imm, when op2 is
+  // NULL) as code says: Eq, Ne, Less, Le, Gt or Ge
+class IfRel: public Instruction {
+    Mips::OpCode code;
+    Location *op1, *op2;
+    int imm;
+    const char *label;
+  public:
+    static const TacOpcode Kind = TacIfRel;
+    IfRel(Mips::OpCode code, Location *op1, Location *op2, const char *label);
+    IfRel(Mips::OpCode code, Location *op1, int imm, const char *label);
+    void EmitSpecific(Mips *mips);
+    Instruction *Rename(Location *from, Location *to) override;
+    Mips::OpCode GetCode() { return code; }
+    Location *GetOp1() { return op1; }
+    Location *GetOp2() { return op2; }
+    int GetImmediate() { return imm; }
     const char *GetLabel() { return label; }
-    LiveVars* GetGenVars() override;
 };
 
 class BeginFunc: public Instruction {
     int frameSize;
     List<Location*> *formals;
   public:
+    static const TacOpcode Kind = TacBeginFunc;
     BeginFunc(List<Location*> *f);
     // used to backpatch the instruction with frame size once known
     void SetFrameSize(int numBytesForAllLocalsAndTemps);
     void EmitSpecific(Mips *mips);
-    // LiveVars* GetGenVars() override;
-
-    InterferenceGraph interferenceGraph;
+    List<Location*> *GetFormals() { return formals; }
+    int GetFrameSize() { return frameSize; }
+
+    LocationTable *locations; // the function's locations
+    List<BasicBlock*> blocks; // the function's CFG, entry block first
+    InterferenceGraph *interferenceGraph; // built for register allocation
+    List<Location*> spilled;    // kept in memory by the register allocator
+    List<Location*> spillTemps; // short live ranges made for the spills
+    List<Mips::Register> calleeSaved; // the $s registers it uses
+    int maxArgs; // the most arguments any of its calls passes
 };
 
 class EndFunc: public Instruction {
   public:
+    static const TacOpcode Kind = TacEndFunc;
     EndFunc();
     void EmitSpecific(Mips *mips);
 };
@@ -250,57 +493,186 @@ class EndFunc: public Instruction {
 class Return: public Instruction {
     Location *val;
   public:
+    static const TacOpcode Kind = TacReturn;
     Return(Location *val);
     void EmitSpecific(Mips *mips);
-    LiveVars* GetGenVars() override;
+    Instruction *Rename(Location *from, Location *to) override;
 };   
 
 class PushParam: public Instruction {
     Location *param;
+    int index;   // of the argument, 0 for the first (or "this")
   public:
-    PushParam(Location *param);
+    static const TacOpcode Kind = TacPushParam;
+    PushParam(Location *param, int index);
+    int GetIndex() { return index; }
     void EmitSpecific(Mips *mips);
-    LiveVars* GetGenVars() override;
+    Instruction *Rename(Location *from, Location *to) override;
 }; 
 
 class PopParams: public Instruction {
     int numBytes;
   public:
+    static const TacOpcode Kind = TacPopParams;
     PopParams(int numBytesOfParamsToRemove);
     void EmitSpecific(Mips *mips);
 }; 
 
 class FnCall: public Instruction {
+  protected:
+    int numArgs; // pushed by the PushParams right before the call
   public:
+    FnCall(TacOpcode op, int numArgs);
     void EmitSpecific(Mips *mips);
     virtual void EmitCall(Mips *mips) = 0;
+    int GetNumArgs() { return numArgs; }
+
+    LiveVars* liveVarsAcross; // variables live across the call, saved around it
 };
 
 class LCall: public FnCall {
     const char *label;
     Location *dst;
   public:
-    LCall(const char *labe, Location *result);
+    static const TacOpcode Kind = TacLCall;
+    LCall(const char *labe, Location *result, int numArgs);
+    const char *GetLabel() { return label; }
     void EmitCall(Mips *mips) override;
-    LiveVars* GetKillVars() override;
+    Instruction *Rename(Location *from, Location *to) override;
+    Instruction *RenameDst(Location *to) override;
 };
 
 class ACall: public FnCall {
     Location *dst, *methodAddr;
   public:
-    ACall(Location *meth, Location *result);
+    static const TacOpcode Kind = TacACall;
+    ACall(Location *meth, Location *result, int numArgs);
     void EmitCall(Mips *mips) override;
-    LiveVars* GetKillVars() override;
+    Instruction *Rename(Location *from, Location *to) override;
+    Instruction *RenameDst(Location *to) override;
 };
 
 class VTable: public Instruction {
     List<const char *> *methodLabels;
     const char *label;
  public:
+    static const TacOpcode Kind = TacVTable;
     VTable(const char *labelForTable, List<const char *> *methodLabels);
     void Print();
     void EmitSpecific(Mips *mips);
 };
 
+  // dst = Phi(args): at the head of a block, in SSA form only, takes the
+  // argument of the predecessor control came from; args are in the
+  // order of the block's preds. Phis are never emitted: leaving SSA
+  // turns them into copies in the predecessors. The args are not in
+  // GetGenVars, as each is read at the end of its predecessor rather
+  // than in the block.
+class Phi: public Instruction {
+    Location *dst;
+    Location **args;
+    int numArgs;
+  public:
+    static const TacOpcode Kind = TacPhi;
+    Phi(Location *dst, int numArgs);
+    void Print();
+    void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    int NumArgs() { return numArgs; }
+    Location *GetArg(int i) { Assert(i >= 0 && i < numArgs); return args[i]; }
+    void SetArg(int i, Location *arg) { Assert(i >= 0 && i < numArgs); args[i] = arg; }
+    Instruction *Rename(Location *from, Location *to) override;
+    Instruction *RenameDst(Location *to) override;
+};
+
+
+
+  // TacCast<T>(tac) returns tac as a T* if it is an instruction of
+  // class T and NULL otherwise, like dynamic_cast but by opcode.
+template <class T> T *TacCast(Instruction *tac)
+{
+  return (tac && tac->GetOpcode() == T::Kind) ? static_cast<T*>(tac) : NULL;
+}
+
+template <> inline FnCall *TacCast<FnCall>(Instruction *tac)
+{
+  return (tac && tac->IsCall()) ? static_cast<FnCall*>(tac) : NULL;
+}
+
+
+  // Base for passes that treat instruction classes differently. A pass
+  // derives from TacVisitor<Pass, Result> and defines Visit methods
+  // for the classes it cares about; Visit(tac) switches on the opcode
+  // and calls the most specific one (LCall and ACall fall back to
+  // VisitFnCall, everything to VisitInstruction), with no virtual
+  // calls and no RTTI. For example
+  //
+  //   class CountCalls : public TacVisitor<CountCalls> {
+  //     public:
+  //       int n = 0;
+  //       void VisitFnCall(FnCall *tac) { n++; }
+  //   };
+template <class Pass, class Result = void>
+class TacVisitor {
+    Pass *Self() { return static_cast<Pass*>(this); }
+
+  public:
+    Result Visit(Instruction *tac)
+    {
+      switch (tac->GetOpcode())
+      {
+        case TacLoadConstant:
+          return Self()->VisitLoadConstant(static_cast<LoadConstant*>(tac));
+        case TacLoadStringConstant:
+          return Self()->VisitLoadStringConstant(static_cast<LoadStringConstant*>(tac));
+        case TacLoadLabel:
+          return Self()->VisitLoadLabel(static_cast<LoadLabel*>(tac));
+        case TacAssign:   return Self()->VisitAssign(static_cast<Assign*>(tac));
+        case TacLoad:     return Self()->VisitLoad(static_cast<Load*>(tac));
+        case TacStore:    return Self()->VisitStore(static_cast<Store*>(tac));
+        case TacBinaryOp: return Self()->VisitBinaryOp(static_cast<BinaryOp*>(tac));
+        case TacLabel:    return Self()->VisitLabel(static_cast<Label*>(tac));
+        case TacGoto:     return Self()->VisitGoto(static_cast<Goto*>(tac));
+        case TacIfZ:      return Self()->VisitIfZ(static_cast<IfZ*>(tac));
+        case TacIfRel:    return Self()->VisitIfRel(static_cast<IfRel*>(tac));
+        case TacBeginFunc: return Self()->VisitBeginFunc(static_cast<BeginFunc*>(tac));
+        case TacEndFunc:  return Self()->VisitEndFunc(static_cast<EndFunc*>(tac));
+        case TacReturn:   return Self()->VisitReturn(static_cast<Return*>(tac));
+        case TacPushParam: return Self()->VisitPushParam(static_cast<PushParam*>(tac));
+        case TacPopParams: return Self()->VisitPopParams(static_cast<PopParams*>(tac));
+        case TacLCall:    return Self()->VisitLCall(static_cast<LCall*>(tac));
+        case TacACall:    return Self()->VisitACall(static_cast<ACall*>(tac));
+        case TacVTable:   return Self()->VisitVTable(static_cast<VTable*>(tac));
+        case TacPhi:      return Self()->VisitPhi(static_cast<Phi*>(tac));
+        default:          break;
+      }
+      Failure("Unrecognized Tac opcode %d", tac->GetOpcode());
+      return Result();
+    }
+
+    Result VisitInstruction(Instruction *tac) { return Result(); }
+    Result VisitLoadConstant(LoadConstant *tac) { return Self()->VisitInstruction(tac); }
+    Result VisitLoadStringConstant(LoadStringConstant *tac) { return Self()->VisitInstruction(tac); }
+    Result VisitLoadLabel(LoadLabel *tac) { return Self()->VisitInstruction(tac); }
+    Result VisitAssign(Assign *tac)       { return Self()->VisitInstruction(tac); }
+    Result VisitLoad(Load *tac)           { return Self()->VisitInstruction(tac); }
+    Result VisitStore(Store *tac)         { return Self()->VisitInstruction(tac); }
+    Result VisitBinaryOp(BinaryOp *tac)   { return Self()->VisitInstruction(tac); }
+    Result VisitLabel(Label *tac)         { return Self()->VisitInstruction(tac); }
+    Result VisitGoto(Goto *tac)           { return Self()->VisitInstruction(tac); }
+    Result VisitIfZ(IfZ *tac)             { return Self()->VisitInstruction(tac); }
+    Result VisitIfRel(IfRel *tac)         { return Self()->VisitInstruction(tac); }
+    Result VisitBeginFunc(BeginFunc *tac) { return Self()->VisitInstruction(tac); }
+    Result VisitEndFunc(EndFunc *tac)     { return Self()->VisitInstruction(tac); }
+    Result VisitReturn(Return *tac)       { return Self()->VisitInstruction(tac); }
+    Result VisitPushParam(PushParam *tac) { return Self()->VisitInstruction(tac); }
+    Result VisitPopParams(PopParams *tac) { return Self()->VisitInstruction(tac); }
+    Result VisitFnCall(FnCall *tac)       { return Self()->VisitInstruction(tac); }
+    Result VisitLCall(LCall *tac)         { return Self()->VisitFnCall(tac); }
+    Result VisitACall(ACall *tac)         { return Self()->VisitFnCall(tac); }
+    Result VisitVTable(VTable *tac)       { return Self()->VisitInstruction(tac); }
+    Result VisitPhi(Phi *tac)             { return Self()->VisitInstruction(tac); }
+};
+
 
 #endif
@@ -11,6 +11,13 @@
 
 static List<const char*> debugKeys;
 static const int BufferSize = 2048;
+static RegisterAllocator registerAllocator = AutomaticAllocator;
+static int allocatorBudget = 4096;
+static Scheduling scheduling = ListScheduling;
+static const int MaxLatencies = 16;
+static struct { char unit[16]; int cycles; } latencies[MaxLatencies];
+static int numLatencies;
+static const char *latencyUnits[] = { "alu", "load", "mul", "div" };
 
 void Failure(const char *format, ...)
 {
@@ -66,17 +73,77 @@ void PrintDebug(const char *key, const char *format, ...)
 }
 
 
+// whether unit is one that GetLatency is asked about
+static bool IsLatencyUnit(const char *unit)
+{
+  for (size_t i = 0; i < sizeof(latencyUnits) / sizeof(*latencyUnits); i++)
+    if (!strcmp(latencyUnits[i], unit))
+      return true;
+  return false;
+}
+
+static void Usage()
+{
+  printf("Usage:   [-r graph|linear|auto] [-b <budget>] "
+         "[-s none|list|delayed] [-l <unit>=<cycles>] "
+         "[-d <debug-key-1> <debug-key-2> ...]\n");
+  exit(2);
+}
+
 void ParseCommandLine(int argc, char *argv[])
 {
-  if (argc == 1)
-    return;
-  
-  if (strcmp(argv[1], "-d") != 0) { // first arg is not -d
-    printf("Usage:   -d <debug-key-1> <debug-key-2> ... \n");
-    exit(2);
+  int i = 1;
+  for (; i < argc && strcmp(argv[i], "-d") != 0; i += 2)
+  {
+    if (i + 1 == argc)
+      Usage();
+    if (!strcmp(argv[i], "-r") && !strcmp(argv[i + 1], "graph"))
+      registerAllocator = GraphColoringAllocator;
+    else if (!strcmp(argv[i], "-r") && !strcmp(argv[i + 1], "linear"))
+      registerAllocator = LinearScanAllocator;
+    else if (!strcmp(argv[i], "-r") && !strcmp(argv[i + 1], "auto"))
+      registerAllocator = AutomaticAllocator;
+    else if (!strcmp(argv[i], "-b") && atoi(argv[i + 1]) > 0)
+      allocatorBudget = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-s") && !strcmp(argv[i + 1], "none"))
+      scheduling = NoScheduling;
+    else if (!strcmp(argv[i], "-s") && !strcmp(argv[i + 1], "list"))
+      scheduling = ListScheduling;
+    else if (!strcmp(argv[i], "-s") && !strcmp(argv[i + 1], "delayed"))
+      scheduling = DelayedScheduling;
+    else if (!strcmp(argv[i], "-l") && numLatencies < MaxLatencies &&
+             sscanf(argv[i + 1], "%15[a-z]=%d", latencies[numLatencies].unit,
+                    &latencies[numLatencies].cycles) == 2 &&
+             latencies[numLatencies].cycles > 0 &&
+             IsLatencyUnit(latencies[numLatencies].unit))
+      numLatencies++;
+    else
+      Usage();
   }
 
-  for (int i = 2; i < argc; i++)
+  for (i++; i < argc; i++)
     SetDebugForKey(argv[i], true);
 }
 
+RegisterAllocator GetRegisterAllocator()
+{
+  return registerAllocator;
+}
+
+int GetAllocatorBudget()
+{
+  return allocatorBudget;
+}
+
+Scheduling GetScheduling()
+{
+  return scheduling;
+}
+
+int GetLatency(const char *unit, int standard)
+{
+  for (int i = numLatencies - 1; i >= 0; i--) // the last one given wins
+    if (!strcmp(latencies[i].unit, unit))
+      return latencies[i].cycles;
+  return standard;
+}
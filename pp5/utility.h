@@ -74,10 +74,64 @@ bool IsDebugOn(const char *key);
 
 /* Function: ParseCommandLine
  * --------------------------
- * Turn on the debugging flags from the command line.  Verifies that
- * first argument is -d, and then interpret all the arguments that follow
- * as being flags to turn on.
+ * Reads the options from the command line:
+ *
+ *     dcc [-r graph|linear|auto] [-b <budget>] [-s none|list|delayed]
+ *         [-l <unit>=<cycles>] [-d <key-1> <key-2> ...]
+ *
+ * -r picks the register allocator (see GetRegisterAllocator below) and
+ * -b the budget for the automatic choice. -s picks the instruction
+ * scheduling and -l sets the latency of a unit (see GetScheduling and
+ * GetLatency below), the unit being alu, load, mul or div; -l may be
+ * given more than once. Everything after -d is taken as debugging flags
+ * to turn on.
  */
 void ParseCommandLine(int argc, char *argv[]);
+
+
+/* Function: GetRegisterAllocator()
+ * Usage: if (GetRegisterAllocator() == LinearScanAllocator) ...
+ * ------------------------------------------------------------
+ * Which register allocator the command line asked for. Graph coloring
+ * gives the better code, but its interference graph grows with the
+ * square of the values live at once; linear scan takes time linear in
+ * the size of the function. AutomaticAllocator (the default) colors
+ * the graph of each function unless the function has more Locations or
+ * more Tac instructions than GetAllocatorBudget(), and uses linear scan
+ * for it then. Such a function also stays out of SSA form, as building
+ * and leaving it takes liveness analyses of its own.
+ */
+typedef enum { AutomaticAllocator, GraphColoringAllocator,
+               LinearScanAllocator } RegisterAllocator;
+
+RegisterAllocator GetRegisterAllocator();
+int GetAllocatorBudget();
+
+
+/* Function: GetScheduling()
+ * Usage: if (GetScheduling() == DelayedScheduling) ...
+ * ----------------------------------------------------
+ * How the machine instructions of each basic block are ordered.
+ * ListScheduling (the default) reorders them so that the results of
+ * loads, multiplies and divides are not used too soon. DelayedScheduling
+ * also fills the delay slot after each branch, jump and call, and keeps
+ * the instruction after a load from using its result; its output is for
+ * a simulator run with delayed branches and loads (spim
+ * -delayed_branches -delayed_loads). NoScheduling leaves the
+ * instructions in the order they were generated.
+ */
+typedef enum { NoScheduling, ListScheduling, DelayedScheduling } Scheduling;
+
+Scheduling GetScheduling();
+
+
+/* Function: GetLatency()
+ * Usage: int cycles = GetLatency("load", 2);
+ * ------------------------------------------
+ * The cycles after which the result of an instruction of the unit can
+ * be used, as set with -l on the command line, or standard if it was
+ * not.
+ */
+int GetLatency(const char *unit, int standard);
      
 #endif